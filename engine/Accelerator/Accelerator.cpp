@@ -8,53 +8,9 @@
 #include <fstream>
 
 
-#define BUFFER_SIZE 1920
-
-void AudioAccelerator::RunSonic(int16_t *inputData, int inputSize, int16_t *outputData, int outputSize, 
-                                 int sampleRate, int numChannels, float speed) {
-
-    sonicStream stream;
-    int16_t inBuffer[BUFFER_SIZE], outBuffer[BUFFER_SIZE];
-    int shortsToRead, samplesWritten, shortsToWrite;
-    int inputedShorts = 0;
-    int outputedShorts = 0;
-
-    stream = sonicCreateStream(sampleRate, numChannels);
-    sonicSetSpeed(stream, speed);
-    do {
-        //calculate how many samples remaining to read
-        if (inputedShorts >= inputSize) {
-            shortsToRead = 0;
-        } else if (inputSize - inputedShorts < BUFFER_SIZE) {
-            shortsToRead = inputSize - inputedShorts;
-        } else {
-            shortsToRead = BUFFER_SIZE;
-        }
-        
-        if (shortsToRead == 0) {
-            sonicFlushStream(stream);
-        } else {
-            std::copy(inputData + inputedShorts, inputData + inputedShorts + shortsToRead, inBuffer);
-            inputedShorts += shortsToRead;
-            sonicWriteShortToStream(stream, inBuffer, shortsToRead / numChannels);
-            putCounts++;
-            //AppendAudioDataToWavFile("input.wav", (char*)inBuffer, shortsToRead * sizeof(int16_t));
-        }
-
-        do {
-            samplesWritten = sonicReadShortFromStream(stream, outBuffer, BUFFER_SIZE / numChannels);
-            if (samplesWritten > 0) {
-                shortsToWrite = samplesWritten * numChannels;
-                if ((outputedShorts + shortsToWrite) <= outputSize) {
-                    std::copy(outBuffer, outBuffer + shortsToWrite, outputData + outputedShorts);
-                }
-                outputedShorts += shortsToWrite;
-                //AppendAudioDataToWavFile("output.wav", (char*)outBuffer, shortsToWrite * sizeof(int16_t));
-            }
-        } while (samplesWritten > 0);
-    } while (shortsToRead > 0);
-    sonicDestroyStream(stream);
-}
+// Samples per channel written per sonicWriteShortToStream() call by handleAudioData, bounds how far
+// sonic's input buffer grows
+#define CHUNK_SAMPLES 960
 
 void AudioAccelerator::AppendAudioDataToWavFile(const char *filename, char *data, uint32_t len)
 {
@@ -141,22 +97,139 @@ void AudioAccelerator::AppendAudioDataToWavFile(const char *filename, char *data
 }
 
 AudioAccelerator::AudioAccelerator(float speed):
-                                    speed(speed), putCounts(0) {}
+                                    stream(nullptr), sampleRate(0), numChannels(0), speed(speed),
+                                    pitchEstimator(SONIC_PITCH_AMDF), channelPitchMode(SONIC_CHANNELS_MIX),
+                                    putCounts(0) {}
+
+AudioAccelerator::~AudioAccelerator() {
+    if (stream) {
+        sonicDestroyStream(stream);
+        stream = nullptr;
+    }
+}
 
-AudioAccelerator::~AudioAccelerator() {}
+void AudioAccelerator::setSpeed(float speed) {
+    this->speed = speed;
+    if (stream) {
+        sonicSetSpeed(stream, speed);
+    }
+}
+
+void AudioAccelerator::setPitchEstimator(int estimator) {
+    pitchEstimator = estimator;
+    if (stream) {
+        sonicSetPitchEstimator(stream, estimator);
+    }
+}
 
+void AudioAccelerator::setChannelPitchMode(int mode) {
+    channelPitchMode = mode;
+    if (stream) {
+        sonicSetChannelPitchMode(stream, mode);
+    }
+}
+
+void AudioAccelerator::setSpeedMap(std::shared_ptr<SpeedMap> speedMap) {
+    this->speedMap = speedMap;
+}
+
+bool AudioAccelerator::open(int sampleRate, int numChannels) {
+    if (stream && sampleRate == this->sampleRate && numChannels == this->numChannels) {
+        // Drop a tail left over from an unflushed stream, the next call starts a new signal, at the
+        // constant speed again if a speed map ran last
+        std::vector<int16_t> discard;
+        flush(discard);
+        sonicSetSpeed(stream, speed);
+        return true;
+    }
+    if (stream) {
+        sonicDestroyStream(stream);
+    }
+    this->sampleRate = sampleRate;
+    this->numChannels = numChannels;
+    stream = sonicCreateStream(sampleRate, numChannels);
+    if (!stream) {
+        // Out of memory, or a format sonic does not take
+        std::cerr << "Failed to create sonic stream: " << sampleRate << " Hz " << numChannels
+                  << " channel(s)" << std::endl;
+        this->sampleRate = 0;
+        this->numChannels = 0;
+        return false;
+    }
+    sonicSetSpeed(stream, speed);
+    sonicSetPitchEstimator(stream, pitchEstimator);
+    sonicSetChannelPitchMode(stream, channelPitchMode);
+    return true;
+}
+
+int AudioAccelerator::readAvailable(std::vector<int16_t>& output) {
+    int available = sonicSamplesAvailable(stream);
+    if (available <= 0) {
+        return 0;
+    }
+    // Read straight into the caller's buffer, sized by what sonic reports
+    size_t offset = output.size();
+    output.resize(offset + (size_t)available * numChannels);
+    int read = sonicReadShortFromStream(stream, output.data() + offset, available);
+    output.resize(offset + (size_t)read * numChannels);
+    return read;
+}
+
+int AudioAccelerator::process(const int16_t* samples, int numSamples, std::vector<int16_t>& output) {
+    if (!stream) {
+        return 0;
+    }
+    if (numSamples > 0) {
+        sonicWriteShortToStream(stream, samples, numSamples);
+        putCounts++;
+    }
+    return readAvailable(output);
+}
+
+int AudioAccelerator::flush(std::vector<int16_t>& output) {
+    if (!stream) {
+        return 0;
+    }
+    sonicFlushStream(stream);
+    return readAvailable(output);
+}
 
 bool AudioAccelerator::handleAudioData(IAudioData& audioData) {
+    int inputSize = audioData.getDataSize();
+    int channels = audioData.getChannels();
+    int numSamples = inputSize / channels;
+    const int16_t* input = audioData.getDataPointer();
+
+    int sampleRate = audioData.getSampleRate();
+    float minSpeed = speedMap ? speedMap->getMinSpeed() : speed;
 
     std::vector<int16_t> output;
-    int inputSize = audioData.getDataSize();
-    output.resize(static_cast<int>(std::ceil(inputSize/speed)));
+    // Only a hint, process() grows the output by what sonic actually produced
+    output.reserve(static_cast<size_t>(std::ceil(inputSize / minSpeed)) + CHUNK_SAMPLES * channels);
 
     // Record the start time
     auto start = std::chrono::high_resolution_clock::now();
 
-    RunSonic(audioData.getDataPointer(), inputSize, output.data(), output.size(), 
-                audioData.getSampleRate(), audioData.getChannels(), speed);
+    if (!open(sampleRate, channels)) {
+        return false;
+    }
+    if (speedMap) {
+        speedMap->reset();
+    }
+    for (int pos = 0; pos < numSamples;) {
+        int count = std::min(CHUNK_SAMPLES, numSamples - pos);
+        if (speedMap) {
+            // Cut the chunk where the map changes speed, then play it at the map's speed. sonic
+            // blends the old and the new speed over the ~30 ms of input it still holds, so the
+            // change lands near the point, not exactly on it.
+            count = (int)std::min<int64_t>(count, speedMap->samplesToNextChange(pos, sampleRate));
+            // Straight to the stream: the constant speed stays for runs without the map
+            sonicSetSpeed(stream, speedMap->speedFor(input + (size_t)pos * channels, count, channels, sampleRate, pos));
+        }
+        process(input + (size_t)pos * channels, count, output);
+        pos += count;
+    }
+    flush(output);
 
     // Record the end time
     auto end = std::chrono::high_resolution_clock::now();
@@ -167,7 +240,7 @@ bool AudioAccelerator::handleAudioData(IAudioData& audioData) {
     // Print the duration
     std::cout << "RunSonic execution time: " << duration.count() << " milliseconds. put count: "<<putCounts<< std::endl;
     std::cout << "Length of output: " << output.size() << " input: "<< inputSize
-              << " sample rate: "<<audioData.getSampleRate()<<" channel:"<<audioData.getChannels()<< std::endl;
+              << " sample rate: "<<sampleRate<<" channel:"<<channels<< std::endl;
     
     audioData.updateData(output);
     return true;
@@ -2,11 +2,16 @@
 #define ACCELERATOR_H
 
 #include <cstdint>
+#include <memory>
 #include <vector>
 #include "IAudioData.h"
 #include "IAudioDataHandler.h"
+#include "SpeedMap.h"
 #include "sonic.h"
 
+// Time-stretches with sonic. The stream is kept across calls (it is only recreated when the sample
+// rate or channel count changes), so it can also be fed frame by frame with process() while the
+// speed changes in between.
 class AudioAccelerator : public IAudioDataHandler{
 public:
     AudioAccelerator(float speed);
@@ -14,12 +19,48 @@ public:
 
     bool handleAudioData(IAudioData& audioData);
 
+    // Takes effect for the samples written after the call. Output sonic already produced keeps its
+    // speed, but the input it still holds unprocessed (up to two of the longest pitch periods,
+    // about 30 ms) is stretched at the mean speed of everything buffered, so a change blends in
+    // over that span rather than at an exact sample.
+    void setSpeed(float speed);
+    float getSpeed() const { return speed; }
+    // How pitch periods are found, see sonicSetPitchEstimator(). The default, SONIC_PITCH_AMDF, is
+    // the cheapest; SONIC_PITCH_FFT costs about 2-3x (8 kHz) to 10x (48 kHz) as much per search
+    // and hardly ever misses the period.
+    void setPitchEstimator(int estimator);
+    // How the pitch of multi-channel input is found, see sonicSetChannelPitchMode(). The default,
+    // SONIC_CHANNELS_MIX, is the cheapest. SONIC_CHANNELS_JOINT costs about twice as much per
+    // search and only pays off with SONIC_PITCH_FFT, on wide or out-of-phase stereo where the mix
+    // cancels out.
+    void setChannelPitchMode(int mode);
+    // handleAudioData takes the speed of every chunk from the map instead (nullptr: back to the
+    // constant speed)
+    void setSpeedMap(std::shared_ptr<SpeedMap> speedMap);
+    // Creates the stream, or resets it if the format changed (dropping whatever it still held).
+    // Returns false if sonic could not create it; process() and flush() then produce nothing.
+    bool open(int sampleRate, int numChannels);
+    // Streams numSamples (per channel) from samples and appends everything sonic has ready to
+    // output, returns the number of samples per channel appended
+    int process(const int16_t* samples, int numSamples, std::vector<int16_t>& output);
+    // End of the stream: appends what sonic still holds
+    int flush(std::vector<int16_t>& output);
+
 private:
+    AudioAccelerator(const AudioAccelerator&) = delete;
+    AudioAccelerator& operator=(const AudioAccelerator&) = delete;
+
+    int readAvailable(std::vector<int16_t>& output);
+    void AppendAudioDataToWavFile(const char *filename, char *data, uint32_t len);
+
+    sonicStream stream;
+    int sampleRate;
+    int numChannels;
     float speed;
+    int pitchEstimator;
+    int channelPitchMode;
+    std::shared_ptr<SpeedMap> speedMap;
     int putCounts;
-    void RunSonic(int16_t *inputData, int inputSize, int16_t *outputData, int outputSize, 
-                    int sampleRate, int numChannels, float speed);
-    void AppendAudioDataToWavFile(const char *filename, char *data, uint32_t len);
 };
 
 #endif // ACCELERATOR_H
\ No newline at end of file
@@ -0,0 +1,147 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "sonic.h"
+
+/* Compares the sonic pitch estimators on a synthetic voice whose pitch is
+   known: the down-sampled AMDF (default), the full-rate AMDF (quality 1) and
+   the FFT autocorrelation.  Reports the cost per estimate, how often the
+   estimate is off by more than 5% (and how many of those are octave errors),
+   and the mean error of the others.  Stereo input is also run with the
+   joint (per-channel) pitch mode, and with the right channel phase inverted
+   (as in wide stereo mixes), which cancels out when the channels are mixed
+   down.
+
+   Usage: PitchBench [seconds] */
+
+typedef struct {
+  const char* name;
+  int estimator;
+  int quality;
+  int channelMode;
+} Config;
+
+static const Config configs[] = {
+    {"amdf", SONIC_PITCH_AMDF, 0, SONIC_CHANNELS_MIX},
+    {"amdf-q1", SONIC_PITCH_AMDF, 1, SONIC_CHANNELS_MIX},
+    {"fft", SONIC_PITCH_FFT, 0, SONIC_CHANNELS_MIX},
+    {"amdf-jnt", SONIC_PITCH_AMDF, 0, SONIC_CHANNELS_JOINT},
+    {"fft-jnt", SONIC_PITCH_FFT, 0, SONIC_CHANNELS_JOINT},
+};
+
+#define NUM_MIXED_CONFIGS 3
+#define NUM_CONFIGS (int)(sizeof(configs) / sizeof(configs[0]))
+
+/* Test signals */
+#define VOICE_FULL 0
+#define VOICE_NO_FUNDAMENTAL 1
+#define VOICE_INVERTED 2
+
+static const char* voiceNames[] = {"full voice", "voice without fundamental",
+                                   "stereo voice, right channel inverted"};
+
+static double cpuSeconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Harmonics 1 (or 2) to 8 of a 90-280 Hz glide plus noise, the pitch of
+   every sample goes to pitch[].  The noise is different in each channel. */
+static short* makeVoice(int sampleRate, int numChannels, int numSamples,
+                        int voice, double* pitch) {
+  int firstHarmonic = voice == VOICE_NO_FUNDAMENTAL ? 2 : 1;
+  double gain = voice == VOICE_INVERTED ? -0.9 : 0.7;
+  short* samples = (short*)malloc(sizeof(short) * numSamples * numChannels);
+  double phase = 0.0;
+  unsigned int noise = 1;
+  int i, c, h;
+
+  for (i = 0; i < numSamples; i++) {
+    double t = (double)i / sampleRate;
+    double value = 0.0;
+    pitch[i] = 185.0 + 95.0 * sin(2 * M_PI * 0.4 * t);
+    phase += 2 * M_PI * pitch[i] / sampleRate;
+    for (h = firstHarmonic; h <= 8; h++) {
+      value += sin(h * phase + h) / h;
+    }
+    value *= 6000.0;
+    for (c = 0; c < numChannels; c++) {
+      noise = noise * 1103515245 + 12345;
+      samples[i * numChannels + c] =
+          (short)((c == 0 ? value : value * gain) +
+                  ((int)(noise >> 16) % 1200 - 600));
+    }
+  }
+  return samples;
+}
+
+static void runConfig(const Config* config, const short* input, int numSamples,
+                      const double* pitch, int sampleRate, int numChannels) {
+  sonicStream stream = sonicCreateStream(sampleRate, numChannels);
+  int window, hop = sampleRate / 100;
+  int pos, estimates = 0, gross = 0, octave = 0;
+  double error = 0.0, start, elapsed;
+
+  sonicSetQuality(stream, config->quality);
+  sonicSetPitchEstimator(stream, config->estimator);
+  sonicSetChannelPitchMode(stream, config->channelMode);
+  window = sonicGetPitchWindow(stream);
+  start = cpuSeconds();
+  for (pos = 0; pos + window <= numSamples; pos += hop) {
+    int period = sonicEstimatePitchPeriod(
+        stream, (short*)input + pos * numChannels);
+    double truePeriod = sampleRate / pitch[pos + window / 2];
+    double ratio = period / truePeriod;
+
+    if (fabs(ratio - 1.0) > 0.05) {
+      gross++;
+      if (fabs(ratio - 2.0) < 0.1 || fabs(ratio - 0.5) < 0.05) {
+        octave++;
+      }
+    } else {
+      error += fabs(ratio - 1.0);
+    }
+    estimates++;
+  }
+  elapsed = cpuSeconds() - start;
+  printf("%-6d %-3d %-8s %10.1f %9.2f%% %8d %9.2f%%\n", sampleRate,
+         numChannels, config->name, elapsed * 1e6 / estimates,
+         100.0 * gross / estimates, octave,
+         estimates > gross ? 100.0 * error / (estimates - gross) : 0.0);
+  sonicDestroyStream(stream);
+}
+
+int main(int argc, char** argv) {
+  static const int rates[] = {8000, 16000, 48000};
+  int seconds = argc > 1 ? atoi(argv[1]) : 20;
+  int r, c, voice, numChannels;
+
+  if (seconds <= 0) {
+    fprintf(stderr, "Usage: %s [seconds]\n", argv[0]);
+    return 1;
+  }
+  for (voice = VOICE_FULL; voice <= VOICE_INVERTED; voice++) {
+    printf("%s, %d s\n", voiceNames[voice], seconds);
+    printf("%-6s %-3s %-8s %10s %10s %8s %10s\n", "rate", "ch", "method",
+           "us/call", "gross", "octave", "mean err");
+    for (r = 0; r < 3; r++) {
+      for (numChannels = voice == VOICE_INVERTED ? 2 : 1; numChannels <= 2;
+           numChannels++) {
+        int numSamples = rates[r] * seconds;
+        double* pitch = (double*)malloc(sizeof(double) * numSamples);
+        short* input =
+            makeVoice(rates[r], numChannels, numSamples, voice, pitch);
+        int numConfigs = numChannels == 1 ? NUM_MIXED_CONFIGS : NUM_CONFIGS;
+        for (c = 0; c < numConfigs; c++) {
+          runConfig(&configs[c], input, numSamples, pitch, rates[r],
+                    numChannels);
+        }
+        free(input);
+        free(pitch);
+      }
+    }
+  }
+  return 0;
+}
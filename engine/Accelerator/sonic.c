@@ -13,6 +13,20 @@
 #include <stdlib.h>
 #include <string.h>
 
+/* SIMD kernels for the pitch search, the overlap-add and the down-sampling.
+   SSE2 is always there on x86-64, AVX2 is picked at run time, NEON is always
+   there on ARM64.  The pitch search, the overlap-add and the down-sampling
+   have NEON kernels too; on ARM64 (the Apple Silicon build the engine ships
+   for) only the rate-change interpolation runs the plain C code.
+   sonic_kernel_test.c checks every kernel against the plain C one. */
+#if defined(__x86_64__) && defined(__GNUC__)
+#define SONIC_SAD_X86
+#include <immintrin.h>
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+#define SONIC_SAD_NEON
+#include <arm_neon.h>
+#endif
+
 /*
     The following code was used to generate the following sinc lookup table.
 
@@ -54,6 +68,24 @@
   12 /* I am not able to hear improvement with higher N. */
 #define SINC_TABLE_SIZE 601
 
+/* The FFT pitch estimator takes the shortest period whose normalized
+   correlation is at least this fraction of the best one. */
+#define SONIC_NCC_THRESHOLD 0.9
+
+/* Largest polyphase table of sinc weights kept for a rate change, in phases
+   of SINC_FILTER_POINTS weights.  Pairs of rates with more phases compute the
+   weights for every output frame. */
+#define SONIC_MAX_SINC_PHASES 1024
+
+/* Alignment of the blocks handed out of a stream's arena. */
+#define SONIC_ARENA_ALIGN 16
+#define arenaAlign(len) \
+  (((len) + SONIC_ARENA_ALIGN - 1) & ~(SONIC_ARENA_ALIGN - 1))
+
+/* The per-channel pitch modes handle up to this many channels, more are
+   mixed down. */
+#define SONIC_MAX_PITCH_CHANNELS 8
+
 /* Lookup table for windowed sinc function of SINC_FILTER_POINTS points. */
 static short sincTable[SINC_TABLE_SIZE] = {
     0,     0,     0,     0,     0,     0,     0,     -1,    -1,    -2,    -2,
@@ -183,6 +215,641 @@ static void sonicFree(void *p) {
 
 #endif
 
+/* Sum of absolute differences between two runs of samples.  Each difference
+   is taken as an unsigned 16-bit value, so every kernel gives exactly the same
+   sum as the scalar one. */
+typedef unsigned long (*sonicSadFunc)(const short* s, const short* p, int n);
+
+/* Plain C sum of absolute differences. */
+static unsigned long sadScalar(const short* s, const short* p, int n) {
+  unsigned long diff = 0;
+  short sVal, pVal;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    sVal = *s++;
+    pVal = *p++;
+    diff += sVal >= pVal ? (unsigned short)(sVal - pVal)
+                         : (unsigned short)(pVal - sVal);
+  }
+  return diff;
+}
+
+#ifdef SONIC_SAD_X86
+
+/* max - min of two signed shorts is the absolute difference as an unsigned
+   short, which is then widened to 32 bits before adding up. */
+static unsigned long sadSse2(const short* s, const short* p, int n) {
+  __m128i zero = _mm_setzero_si128();
+  __m128i acc = zero;
+  unsigned int lanes[4];
+  int i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    __m128i a = _mm_loadu_si128((const __m128i*)(s + i));
+    __m128i b = _mm_loadu_si128((const __m128i*)(p + i));
+    __m128i d = _mm_sub_epi16(_mm_max_epi16(a, b), _mm_min_epi16(a, b));
+    acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(d, zero));
+    acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(d, zero));
+  }
+  _mm_storeu_si128((__m128i*)lanes, acc);
+  return (unsigned long)lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+         sadScalar(s + i, p + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static unsigned long sadAvx2(const short* s, const short* p, int n) {
+  __m256i zero = _mm256_setzero_si256();
+  __m256i acc = zero;
+  unsigned int lanes[8];
+  unsigned long diff = 0;
+  int i, j;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    __m256i a = _mm256_loadu_si256((const __m256i*)(s + i));
+    __m256i b = _mm256_loadu_si256((const __m256i*)(p + i));
+    __m256i d = _mm256_sub_epi16(_mm256_max_epi16(a, b), _mm256_min_epi16(a, b));
+    acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(d, zero));
+    acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(d, zero));
+  }
+  _mm256_storeu_si256((__m256i*)lanes, acc);
+  /* Calling the SSE2 code with the upper halves still dirty is slower than
+     the plain C search on some CPUs, so finish without leaving AVX. */
+  _mm256_zeroupper();
+  for (j = 0; j < 8; j++) {
+    diff += lanes[j];
+  }
+  for (; i < n; i++) {
+    diff += s[i] >= p[i] ? (unsigned short)(s[i] - p[i])
+                         : (unsigned short)(p[i] - s[i]);
+  }
+  return diff;
+}
+
+#endif  /* SONIC_SAD_X86 */
+
+#ifdef SONIC_SAD_NEON
+
+/* vabd gives |a - b| truncated to 16 bits, which read as unsigned is exact. */
+static unsigned long sadNeon(const short* s, const short* p, int n) {
+  uint32x4_t acc = vdupq_n_u32(0);
+  int i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    int16x8_t d = vabdq_s16(vld1q_s16(s + i), vld1q_s16(p + i));
+    acc = vpadalq_u16(acc, vreinterpretq_u16_s16(d));
+  }
+  return (unsigned long)vgetq_lane_u32(acc, 0) + vgetq_lane_u32(acc, 1) +
+         vgetq_lane_u32(acc, 2) + vgetq_lane_u32(acc, 3) +
+         sadScalar(s + i, p + i, n - i);
+}
+
+#endif  /* SONIC_SAD_NEON */
+
+/* Exact division by a constant with a multiply and a shift (Granlund and
+   Montgomery): for 0 <= x < 2^bits, x / divisor is (x * multiplier) >> shift,
+   with shift = bits + l, multiplier = ceil(2^shift / divisor) and 2^l the
+   first power of two >= divisor.  The kernels below divide sums of shorts
+   whose weights add up to divisor, so bits = 16 + l, which keeps the
+   multiplier in 32 bits and the product in 64 bits for divisors below
+   SONIC_MAX_RECIPROCAL. */
+typedef struct {
+  unsigned int multiplier;
+  int shift;
+} sonicReciprocal;
+
+#define SONIC_MAX_RECIPROCAL 32768
+
+static sonicReciprocal findReciprocal(int divisor) {
+  sonicReciprocal r;
+  int l = 0;
+
+  while ((1 << l) < divisor) {
+    l++;
+  }
+  r.shift = 16 + 2 * l;
+  r.multiplier = (unsigned int)((((unsigned long long)1 << r.shift) +
+                                 divisor - 1) / divisor);
+  return r;
+}
+
+/* Overlap two runs of numSamples frames, ramp the volume of rampDown down,
+   while ramping rampUp from zero up, and add them, storing the result at
+   out. */
+typedef void (*sonicOverlapFunc)(int numSamples, int numChannels, short* out,
+                                 const short* rampDown, const short* rampUp);
+
+/* Average each run of samplesPerValue samples into one of numValues
+   values. */
+typedef void (*sonicDownSampleFunc)(const short* samples, short* out,
+                                    int numValues, int samplesPerValue);
+
+/* Plain C overlap-add. */
+static void overlapAddScalar(int numSamples, int numChannels, short* out,
+                             const short* rampDown, const short* rampUp) {
+  short* o;
+  const short* u;
+  const short* d;
+  int i, t;
+
+  for (i = 0; i < numChannels; i++) {
+    o = out + i;
+    u = rampUp + i;
+    d = rampDown + i;
+    for (t = 0; t < numSamples; t++) {
+#ifdef SONIC_USE_SIN
+      float ratio = sin(t * M_PI / (2 * numSamples));
+      *o = *d * (1.0f - ratio) + *u * ratio;
+#else
+      *o = (*d * (numSamples - t) + *u * t) / numSamples;
+#endif
+      o += numChannels;
+      d += numChannels;
+      u += numChannels;
+    }
+  }
+}
+
+/* Plain C down-sampling. */
+static void downSampleScalar(const short* samples, short* out, int numValues,
+                             int samplesPerValue) {
+  int i, j;
+  int value;
+
+  for (i = 0; i < numValues; i++) {
+    value = 0;
+    for (j = 0; j < samplesPerValue; j++) {
+      value += *samples++;
+    }
+    value /= samplesPerValue;
+    *out++ = value;
+  }
+}
+
+/* Compute one output frame of the rate change: the SINC_FILTER_POINTS taps
+   of every channel, starting at in, times weights.  The sum is kept in 64
+   bits, and clipped if it does not fit in 32. */
+typedef void (*sonicInterpolateFunc)(const short* in, int numChannels,
+                                     const int* weights, short* out);
+
+/* Scale a filter sum to a sample.  It is better to clip than to wrap if there
+   was an overflow. */
+static short clipFilterSum(long long total) {
+  if (total > INT_MAX) {
+    return SHRT_MAX;
+  } else if (total < INT_MIN) {
+    return SHRT_MIN;
+  }
+  return (int)total >> 16;
+}
+
+/* Plain C interpolation. */
+static void interpolateScalar(const short* in, int numChannels,
+                              const int* weights, short* out) {
+  long long total;
+  int i, c;
+
+  for (c = 0; c < numChannels; c++) {
+    total = 0;
+    for (i = 0; i < SINC_FILTER_POINTS; i++) {
+      total += in[i * numChannels + c] * weights[i];
+    }
+    out[c] = clipFilterSum(total);
+  }
+}
+
+#if defined(SONIC_SAD_X86) || defined(SONIC_SAD_NEON)
+
+/* The overlap-add of the interleaved values from start on, the same math as
+   overlapAddScalar. */
+static void overlapAddTail(int numSamples, int numChannels, short* out,
+                           const short* rampDown, const short* rampUp,
+                           int start) {
+  int total = numSamples * numChannels;
+  int i, t;
+
+  for (i = start; i < total; i++) {
+    t = i / numChannels;
+    out[i] = (rampDown[i] * (numSamples - t) + rampUp[i] * t) / numSamples;
+  }
+}
+
+#endif
+
+#ifdef SONIC_SAD_X86
+
+/* Divide four ints by a reciprocal, rounding toward zero like C does: the
+   magnitude is divided with 32x32->64 bit multiplies, then the sign is put
+   back. */
+static __m128i divideSse2(__m128i x, __m128i multiplier, __m128i shift) {
+  __m128i sign = _mm_srai_epi32(x, 31);
+  __m128i a = _mm_sub_epi32(_mm_xor_si128(x, sign), sign);
+  __m128i even = _mm_srl_epi64(_mm_mul_epu32(a, multiplier), shift);
+  __m128i odd =
+      _mm_srl_epi64(_mm_mul_epu32(_mm_srli_epi64(a, 32), multiplier), shift);
+  __m128i q = _mm_or_si128(_mm_and_si128(even, _mm_set_epi32(0, -1, 0, -1)),
+                           _mm_slli_epi64(odd, 32));
+  return _mm_sub_epi32(_mm_xor_si128(q, sign), sign);
+}
+
+/* Eight interleaved values at a time, when the channels divide eight so that
+   every lane keeps its place in the ramp.  madd computes
+   down * (numSamples - t) + up * t exactly in 32 bits. */
+static void overlapAddSse2(int numSamples, int numChannels, short* out,
+                           const short* rampDown, const short* rampUp) {
+  int total = numSamples * numChannels;
+  int i = 0, j;
+
+  /* Nothing to add, and no reciprocal of zero */
+  if (numSamples <= 0) {
+    return;
+  }
+
+  if (8 % numChannels == 0 && numSamples < SONIC_MAX_RECIPROCAL) {
+    sonicReciprocal r = findReciprocal(numSamples);
+    __m128i multiplier = _mm_set1_epi32((int)r.multiplier);
+    __m128i shift = _mm_cvtsi32_si128(r.shift);
+    __m128i n = _mm_set1_epi16((short)numSamples);
+    __m128i step = _mm_set1_epi16((short)(8 / numChannels));
+    short lanes[8];
+    __m128i t;
+
+    for (j = 0; j < 8; j++) {
+      lanes[j] = j / numChannels;
+    }
+    t = _mm_loadu_si128((const __m128i*)lanes);
+    for (; i + 8 <= total; i += 8) {
+      __m128i d = _mm_loadu_si128((const __m128i*)(rampDown + i));
+      __m128i u = _mm_loadu_si128((const __m128i*)(rampUp + i));
+      __m128i w = _mm_sub_epi16(n, t);
+      __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi16(d, u),
+                                  _mm_unpacklo_epi16(w, t));
+      __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi16(d, u),
+                                  _mm_unpackhi_epi16(w, t));
+      _mm_storeu_si128((__m128i*)(out + i),
+                       _mm_packs_epi32(divideSse2(lo, multiplier, shift),
+                                       divideSse2(hi, multiplier, shift)));
+      t = _mm_add_epi16(t, step);
+    }
+  }
+  overlapAddTail(numSamples, numChannels, out, rampDown, rampUp, i);
+}
+
+__attribute__((target("avx2")))
+static __m256i divideAvx2(__m256i x, __m256i multiplier, __m128i shift) {
+  __m256i sign = _mm256_srai_epi32(x, 31);
+  __m256i a = _mm256_sub_epi32(_mm256_xor_si256(x, sign), sign);
+  __m256i even = _mm256_srl_epi64(_mm256_mul_epu32(a, multiplier), shift);
+  __m256i odd = _mm256_srl_epi64(
+      _mm256_mul_epu32(_mm256_srli_epi64(a, 32), multiplier), shift);
+  __m256i q = _mm256_or_si256(
+      _mm256_and_si256(even, _mm256_set1_epi64x(0xffffffff)),
+      _mm256_slli_epi64(odd, 32));
+  return _mm256_sub_epi32(_mm256_xor_si256(q, sign), sign);
+}
+
+/* Sixteen values at a time.  The unpacks and the pack both work within the
+   128-bit halves, which leaves the results in order. */
+__attribute__((target("avx2")))
+static void overlapAddAvx2(int numSamples, int numChannels, short* out,
+                           const short* rampDown, const short* rampUp) {
+  int total = numSamples * numChannels;
+  int i = 0, j;
+
+  if (numSamples <= 0) {
+    return;
+  }
+
+  if (16 % numChannels == 0 && numSamples < SONIC_MAX_RECIPROCAL) {
+    sonicReciprocal r = findReciprocal(numSamples);
+    __m256i multiplier = _mm256_set1_epi32((int)r.multiplier);
+    __m128i shift = _mm_cvtsi32_si128(r.shift);
+    __m256i n = _mm256_set1_epi16((short)numSamples);
+    __m256i step = _mm256_set1_epi16((short)(16 / numChannels));
+    short lanes[16];
+    __m256i t;
+
+    for (j = 0; j < 16; j++) {
+      lanes[j] = j / numChannels;
+    }
+    t = _mm256_loadu_si256((const __m256i*)lanes);
+    for (; i + 16 <= total; i += 16) {
+      __m256i d = _mm256_loadu_si256((const __m256i*)(rampDown + i));
+      __m256i u = _mm256_loadu_si256((const __m256i*)(rampUp + i));
+      __m256i w = _mm256_sub_epi16(n, t);
+      __m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi16(d, u),
+                                     _mm256_unpacklo_epi16(w, t));
+      __m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi16(d, u),
+                                     _mm256_unpackhi_epi16(w, t));
+      _mm256_storeu_si256(
+          (__m256i*)(out + i),
+          _mm256_packs_epi32(divideAvx2(lo, multiplier, shift),
+                             divideAvx2(hi, multiplier, shift)));
+      t = _mm256_add_epi16(t, step);
+    }
+    _mm256_zeroupper();
+  }
+  overlapAddTail(numSamples, numChannels, out, rampDown, rampUp, i);
+}
+
+/* Four values at a time: madd against ones sums pairs of samples into 32-bit
+   lanes, the last partial vector of a value is masked, and the four partial
+   sums are transposed and added up.  Pairs (stereo mixed down at the full
+   rate) take a single madd for four values. */
+static void downSampleSse2(const short* samples, short* out, int numValues,
+                           int samplesPerValue) {
+  sonicReciprocal r;
+  __m128i multiplier, shift;
+  __m128i ones = _mm_set1_epi16(1);
+  int full = samplesPerValue & ~7;
+  int rest = samplesPerValue & 7;
+  int end = numValues * samplesPerValue;
+  int i = 0, j, v;
+
+  if (samplesPerValue >= SONIC_MAX_RECIPROCAL) {
+    downSampleScalar(samples, out, numValues, samplesPerValue);
+    return;
+  }
+  r = findReciprocal(samplesPerValue);
+  multiplier = _mm_set1_epi32((int)r.multiplier);
+  shift = _mm_cvtsi32_si128(r.shift);
+  if (samplesPerValue == 2) {
+    for (; i + 4 <= numValues; i += 4) {
+      __m128i sum = _mm_madd_epi16(
+          _mm_loadu_si128((const __m128i*)(samples + 2 * i)), ones);
+      __m128i q = divideSse2(sum, multiplier, shift);
+      _mm_storel_epi64((__m128i*)(out + i), _mm_packs_epi32(q, q));
+    }
+  } else {
+    short maskLanes[8];
+    __m128i mask;
+
+    for (j = 0; j < 8; j++) {
+      maskLanes[j] = j < rest ? -1 : 0;
+    }
+    mask = _mm_loadu_si128((const __m128i*)maskLanes);
+    /* The masked load of a value reads up to 7 samples past its end */
+    for (; (i + 4) * samplesPerValue + (rest ? 8 - rest : 0) <= end; i += 4) {
+      __m128i sums[4], a, b, q;
+
+      for (v = 0; v < 4; v++) {
+        const short* p = samples + (i + v) * samplesPerValue;
+        __m128i acc = _mm_setzero_si128();
+        for (j = 0; j < full; j += 8) {
+          acc = _mm_add_epi32(
+              acc,
+              _mm_madd_epi16(_mm_loadu_si128((const __m128i*)(p + j)), ones));
+        }
+        if (rest) {
+          __m128i tail = _mm_and_si128(
+              _mm_loadu_si128((const __m128i*)(p + full)), mask);
+          acc = _mm_add_epi32(acc, _mm_madd_epi16(tail, ones));
+        }
+        sums[v] = acc;
+      }
+      a = _mm_add_epi32(_mm_unpacklo_epi32(sums[0], sums[1]),
+                        _mm_unpackhi_epi32(sums[0], sums[1]));
+      b = _mm_add_epi32(_mm_unpacklo_epi32(sums[2], sums[3]),
+                        _mm_unpackhi_epi32(sums[2], sums[3]));
+      q = divideSse2(
+          _mm_add_epi32(_mm_unpacklo_epi64(a, b), _mm_unpackhi_epi64(a, b)),
+          multiplier, shift);
+      _mm_storel_epi64((__m128i*)(out + i), _mm_packs_epi32(q, q));
+    }
+  }
+  downSampleScalar(samples + i * samplesPerValue, out + i, numValues - i,
+                   samplesPerValue);
+}
+
+#if SINC_FILTER_POINTS == 12
+
+/* Mono and stereo frames with AVX2: the products fit in 32 bits, and are
+   widened to 64 bits to be added up.  For stereo the weights are doubled up
+   so that both channels are done at once, in alternate lanes. */
+__attribute__((target("avx2")))
+static void interpolateAvx2(const short* in, int numChannels,
+                            const int* weights, short* out) {
+  __m256i w = _mm256_loadu_si256((const __m256i*)weights);
+  __m256i sum, p;
+  __m128i half;
+
+  if (numChannels == 1) {
+    p = _mm256_mullo_epi32(
+        _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)in)), w);
+    sum = _mm256_add_epi64(_mm256_cvtepi32_epi64(_mm256_castsi256_si128(p)),
+                           _mm256_cvtepi32_epi64(_mm256_extracti128_si256(p, 1)));
+    half = _mm_mullo_epi32(
+        _mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i*)(in + 8))),
+        _mm_loadu_si128((const __m128i*)(weights + 8)));
+    sum = _mm256_add_epi64(sum, _mm256_cvtepi32_epi64(half));
+    half = _mm_add_epi64(_mm256_castsi256_si128(sum),
+                         _mm256_extracti128_si256(sum, 1));
+    _mm256_zeroupper();
+    out[0] = clipFilterSum(_mm_cvtsi128_si64(half) +
+                           _mm_cvtsi128_si64(_mm_unpackhi_epi64(half, half)));
+  } else if (numChannels == 2) {
+    __m256i low = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+    __m256i high = _mm256_setr_epi32(4, 4, 5, 5, 6, 6, 7, 7);
+    __m256i last = _mm256_permutevar8x32_epi32(
+        _mm256_loadu_si256((const __m256i*)(weights + 4)), high);
+    int j;
+
+    sum = _mm256_setzero_si256();
+    for (j = 0; j < 3; j++) {
+      __m256i weight = j == 0   ? _mm256_permutevar8x32_epi32(w, low)
+                       : j == 1 ? _mm256_permutevar8x32_epi32(w, high)
+                                : last;
+      p = _mm256_mullo_epi32(
+          _mm256_cvtepi16_epi32(
+              _mm_loadu_si128((const __m128i*)(in + 8 * j))),
+          weight);
+      sum = _mm256_add_epi64(sum,
+                             _mm256_cvtepi32_epi64(_mm256_castsi256_si128(p)));
+      sum = _mm256_add_epi64(
+          sum, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(p, 1)));
+    }
+    half = _mm_add_epi64(_mm256_castsi256_si128(sum),
+                         _mm256_extracti128_si256(sum, 1));
+    _mm256_zeroupper();
+    out[0] = clipFilterSum(_mm_cvtsi128_si64(half));
+    out[1] = clipFilterSum(_mm_cvtsi128_si64(_mm_unpackhi_epi64(half, half)));
+  } else {
+    _mm256_zeroupper();
+    interpolateScalar(in, numChannels, weights, out);
+  }
+}
+
+#endif  /* SINC_FILTER_POINTS == 12 */
+
+#endif  /* SONIC_SAD_X86 */
+
+#ifdef SONIC_SAD_NEON
+
+/* Divide four ints by a reciprocal, rounding toward zero like C does: the
+   magnitude is divided with 32x32->64 bit multiplies, then the sign is put
+   back.  shift holds the negated shift, as vshl shifts right by a negative
+   count. */
+static int32x4_t divideNeon(int32x4_t x, uint32x2_t multiplier,
+                            int64x2_t shift) {
+  int32x4_t sign = vshrq_n_s32(x, 31);
+  uint32x4_t a = vreinterpretq_u32_s32(vsubq_s32(veorq_s32(x, sign), sign));
+  uint64x2_t lo = vshlq_u64(vmull_u32(vget_low_u32(a), multiplier), shift);
+  uint64x2_t hi = vshlq_u64(vmull_u32(vget_high_u32(a), multiplier), shift);
+  int32x4_t q =
+      vreinterpretq_s32_u32(vcombine_u32(vmovn_u64(lo), vmovn_u64(hi)));
+  return vsubq_s32(veorq_s32(q, sign), sign);
+}
+
+/* Eight interleaved values at a time, when the channels divide eight, like
+   overlapAddSse2: vmull/vmlal compute down * (numSamples - t) + up * t
+   exactly in 32 bits. */
+static void overlapAddNeon(int numSamples, int numChannels, short* out,
+                           const short* rampDown, const short* rampUp) {
+  int total = numSamples * numChannels;
+  int i = 0, j;
+
+  if (numSamples <= 0) {
+    return;
+  }
+
+  if (8 % numChannels == 0 && numSamples < SONIC_MAX_RECIPROCAL) {
+    sonicReciprocal r = findReciprocal(numSamples);
+    uint32x2_t multiplier = vdup_n_u32(r.multiplier);
+    int64x2_t shift = vdupq_n_s64(-r.shift);
+    int16x8_t n = vdupq_n_s16((short)numSamples);
+    int16x8_t step = vdupq_n_s16((short)(8 / numChannels));
+    short lanes[8];
+    int16x8_t t;
+
+    for (j = 0; j < 8; j++) {
+      lanes[j] = j / numChannels;
+    }
+    t = vld1q_s16(lanes);
+    for (; i + 8 <= total; i += 8) {
+      int16x8_t d = vld1q_s16(rampDown + i);
+      int16x8_t u = vld1q_s16(rampUp + i);
+      int16x8_t w = vsubq_s16(n, t);
+      int32x4_t lo = vmlal_s16(vmull_s16(vget_low_s16(d), vget_low_s16(w)),
+                               vget_low_s16(u), vget_low_s16(t));
+      int32x4_t hi =
+          vmlal_s16(vmull_s16(vget_high_s16(d), vget_high_s16(w)),
+                    vget_high_s16(u), vget_high_s16(t));
+      vst1q_s16(out + i,
+                vcombine_s16(vqmovn_s32(divideNeon(lo, multiplier, shift)),
+                             vqmovn_s32(divideNeon(hi, multiplier, shift))));
+      t = vaddq_s16(t, step);
+    }
+  }
+  overlapAddTail(numSamples, numChannels, out, rampDown, rampUp, i);
+}
+
+/* Four values at a time: vpadal adds pairs of samples into 32-bit lanes, the
+   last few samples of a value are added on their own (no masked loads, so
+   nothing is read past the input), and the four sums are divided at once.
+   Pairs (stereo mixed down at the full rate) take a single vpaddl for four
+   values. */
+static void downSampleNeon(const short* samples, short* out, int numValues,
+                           int samplesPerValue) {
+  sonicReciprocal r;
+  uint32x2_t multiplier;
+  int64x2_t shift;
+  int full = samplesPerValue & ~7;
+  int i = 0, j, v;
+
+  if (samplesPerValue >= SONIC_MAX_RECIPROCAL) {
+    downSampleScalar(samples, out, numValues, samplesPerValue);
+    return;
+  }
+  r = findReciprocal(samplesPerValue);
+  multiplier = vdup_n_u32(r.multiplier);
+  shift = vdupq_n_s64(-r.shift);
+  if (samplesPerValue == 2) {
+    for (; i + 4 <= numValues; i += 4) {
+      int32x4_t q = divideNeon(vpaddlq_s16(vld1q_s16(samples + 2 * i)),
+                               multiplier, shift);
+      vst1_s16(out + i, vqmovn_s32(q));
+    }
+  } else {
+    for (; i + 4 <= numValues; i += 4) {
+      int sums[4];
+
+      for (v = 0; v < 4; v++) {
+        const short* p = samples + (i + v) * samplesPerValue;
+        int32x4_t acc = vdupq_n_s32(0);
+        int32x2_t half;
+        int sum;
+
+        for (j = 0; j < full; j += 8) {
+          acc = vpadalq_s16(acc, vld1q_s16(p + j));
+        }
+        half = vadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+        sum = vget_lane_s32(vpadd_s32(half, half), 0);
+        for (j = full; j < samplesPerValue; j++) {
+          sum += p[j];
+        }
+        sums[v] = sum;
+      }
+      vst1_s16(out + i,
+               vqmovn_s32(divideNeon(vld1q_s32(sums), multiplier, shift)));
+    }
+  }
+  downSampleScalar(samples + i * samplesPerValue, out + i, numValues - i,
+                   samplesPerValue);
+}
+
+#endif  /* SONIC_SAD_NEON */
+
+/* The fastest overlap-add this CPU can run. */
+static sonicOverlapFunc findOverlapFunc(void) {
+#if defined(SONIC_SAD_X86) && !defined(SONIC_USE_SIN)
+  if (__builtin_cpu_supports("avx2")) {
+    return overlapAddAvx2;
+  }
+  return overlapAddSse2;
+#elif defined(SONIC_SAD_NEON) && !defined(SONIC_USE_SIN)
+  return overlapAddNeon;
+#else
+  return overlapAddScalar;
+#endif
+}
+
+/* The fastest interpolation this CPU can run.  ARM64 stays with the plain C
+   code: there is no NEON interpolation, and the rate change (pitch or rate
+   other than 1) is off the default speed-only path anyway. */
+static sonicInterpolateFunc findInterpolateFunc(void) {
+#if defined(SONIC_SAD_X86) && SINC_FILTER_POINTS == 12
+  if (__builtin_cpu_supports("avx2")) {
+    return interpolateAvx2;
+  }
+#endif
+  return interpolateScalar;
+}
+
+/* The fastest down-sampling this CPU can run. */
+static sonicDownSampleFunc findDownSampleFunc(void) {
+#if defined(SONIC_SAD_X86)
+  return downSampleSse2;
+#elif defined(SONIC_SAD_NEON)
+  return downSampleNeon;
+#else
+  return downSampleScalar;
+#endif
+}
+
+/* The fastest kernel this CPU can run. */
+static sonicSadFunc findSadFunc(void) {
+#if defined(SONIC_SAD_X86)
+  if (__builtin_cpu_supports("avx2")) {
+    return sadAvx2;
+  }
+  return sadSse2;
+#elif defined(SONIC_SAD_NEON)
+  return sadNeon;
+#else
+  return sadScalar;
+#endif
+}
+
 struct sonicStreamStruct {
 #ifdef SONIC_SPECTROGRAM
   sonicSpectrogram spectrogram;
@@ -233,6 +900,35 @@ struct sonicStreamStruct {
   int sampleRate;
   int prevPeriod;
   int prevMinDiff;
+  sonicSadFunc sad;
+  sonicOverlapFunc overlap;
+  sonicDownSampleFunc downSample;
+  sonicInterpolateFunc interpolate;
+  int pitchEstimator;
+  int channelPitchMode;
+  /* Buffers of the FFT pitch estimator, allocated on first use. */
+  int fftSize;
+  float* fftBuffer;     /* fftSize complex values, interleaved */
+  float* fftTwiddle;    /* fftSize/2 complex roots of unity */
+  double* fftEnergy;    /* Running sum of squares of the analysed frame */
+  /* Polyphase sinc table of the rate change, built for sincOldRate and
+     sincNewRate on first use.  Phase k holds the weights for a ratio of
+     (k + 1) * sincStep - 1, sincPhases is 0 when there is no table. */
+  int* sincWeights;
+  int sincPhases;
+  int sincStep;
+  sonicReciprocal sincReciprocal;  /* Of sincNewRate */
+  int sincOldRate;
+  int sincNewRate;
+  /* Memory of a stream made by sonicCreateStreamInArena, NULL otherwise.  The
+     stream itself is at the start, its buffers are handed out from arenaStart
+     on, and are sized up front for arenaMinSpeed and arenaMaxWrite. */
+  unsigned char* arena;
+  int arenaSize;
+  int arenaPos;
+  int arenaStart;
+  float arenaMinSpeed;
+  int arenaMaxWrite;
 };
 
 /* Attach user data to the stream. */
@@ -328,23 +1024,102 @@ void sonicSetVolume(sonicStream stream, float volume) {
   stream->volume = volume;
 }
 
+/* Allocate a stream buffer, out of the stream's arena if it has one. */
+static void* streamCalloc(sonicStream stream, int num, int size) {
+  unsigned char* p;
+  int len = arenaAlign(num * size);
+
+  if (stream->arena == NULL) {
+    return sonicCalloc(num, size);
+  }
+  if (stream->arenaPos + len > stream->arenaSize) {
+    return NULL;
+  }
+  p = stream->arena + stream->arenaPos;
+  stream->arenaPos += len;
+  memset(p, 0, num * size);
+  return p;
+}
+
+/* Grow a stream buffer.  Arena buffers are sized so that this is not called,
+   the last block handed out can still grow in place. */
+static void* streamRealloc(sonicStream stream, void* p, int oldNum, int newNum,
+                           int size) {
+  unsigned char* newBuffer;
+  int oldLen = arenaAlign(oldNum * size);
+
+  if (stream->arena == NULL) {
+    return sonicRealloc(p, oldNum, newNum, size);
+  }
+  if (newNum <= oldNum) {
+    return p;
+  }
+  if ((unsigned char*)p + oldLen == stream->arena + stream->arenaPos &&
+      stream->arenaPos - oldLen + arenaAlign(newNum * size) <=
+          stream->arenaSize) {
+    stream->arenaPos += arenaAlign(newNum * size) - oldLen;
+    return p;
+  }
+  newBuffer = (unsigned char*)streamCalloc(stream, newNum, size);
+  if (newBuffer == NULL) {
+    return NULL;
+  }
+  memcpy(newBuffer, p, oldNum * size);
+  return newBuffer;
+}
+
+/* Free a stream buffer.  Arena buffers all go back at once, see
+   freeStreamBuffers. */
+static void streamFree(sonicStream stream, void* p) {
+  if (stream->arena == NULL) {
+    sonicFree(p);
+  }
+}
+
+/* Free the buffers of the FFT pitch estimator. */
+static void freeFftBuffers(sonicStream stream) {
+  if (stream->fftBuffer != NULL) {
+    streamFree(stream, stream->fftBuffer);
+    stream->fftBuffer = NULL;
+  }
+  if (stream->fftTwiddle != NULL) {
+    streamFree(stream, stream->fftTwiddle);
+    stream->fftTwiddle = NULL;
+  }
+  if (stream->fftEnergy != NULL) {
+    streamFree(stream, stream->fftEnergy);
+    stream->fftEnergy = NULL;
+  }
+  stream->fftSize = 0;
+}
+
 /* Free stream buffers. */
 static void freeStreamBuffers(sonicStream stream) {
   if (stream->inputBuffer != NULL) {
-    sonicFree(stream->inputBuffer);
+    streamFree(stream, stream->inputBuffer);
   }
   if (stream->outputBuffer != NULL) {
-    sonicFree(stream->outputBuffer);
+    streamFree(stream, stream->outputBuffer);
   }
   if (stream->pitchBuffer != NULL) {
-    sonicFree(stream->pitchBuffer);
+    streamFree(stream, stream->pitchBuffer);
   }
   if (stream->downSampleBuffer != NULL) {
-    sonicFree(stream->downSampleBuffer);
+    streamFree(stream, stream->downSampleBuffer);
+  }
+  freeFftBuffers(stream);
+  if (stream->sincWeights != NULL) {
+    streamFree(stream, stream->sincWeights);
+    stream->sincWeights = NULL;
   }
+  stream->sincPhases = 0;
+  stream->sincOldRate = 0;
+  stream->sincNewRate = 0;
+  stream->arenaPos = stream->arenaStart;
 }
 
-/* Destroy the sonic stream. */
+/* Destroy the sonic stream.  The memory of an arena stream belongs to the
+   caller. */
 void sonicDestroyStream(sonicStream stream) {
 #ifdef SONIC_SPECTROGRAM
   if (stream->spectrogram != NULL) {
@@ -352,7 +1127,9 @@ void sonicDestroyStream(sonicStream stream) {
   }
 #endif  /* SONIC_SPECTROGRAM */
   freeStreamBuffers(stream);
-  sonicFree(stream);
+  if (stream->arena == NULL) {
+    sonicFree(stream);
+  }
 }
 
 /* Compute the number of samples to skip to down-sample the input. */
@@ -364,40 +1141,76 @@ static int computeSkip(sonicStream stream) {
   return skip;
 }
 
+/* Size of the FFT for the autocorrelation of maxRequired samples up to a lag of
+   maxPeriod. */
+static int computeFftSize(int maxRequired, int maxPeriod) {
+  int size = 1;
+
+  while (size < maxRequired + maxPeriod) {
+    size <<= 1;
+  }
+  return size;
+}
+
+/* Worst case input and output buffer sizes of an arena stream.  The input
+   holds less than maxRequired unprocessed samples plus one write.  A flush
+   makes room for the unprocessed samples twice plus 2 * maxRequired samples
+   of silence.  The output holds what
+   one write produces, assuming it is read after every write: at most 1/speed
+   samples per input sample below 0.5X, and 2 samples per input sample for the
+   doubled pitch periods between 0.5X and 1X. */
+static void computeArenaBufferSizes(int maxRequired, float minSpeed,
+                                    int maxWriteSamples, int* inputSize,
+                                    int* outputSize) {
+  float stretch = minSpeed < 0.5f ? 1.0f / minSpeed : 2.0f;
+  int written =
+      maxWriteSamples > 3 * maxRequired ? maxWriteSamples : 3 * maxRequired;
+
+  *inputSize = maxRequired + written;
+  *outputSize = (int)(*inputSize * stretch) + maxRequired;
+}
+
 /* Allocate stream buffers. */
 static int allocateStreamBuffers(sonicStream stream, int sampleRate,
                                  int numChannels) {
   int minPeriod = sampleRate / SONIC_MAX_PITCH;
   int maxPeriod = sampleRate / SONIC_MIN_PITCH;
   int maxRequired = 2 * maxPeriod;
-  int skip = computeSkip(stream);
 
-  /* Allocate 25% more than needed so we hopefully won't grow. */
-  stream->inputBufferSize = maxRequired + (maxRequired >> 2);;
-  stream->inputBuffer =
-      (short*)sonicCalloc(stream->inputBufferSize, sizeof(short) * numChannels);
+  if (stream->arena != NULL) {
+    /* Never grow: room for the worst case up front. */
+    computeArenaBufferSizes(maxRequired, stream->arenaMinSpeed,
+                            stream->arenaMaxWrite, &stream->inputBufferSize,
+                            &stream->outputBufferSize);
+    stream->pitchBufferSize = stream->outputBufferSize + SINC_FILTER_POINTS;
+  } else {
+    /* Allocate 25% more than needed so we hopefully won't grow. */
+    stream->inputBufferSize = maxRequired + (maxRequired >> 2);
+    stream->outputBufferSize = maxRequired + (maxRequired >> 2);
+    stream->pitchBufferSize = maxRequired + (maxRequired >> 2);
+  }
+  stream->inputBuffer = (short*)streamCalloc(stream, stream->inputBufferSize,
+                                             sizeof(short) * numChannels);
   if (stream->inputBuffer == NULL) {
     sonicDestroyStream(stream);
     return 0;
   }
-  /* Allocate 25% more than needed so we hopefully won't grow. */
-  stream->outputBufferSize = maxRequired + (maxRequired >> 2);
-  stream->outputBuffer =
-      (short*)sonicCalloc(stream->outputBufferSize, sizeof(short) * numChannels);
+  stream->outputBuffer = (short*)streamCalloc(stream, stream->outputBufferSize,
+                                              sizeof(short) * numChannels);
   if (stream->outputBuffer == NULL) {
     sonicDestroyStream(stream);
     return 0;
   }
-  /* Allocate 25% more than needed so we hopefully won't grow. */
-  stream->pitchBufferSize = maxRequired + (maxRequired >> 2);
-  stream->pitchBuffer =
-      (short*)sonicCalloc(stream->pitchBufferSize, sizeof(short) * numChannels);
+  stream->pitchBuffer = (short*)streamCalloc(stream, stream->pitchBufferSize,
+                                             sizeof(short) * numChannels);
   if (stream->pitchBuffer == NULL) {
     sonicDestroyStream(stream);
     return 0;
   }
-  int downSampleBufferSize = (maxRequired + skip - 1)/ skip;
-  stream->downSampleBuffer = (short*)sonicCalloc(downSampleBufferSize, sizeof(short));
+  /* Full size: stereo input and the FFT estimator mix down without skipping.
+     One plane per channel for the per-channel pitch modes. */
+  stream->downSampleBuffer =
+      (short*)streamCalloc(stream, maxRequired, sizeof(short) * numChannels);
   if (stream->downSampleBuffer == NULL) {
     sonicDestroyStream(stream);
     return 0;
@@ -414,15 +1227,9 @@ static int allocateStreamBuffers(sonicStream stream, int sampleRate,
   return 1;
 }
 
-/* Create a sonic stream.  Return NULL only if we are out of memory and cannot
-   allocate the stream. */
-sonicStream sonicCreateStream(int sampleRate, int numChannels) {
-  sonicStream stream = (sonicStream)sonicCalloc(
-      1, sizeof(struct sonicStreamStruct));
-
-  if (stream == NULL) {
-    return NULL;
-  }
+/* Set up a zeroed stream.  Return NULL if its buffers cannot be allocated. */
+static sonicStream initStream(sonicStream stream, int sampleRate,
+                              int numChannels) {
   if (!allocateStreamBuffers(stream, sampleRate, numChannels)) {
     return NULL;
   }
@@ -433,15 +1240,100 @@ sonicStream sonicCreateStream(int sampleRate, int numChannels) {
   stream->oldRatePosition = 0;
   stream->newRatePosition = 0;
   stream->quality = 0;
+  stream->sad = findSadFunc();
+  stream->overlap = findOverlapFunc();
+  stream->downSample = findDownSampleFunc();
+  stream->interpolate = findInterpolateFunc();
+  stream->pitchEstimator = SONIC_PITCH_AMDF;
+  stream->channelPitchMode = SONIC_CHANNELS_MIX;
   return stream;
 }
 
+/* Create a sonic stream.  Return NULL only if we are out of memory and cannot
+   allocate the stream. */
+sonicStream sonicCreateStream(int sampleRate, int numChannels) {
+  sonicStream stream = (sonicStream)sonicCalloc(
+      1, sizeof(struct sonicStreamStruct));
+
+  if (stream == NULL) {
+    return NULL;
+  }
+  return initStream(stream, sampleRate, numChannels);
+}
+
+/* Get the number of bytes sonicCreateStreamInArena needs. */
+int sonicGetArenaSize(int sampleRate, int numChannels, float minSpeed,
+                      int maxWriteSamples) {
+  int maxPeriod = sampleRate / SONIC_MIN_PITCH;
+  int maxRequired = 2 * maxPeriod;
+  int fftSize = computeFftSize(maxRequired, maxPeriod);
+  int frameSize = sizeof(short) * numChannels;
+  int inputSize, outputSize;
+
+  if (sampleRate <= 0 || numChannels <= 0 || minSpeed <= 0.0f) {
+    return 0;
+  }
+  computeArenaBufferSizes(maxRequired, minSpeed, maxWriteSamples, &inputSize,
+                          &outputSize);
+  return arenaAlign((int)sizeof(struct sonicStreamStruct)) +
+         arenaAlign(inputSize * frameSize) +
+         arenaAlign(outputSize * frameSize) +
+         arenaAlign((outputSize + SINC_FILTER_POINTS) * frameSize) +
+         arenaAlign(maxRequired * frameSize) +
+         /* The sinc table, see buildSincTable */
+         arenaAlign(SONIC_MAX_SINC_PHASES * SINC_FILTER_POINTS *
+                    (int)sizeof(int)) +
+         /* The FFT estimator's buffers, see allocateFftBuffers */
+         arenaAlign((2 * fftSize + maxPeriod + 1) * (int)sizeof(float)) +
+         arenaAlign(fftSize * (int)sizeof(float)) +
+         arenaAlign((maxRequired + 1) * (int)sizeof(double));
+}
+
+/* Create a sonic stream in caller-owned memory, see sonic.h. */
+sonicStream sonicCreateStreamInArena(void* arena, int arenaSize,
+                                     int sampleRate, int numChannels,
+                                     float minSpeed, int maxWriteSamples) {
+  sonicStream stream = (sonicStream)arena;
+  int needed =
+      sonicGetArenaSize(sampleRate, numChannels, minSpeed, maxWriteSamples);
+
+  if (arena == NULL || needed == 0 || arenaSize < needed) {
+    return NULL;
+  }
+  memset(stream, 0, sizeof(struct sonicStreamStruct));
+  stream->arena = (unsigned char*)arena;
+  stream->arenaSize = arenaSize;
+  stream->arenaStart = arenaAlign((int)sizeof(struct sonicStreamStruct));
+  stream->arenaPos = stream->arenaStart;
+  stream->arenaMinSpeed = minSpeed;
+  stream->arenaMaxWrite = maxWriteSamples;
+  return initStream(stream, sampleRate, numChannels);
+}
+
 /* Get the sample rate of the stream. */
 int sonicGetSampleRate(sonicStream stream) { return stream->sampleRate; }
 
+/* Whether the stream's arena has room for the buffers of a new format.  A
+   stream that is not in an arena can always try. */
+static int formatFitsArena(sonicStream stream, int sampleRate,
+                           int numChannels) {
+  int needed;
+
+  if (stream->arena == NULL) {
+    return 1;
+  }
+  needed = sonicGetArenaSize(sampleRate, numChannels, stream->arenaMinSpeed,
+                             stream->arenaMaxWrite);
+  return needed != 0 && needed <= stream->arenaSize;
+}
+
 /* Set the sample rate of the stream.  This will cause samples buffered in the
-   stream to be lost. */
+   stream to be lost.  An arena stream ignores a rate its arena is too small
+   for, and keeps its samples. */
 void sonicSetSampleRate(sonicStream stream, int sampleRate) {
+  if (!formatFitsArena(stream, sampleRate, stream->numChannels)) {
+    return;
+  }
   freeStreamBuffers(stream);
   allocateStreamBuffers(stream, sampleRate, stream->numChannels);
 }
@@ -450,8 +1342,12 @@ void sonicSetSampleRate(sonicStream stream, int sampleRate) {
 int sonicGetNumChannels(sonicStream stream) { return stream->numChannels; }
 
 /* Set the num channels of the stream.  This will cause samples buffered in the
-   stream to be lost. */
+   stream to be lost.  An arena stream ignores a channel count its arena is
+   too small for, and keeps its samples. */
 void sonicSetNumChannels(sonicStream stream, int numChannels) {
+  if (!formatFitsArena(stream, stream->sampleRate, numChannels)) {
+    return;
+  }
   freeStreamBuffers(stream);
   allocateStreamBuffers(stream, stream->sampleRate, numChannels);
 }
@@ -461,15 +1357,15 @@ static int enlargeOutputBufferIfNeeded(sonicStream stream, int numSamples) {
   int outputBufferSize = stream->outputBufferSize;
 
   if (stream->numOutputSamples + numSamples > outputBufferSize) {
-    stream->outputBufferSize += (outputBufferSize >> 1) + numSamples;
-    stream->outputBuffer = (short*)sonicRealloc(
-        stream->outputBuffer,
-        outputBufferSize,
-        stream->outputBufferSize,
+    int newSize = outputBufferSize + (outputBufferSize >> 1) + numSamples;
+    short* newBuffer = (short*)streamRealloc(
+        stream, stream->outputBuffer, outputBufferSize, newSize,
         sizeof(short) * stream->numChannels);
-    if (stream->outputBuffer == NULL) {
+    if (newBuffer == NULL) {
       return 0;
     }
+    stream->outputBuffer = newBuffer;
+    stream->outputBufferSize = newSize;
   }
   return 1;
 }
@@ -479,15 +1375,15 @@ static int enlargeInputBufferIfNeeded(sonicStream stream, int numSamples) {
   int inputBufferSize = stream->inputBufferSize;
 
   if (stream->numInputSamples + numSamples > inputBufferSize) {
-    stream->inputBufferSize += (inputBufferSize >> 1) + numSamples;
-    stream->inputBuffer = (short*)sonicRealloc(
-        stream->inputBuffer,
-        inputBufferSize,
-        stream->inputBufferSize,
+    int newSize = inputBufferSize + (inputBufferSize >> 1) + numSamples;
+    short* newBuffer = (short*)streamRealloc(
+        stream, stream->inputBuffer, inputBufferSize, newSize,
         sizeof(short) * stream->numChannels);
-    if (stream->inputBuffer == NULL) {
+    if (newBuffer == NULL) {
       return 0;
     }
+    stream->inputBuffer = newBuffer;
+    stream->inputBufferSize = newSize;
   }
   return 1;
 }
@@ -722,47 +1618,116 @@ int sonicSamplesAvailable(sonicStream stream) {
   return stream->numOutputSamples;
 }
 
+/* Return how many samples of output the input and pitch buffers will still
+   make, at the speeds the input was written with (as sonicFlushStream expects) */
+int sonicSamplesQueued(sonicStream stream) {
+  float rate = stream->rate * stream->pitch;
+
+  return (int)((stream->inputPlayTime * stream->sampleRate +
+                stream->numPitchSamples) / rate + 0.5f);
+}
+
 /* If skip is greater than one, average skip samples together and write them to
    the down-sample buffer.  If numChannels is greater than one, mix the channels
    together as we down sample. */
 static void downSampleInput(sonicStream stream, short* samples, int skip) {
+  stream->downSample(samples, stream->downSampleBuffer,
+                     stream->maxRequired / skip, stream->numChannels * skip);
+}
+
+/* Use the SIMD pitch search, or not. */
+void sonicEnableSimd(sonicStream stream, int enable) {
+  stream->sad = enable ? findSadFunc() : sadScalar;
+  stream->overlap = enable ? findOverlapFunc() : overlapAddScalar;
+  stream->downSample = enable ? findDownSampleFunc() : downSampleScalar;
+  stream->interpolate = enable ? findInterpolateFunc() : interpolateScalar;
+}
+
+/* Name of the pitch search kernel in use. */
+const char* sonicGetSimdName(sonicStream stream) {
+#if defined(SONIC_SAD_X86)
+  if (stream->sad == sadAvx2) {
+    return "avx2";
+  }
+  if (stream->sad == sadSse2) {
+    return "sse2";
+  }
+#elif defined(SONIC_SAD_NEON)
+  if (stream->sad == sadNeon) {
+    return "neon";
+  }
+#endif
+  return "scalar";
+}
+
+/* Put the input to search for the pitch into down-sampled planes: one mixed
+   down plane, or one per channel, which count equally.  Mono input that isn't
+   down-sampled is used in place.  Returns the number of
+   planes, which start planeSize apart. */
+static int preparePitchPlanes(sonicStream stream, short* samples, int skip,
+                              short** planes, int* planeSize) {
+  int numChannels = stream->numChannels;
   int numSamples = stream->maxRequired / skip;
-  int samplesPerValue = stream->numChannels * skip;
-  int i, j;
-  int value;
-  short* downSamples = stream->downSampleBuffer;
+  int i, j, c;
 
-  for (i = 0; i < numSamples; i++) {
-    value = 0;
-    for (j = 0; j < samplesPerValue; j++) {
-      value += *samples++;
+  *planeSize = stream->maxRequired;
+  if (numChannels == 1 && skip == 1) {
+    *planes = samples;
+    return 1;
+  }
+  *planes = stream->downSampleBuffer;
+  if (numChannels == 1 || numChannels > SONIC_MAX_PITCH_CHANNELS ||
+      stream->channelPitchMode == SONIC_CHANNELS_MIX) {
+    downSampleInput(stream, samples, skip);
+    return 1;
+  }
+  for (c = 0; c < numChannels; c++) {
+    short* in = samples + c;
+    short* out = stream->downSampleBuffer + c * stream->maxRequired;
+    for (i = 0; i < numSamples; i++) {
+      int value = 0;
+      for (j = 0; j < skip; j++) {
+        value += *in;
+        in += numChannels;
+      }
+      value /= skip;
+      out[i] = value;
     }
-    value /= samplesPerValue;
-    *downSamples++ = value;
   }
+  return numChannels;
+}
+
+/* Weight (Q8) of each of numPlanes planes in the pitch search. */
+#define planeWeight(numPlanes) (256 / (numPlanes))
+
+/* Weighted sum of the AMDF of each plane at one period. */
+static unsigned long planesDiff(sonicStream stream, short* planes,
+                                int planeSize, int numPlanes, int period) {
+  unsigned long diff = 0;
+  int c;
+
+  if (numPlanes == 1) {
+    return stream->sad(planes, planes + period, period);
+  }
+  for (c = 0; c < numPlanes; c++) {
+    short* plane = planes + c * planeSize;
+    diff += (planeWeight(numPlanes) *
+             stream->sad(plane, plane + period, period)) >> 8;
+  }
+  return diff;
 }
 
 /* Find the best frequency match in the range, and given a sample skip multiple.
-   For now, just find the pitch of the first channel. */
-static int findPitchPeriodInRange(short* samples, int minPeriod, int maxPeriod,
+   With several planes, the period has to match all channels. */
+static int findPitchPeriodInRange(sonicStream stream, short* planes,
+                                  int planeSize, int numPlanes,
+                                  int minPeriod, int maxPeriod,
                                   int* retMinDiff, int* retMaxDiff) {
   int period, bestPeriod = 0, worstPeriod = 255;
-  short* s;
-  short* p;
-  short sVal, pVal;
   unsigned long diff, minDiff = 1, maxDiff = 0;
-  int i;
 
   for (period = minPeriod; period <= maxPeriod; period++) {
-    diff = 0;
-    s = samples;
-    p = samples + period;
-    for (i = 0; i < period; i++) {
-      sVal = *s++;
-      pVal = *p++;
-      diff += sVal >= pVal ? (unsigned short)(sVal - pVal)
-                           : (unsigned short)(pVal - sVal);
-    }
+    diff = planesDiff(stream, planes, planeSize, numPlanes, period);
     /* Note that the highest number of samples we add into diff will be less
        than 256, since we skip samples.  Thus, diff is a 24 bit number, and
        we can safely multiply by numSamples without overflow */
@@ -805,46 +1770,291 @@ static int prevPeriodBetter(sonicStream stream, int minDiff,
   return 1;
 }
 
-/* Find the pitch period.  This is a critical step, and we may have to try
-   multiple ways to get a good answer.  This version uses Average Magnitude
-   Difference Function (AMDF).  To improve speed, we down sample by an integer
-   factor get in the 11KHz range, and then do it again with a narrower
-   frequency range without down sampling */
-static int findPitchPeriod(sonicStream stream, short* samples,
-                           int preferNewPeriod) {
+/* Find the pitch period using Average Magnitude Difference Function (AMDF).
+   To improve speed, we down sample by an integer factor get in the 11KHz
+   range, and then do it again with a narrower frequency range without down
+   sampling */
+static int findPitchPeriodAmdf(sonicStream stream, short* samples,
+                               int* retMinDiff, int* retMaxDiff) {
   int minPeriod = stream->minPeriod;
   int maxPeriod = stream->maxPeriod;
-  int minDiff, maxDiff, retPeriod;
+  int minDiff, maxDiff;
   int skip = computeSkip(stream);
-  int period;
+  int period, numPlanes, planeSize;
+  short* planes;
+
+  numPlanes = preparePitchPlanes(stream, samples, skip, &planes, &planeSize);
+  period = findPitchPeriodInRange(stream, planes, planeSize, numPlanes,
+                                  minPeriod / skip, maxPeriod / skip,
+                                  &minDiff, &maxDiff);
+  if (skip != 1) {
+    period *= skip;
+    minPeriod = period - (skip << 2);
+    maxPeriod = period + (skip << 2);
+    if (minPeriod < stream->minPeriod) {
+      minPeriod = stream->minPeriod;
+    }
+    if (maxPeriod > stream->maxPeriod) {
+      maxPeriod = stream->maxPeriod;
+    }
+    numPlanes = preparePitchPlanes(stream, samples, 1, &planes, &planeSize);
+    period = findPitchPeriodInRange(stream, planes, planeSize, numPlanes,
+                                    minPeriod, maxPeriod, &minDiff, &maxDiff);
+  }
+  *retMinDiff = minDiff;
+  *retMaxDiff = maxDiff;
+  return period;
+}
 
-  if (stream->numChannels == 1 && skip == 1) {
-    period = findPitchPeriodInRange(samples, minPeriod, maxPeriod, &minDiff,
-                                    &maxDiff);
-  } else {
-    downSampleInput(stream, samples, skip);
-    period = findPitchPeriodInRange(stream->downSampleBuffer, minPeriod / skip,
-                                    maxPeriod / skip, &minDiff, &maxDiff);
-    if (skip != 1) {
-      period *= skip;
-      minPeriod = period - (skip << 2);
-      maxPeriod = period + (skip << 2);
-      if (minPeriod < stream->minPeriod) {
-        minPeriod = stream->minPeriod;
-      }
-      if (maxPeriod > stream->maxPeriod) {
-        maxPeriod = stream->maxPeriod;
-      }
-      if (stream->numChannels == 1) {
-        period = findPitchPeriodInRange(samples, minPeriod, maxPeriod, &minDiff,
-                                        &maxDiff);
-      } else {
-        downSampleInput(stream, samples, 1);
-        period = findPitchPeriodInRange(stream->downSampleBuffer, minPeriod,
-                                        maxPeriod, &minDiff, &maxDiff);
+/* In-place radix-2 FFT of n interleaved complex values, n a power of two no
+   larger than fftSize.  This is not kiss_fftr from ../jitterbuffer on
+   purpose.  sonic.c has to build alone: SonicBench, PitchBench and
+   SonicKernelTest use nothing else.  kiss_fft takes its sample type from
+   speex's config.h and becomes 16-bit fixed point under FIXED_POINT.  The
+   only transform needed here is this power-of-two one, with the twiddles
+   kept in the stream's own buffers, so an arena stream keeps them in its
+   arena. */
+static void fftForward(sonicStream stream, float* data, int n) {
+  int i, j, k, len, half, step;
+
+  /* Bit reversal permutation */
+  for (i = 1, j = 0; i < n; i++) {
+    int bit = n >> 1;
+    for (; j & bit; bit >>= 1) {
+      j ^= bit;
+    }
+    j ^= bit;
+    if (i < j) {
+      float re = data[2 * i], im = data[2 * i + 1];
+      data[2 * i] = data[2 * j];
+      data[2 * i + 1] = data[2 * j + 1];
+      data[2 * j] = re;
+      data[2 * j + 1] = im;
+    }
+  }
+  for (len = 2; len <= n; len <<= 1) {
+    half = len >> 1;
+    step = stream->fftSize / len;
+    for (i = 0; i < n; i += len) {
+      for (k = 0; k < half; k++) {
+        float wr = stream->fftTwiddle[2 * k * step];
+        float wi = stream->fftTwiddle[2 * k * step + 1];
+        float* a = data + 2 * (i + k);
+        float* b = data + 2 * (i + k + half);
+        float tr = b[0] * wr - b[1] * wi;
+        float ti = b[0] * wi + b[1] * wr;
+        b[0] = a[0] - tr;
+        b[1] = a[1] - ti;
+        a[0] += tr;
+        a[1] += ti;
       }
     }
   }
+}
+
+/* Allocate the FFT buffers, large enough for a linear autocorrelation of
+   maxRequired samples up to a lag of maxPeriod, plus the sum of the
+   correlations of all channels. */
+static int allocateFftBuffers(sonicStream stream) {
+  int size = computeFftSize(stream->maxRequired, stream->maxPeriod);
+  int i;
+
+  stream->fftBuffer = (float*)streamCalloc(
+      stream, 2 * size + stream->maxPeriod + 1, sizeof(float));
+  stream->fftTwiddle = (float*)streamCalloc(stream, size, sizeof(float));
+  stream->fftEnergy =
+      (double*)streamCalloc(stream, stream->maxRequired + 1, sizeof(double));
+  if (stream->fftBuffer == NULL || stream->fftTwiddle == NULL ||
+      stream->fftEnergy == NULL) {
+    freeFftBuffers(stream);
+    return 0;
+  }
+  for (i = 0; i < size / 2; i++) {
+    stream->fftTwiddle[2 * i] = (float)cos(-2 * M_PI * i / size);
+    stream->fftTwiddle[2 * i + 1] = (float)sin(-2 * M_PI * i / size);
+  }
+  stream->fftSize = size;
+  return 1;
+}
+
+/* Autocorrelation of the fftSize real values in data (zero padded), computed
+   in place with two complex FFTs of half the size: the even and odd samples
+   are packed as real and imaginary parts.  On return data[i] is the
+   correlation at lag i, times fftSize / 2.  Uses fftSize/2 + 1 floats after the
+   first fftSize as scratch space. */
+static void autocorrelate(sonicStream stream, float* data) {
+  int n = stream->fftSize;
+  int h = n / 2;
+  float* power = data + n;
+  const float* w = stream->fftTwiddle;
+  int k;
+
+  fftForward(stream, data, h);
+  /* Split into the spectrum of the real signal, keep its power */
+  for (k = 0; k <= h / 2; k++) {
+    int m = (h - k) % h;
+    float zr = data[2 * k], zi = data[2 * k + 1];
+    float cr = data[2 * m], ci = -data[2 * m + 1];
+    float er = 0.5f * (zr + cr), ei = 0.5f * (zi + ci);
+    float or = 0.5f * (zi - ci), oi = -0.5f * (zr - cr);
+    /* X[k] = E + W^k O and X[h - k] = conj(E - W^k O) */
+    float tr = w[2 * k] * or - w[2 * k + 1] * oi;
+    float ti = w[2 * k] * oi + w[2 * k + 1] * or;
+    power[k] = (er + tr) * (er + tr) + (ei + ti) * (ei + ti);
+    power[h - k] = (er - tr) * (er - tr) + (ei - ti) * (ei - ti);
+  }
+  /* The power spectrum is real and even, so the inverse transform is a
+     forward one.  Pack it the same way: Y[k] = E[k] + i O[k] with
+     E[k] = (P[k] + P[h - k]) / 2 and O[k] = (P[k] - P[h - k]) / 2 * W^-k. */
+  for (k = 0; k < h; k++) {
+    float e = 0.5f * (power[k] + power[h - k]);
+    float o = 0.5f * (power[k] - power[h - k]);
+    float wr = w[2 * k], wi = -w[2 * k + 1];
+    /* conj(Y[k]), as the forward FFT of conj(Y) is the conjugated inverse */
+    data[2 * k] = e - o * wi;
+    data[2 * k + 1] = -(o * wr);
+  }
+  fftForward(stream, data, h);
+  for (k = 0; k < h; k++) {
+    data[2 * k + 1] = -data[2 * k + 1];
+  }
+}
+
+/* Find the pitch period as the peak of the normalized autocorrelation of the
+   input, computed with an FFT in O(n log n).  With the per-channel modes the
+   correlations and energies of the channels are added up (weighted), which is
+   the normalized correlation of the channels taken together.  The shortest
+   lag whose correlation is within SONIC_NCC_THRESHOLD of the best one wins, so
+   that a multiple of the period isn't picked over the period itself.  The
+   AMDF of the chosen and of the worst lag are returned for prevPeriodBetter. */
+static int findPitchPeriodFft(sonicStream stream, short* samples,
+                              int* retMinDiff, int* retMaxDiff) {
+  int minPeriod = stream->minPeriod;
+  int maxPeriod = stream->maxPeriod;
+  int numSamples = stream->maxRequired;
+  int numPlanes, planeSize;
+  short* planes;
+  float* data;
+  float* corr;
+  float* ncc;
+  double* energy;
+  double best = -2.0, worst = 2.0;
+  int i, c, period, bestPeriod = minPeriod, worstPeriod = minPeriod;
+
+  if (stream->fftSize == 0 && !allocateFftBuffers(stream)) {
+    /* Out of memory, fall back to the AMDF */
+    return findPitchPeriodAmdf(stream, samples, retMinDiff, retMaxDiff);
+  }
+  data = stream->fftBuffer;
+  corr = data + 2 * stream->fftSize;
+  energy = stream->fftEnergy;
+  numPlanes = preparePitchPlanes(stream, samples, 1, &planes, &planeSize);
+  memset(corr, 0, sizeof(float) * (maxPeriod + 1));
+  memset(energy, 0, sizeof(double) * (numSamples + 1));
+  for (c = 0; c < numPlanes; c++) {
+    short* plane = planes + c * planeSize;
+    double weight = numPlanes == 1 ? 1.0 : planeWeight(numPlanes) / 256.0;
+    double mean = 0.0, sum = 0.0;
+
+    if (weight == 0.0) {
+      continue;
+    }
+    for (i = 0; i < numSamples; i++) {
+      mean += plane[i];
+    }
+    mean /= numSamples;
+    for (i = 0; i < numSamples; i++) {
+      double value = plane[i] - mean;
+      data[i] = (float)value;
+      sum += value * value;
+      energy[i + 1] += weight * sum;
+    }
+    memset(data + numSamples, 0,
+           sizeof(float) * (stream->fftSize - numSamples));
+    autocorrelate(stream, data);
+    for (period = minPeriod; period <= maxPeriod; period++) {
+      corr[period] += (float)(weight * data[period]);
+    }
+  }
+
+  /* The scratch space after the correlation is free again */
+  ncc = data + stream->fftSize;
+  for (period = minPeriod; period <= maxPeriod; period++) {
+    double norm = (energy[numSamples - period] *
+                   (energy[numSamples] - energy[period]));
+    double value =
+        norm > 0.0 ? corr[period] / (stream->fftSize / 2) / sqrt(norm) : 0.0;
+    ncc[period] = (float)value;
+    if (value > best) {
+      best = value;
+      bestPeriod = period;
+    }
+    if (value < worst) {
+      worst = value;
+      worstPeriod = period;
+    }
+  }
+  for (period = minPeriod + 1; period < bestPeriod; period++) {
+    if (ncc[period] >= SONIC_NCC_THRESHOLD * best &&
+        ncc[period] >= ncc[period - 1] && ncc[period] >= ncc[period + 1]) {
+      bestPeriod = period;
+      break;
+    }
+  }
+  *retMinDiff = planesDiff(stream, planes, planeSize, numPlanes, bestPeriod) /
+                bestPeriod;
+  *retMaxDiff = planesDiff(stream, planes, planeSize, numPlanes, worstPeriod) /
+                worstPeriod;
+  return bestPeriod;
+}
+
+/* Run the pitch estimator selected for the stream. */
+static int estimatePitchPeriod(sonicStream stream, short* samples,
+                               int* minDiff, int* maxDiff) {
+  if (stream->pitchEstimator == SONIC_PITCH_FFT) {
+    return findPitchPeriodFft(stream, samples, minDiff, maxDiff);
+  }
+  return findPitchPeriodAmdf(stream, samples, minDiff, maxDiff);
+}
+
+/* Select the pitch estimator. */
+void sonicSetPitchEstimator(sonicStream stream, int estimator) {
+  stream->pitchEstimator = estimator;
+}
+
+/* Get the pitch estimator. */
+int sonicGetPitchEstimator(sonicStream stream) {
+  return stream->pitchEstimator;
+}
+
+/* Select how the channels are combined for the pitch search. */
+void sonicSetChannelPitchMode(sonicStream stream, int mode) {
+  stream->channelPitchMode = mode;
+}
+
+/* Get how the channels are combined for the pitch search. */
+int sonicGetChannelPitchMode(sonicStream stream) {
+  return stream->channelPitchMode;
+}
+
+/* Estimate the pitch period of 2 * maxPeriod samples on their own. */
+int sonicEstimatePitchPeriod(sonicStream stream, short* samples) {
+  int minDiff, maxDiff;
+  return estimatePitchPeriod(stream, samples, &minDiff, &maxDiff);
+}
+
+/* Get the number of samples sonicEstimatePitchPeriod looks at. */
+int sonicGetPitchWindow(sonicStream stream) {
+  return stream->maxRequired;
+}
+
+/* Find the pitch period.  This is a critical step, and we may have to try
+   multiple ways to get a good answer. */
+static int findPitchPeriod(sonicStream stream, short* samples,
+                           int preferNewPeriod) {
+  int minDiff, maxDiff, retPeriod;
+  int period = estimatePitchPeriod(stream, samples, &minDiff, &maxDiff);
+
   if (prevPeriodBetter(stream, minDiff, maxDiff, preferNewPeriod)) {
     retPeriod = stream->prevPeriod;
   } else {
@@ -855,33 +2065,6 @@ static int findPitchPeriod(sonicStream stream, short* samples,
   return retPeriod;
 }
 
-/* Overlap two sound segments, ramp the volume of one down, while ramping the
-   other one from zero up, and add them, storing the result at the output. */
-static void overlapAdd(int numSamples, int numChannels, short* out,
-                       short* rampDown, short* rampUp) {
-  short* o;
-  short* u;
-  short* d;
-  int i, t;
-
-  for (i = 0; i < numChannels; i++) {
-    o = out + i;
-    u = rampUp + i;
-    d = rampDown + i;
-    for (t = 0; t < numSamples; t++) {
-#ifdef SONIC_USE_SIN
-      float ratio = sin(t * M_PI / (2 * numSamples));
-      *o = *d * (1.0f - ratio) + *u * ratio;
-#else
-      *o = (*d * (numSamples - t) + *u * t) / numSamples;
-#endif
-      o += numChannels;
-      d += numChannels;
-      u += numChannels;
-    }
-  }
-}
-
 /* Just move the new samples in the output buffer to the pitch buffer */
 static int moveNewSamplesToPitchBuffer(sonicStream stream,
                                        int originalNumOutputSamples) {
@@ -890,9 +2073,14 @@ static int moveNewSamplesToPitchBuffer(sonicStream stream,
   int pitchBufferSize = stream->pitchBufferSize;
 
   if (stream->numPitchSamples + numSamples > pitchBufferSize) {
-    stream->pitchBufferSize += (pitchBufferSize >> 1) + numSamples;
-    stream->pitchBuffer = (short*)sonicRealloc(stream->pitchBuffer,
-        pitchBufferSize, stream->pitchBufferSize, sizeof(short) * numChannels);
+    int newSize = pitchBufferSize + (pitchBufferSize >> 1) + numSamples;
+    short* newBuffer = (short*)streamRealloc(stream, stream->pitchBuffer,
+        pitchBufferSize, newSize, sizeof(short) * numChannels);
+    if (newBuffer == NULL) {
+      return 0;
+    }
+    stream->pitchBuffer = newBuffer;
+    stream->pitchBufferSize = newSize;
   }
   memcpy(stream->pitchBuffer + stream->numPitchSamples * numChannels,
          stream->outputBuffer + originalNumOutputSamples * numChannels,
@@ -918,53 +2106,104 @@ static void removePitchSamples(sonicStream stream, int numSamples) {
   stream->numPitchSamples -= numSamples;
 }
 
-/* Approximate the sinc function times a Hann window from the sinc table. */
-static int findSincCoefficient(int i, int ratio, int width) {
+/* The sinc function times a Hann window, approximated from the sinc table, at
+   each of the SINC_FILTER_POINTS taps for an output sample ratio / width of
+   the way between two input samples.  Where it falls between two entries of
+   the table does not depend on the tap, so it is found once.  Within
+   0 <= ratio < width the weight is at most 2 * 32767 * width, so the division
+   can use the reciprocal of width. */
+static void findSincWeights(int ratio, int width, sonicReciprocal reciprocal,
+                            int* weights) {
   int lobePoints = (SINC_TABLE_SIZE - 1) / SINC_FILTER_POINTS;
-  int left = i * lobePoints + (ratio * lobePoints) / width;
-  int right = left + 1;
-  int position = i * lobePoints * width + ratio * lobePoints - left * width;
-  int leftVal = sincTable[left];
-  int rightVal = sincTable[right];
-
-  return ((leftVal * (width - position) + rightVal * position) << 1) / width;
+  int left = (ratio * lobePoints) / width;
+  int position = ratio * lobePoints - left * width;
+  const short* table = sincTable + left;
+  int i, value;
+  unsigned int magnitude;
+
+  if (ratio < 0 || ratio >= width) {
+    for (i = 0; i < SINC_FILTER_POINTS; i++) {
+      value = (table[i * lobePoints] * (width - position) +
+               table[i * lobePoints + 1] * position) * 2;
+      weights[i] = value / width;
+    }
+    return;
+  }
+  for (i = 0; i < SINC_FILTER_POINTS; i++) {
+    value = (table[i * lobePoints] * (width - position) +
+             table[i * lobePoints + 1] * position) * 2;
+    magnitude = value < 0 ? -(unsigned int)value : (unsigned int)value;
+    magnitude = (unsigned int)(((unsigned long long)magnitude *
+                                reciprocal.multiplier) >> reciprocal.shift);
+    weights[i] = value < 0 ? -(int)magnitude : (int)magnitude;
+  }
 }
 
-/* Return 1 if value >= 0, else -1.  This represents the sign of value. */
-static int getSign(int value) { return value >= 0 ? 1 : -1; }
+/* Greatest common divisor. */
+static int findGcd(int a, int b) {
+  int t;
 
-/* Interpolate the new output sample. */
-static short interpolate(sonicStream stream, short* in, int oldSampleRate,
-                         int newSampleRate) {
-  /* Compute N-point sinc FIR-filter here.  Clip rather than overflow. */
+  while (b != 0) {
+    t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+/* Build the polyphase table for a pair of rates.  (oldRatePosition + 1) *
+   newSampleRate - newRatePosition * oldSampleRate, the ratio plus one, is a
+   multiple of their gcd between 1 and newSampleRate, so there are
+   newSampleRate / gcd phases. */
+static void buildSincTable(sonicStream stream, int oldSampleRate,
+                           int newSampleRate) {
+  int step = findGcd(oldSampleRate, newSampleRate);
+  int phases = newSampleRate / step;
   int i;
-  int total = 0;
+
+  stream->sincOldRate = oldSampleRate;
+  stream->sincNewRate = newSampleRate;
+  stream->sincStep = step;
+  stream->sincReciprocal = findReciprocal(newSampleRate);
+  stream->sincPhases = 0;
+  if (phases > SONIC_MAX_SINC_PHASES) {
+    return;
+  }
+  if (stream->sincWeights == NULL) {
+    stream->sincWeights = (int*)streamCalloc(
+        stream, SONIC_MAX_SINC_PHASES * SINC_FILTER_POINTS, sizeof(int));
+    if (stream->sincWeights == NULL) {
+      return;
+    }
+  }
+  for (i = 0; i < phases; i++) {
+    findSincWeights((i + 1) * step - 1, newSampleRate, stream->sincReciprocal,
+                    stream->sincWeights + i * SINC_FILTER_POINTS);
+  }
+  stream->sincPhases = phases;
+}
+
+/* Find the weights of the next output frame, from the table if there is one,
+   otherwise computed into weights. */
+static const int* findFrameWeights(sonicStream stream, int oldSampleRate,
+                                   int newSampleRate, int* weights) {
   int position = stream->newRatePosition * oldSampleRate;
   int leftPosition = stream->oldRatePosition * newSampleRate;
   int rightPosition = (stream->oldRatePosition + 1) * newSampleRate;
   int ratio = rightPosition - position - 1;
   int width = rightPosition - leftPosition;
-  int weight, value;
-  int oldSign;
-  int overflowCount = 0;
-
-  for (i = 0; i < SINC_FILTER_POINTS; i++) {
-    weight = findSincCoefficient(i, ratio, width);
-    value = in[i * stream->numChannels] * weight;
-    oldSign = getSign(total);
-    total += value;
-    if (oldSign != getSign(total) && getSign(value) == oldSign) {
-      /* We must have overflowed.  This can happen with a sinc filter. */
-      overflowCount += oldSign;
+  int phase;
+
+  if (stream->sincPhases > 0) {
+    /* The positions are not reset by a pitch change, check the phase */
+    phase = (ratio + 1) / stream->sincStep;
+    if (phase * stream->sincStep == ratio + 1 && phase >= 1 &&
+        phase <= stream->sincPhases) {
+      return stream->sincWeights + (phase - 1) * SINC_FILTER_POINTS;
     }
   }
-  /* It is better to clip than to wrap if there was a overflow. */
-  if (overflowCount > 0) {
-    return SHRT_MAX;
-  } else if (overflowCount < 0) {
-    return SHRT_MIN;
-  }
-  return total >> 16;
+  findSincWeights(ratio, width, stream->sincReciprocal, weights);
+  return weights;
 }
 
 /* Change the rate.  Interpolate with a sinc FIR filter using a Hann window. */
@@ -975,7 +2214,7 @@ static int adjustRate(sonicStream stream, float rate,
   int numChannels = stream->numChannels;
   int position;
   short *in, *out;
-  int i;
+  int weights[SINC_FILTER_POINTS];
   int N = SINC_FILTER_POINTS;
 
   /* Set these values to help with the integer math */
@@ -986,6 +2225,10 @@ static int adjustRate(sonicStream stream, float rate,
   if (stream->numOutputSamples == originalNumOutputSamples) {
     return 1;
   }
+  if (oldSampleRate != stream->sincOldRate ||
+      newSampleRate != stream->sincNewRate) {
+    buildSincTable(stream, oldSampleRate, newSampleRate);
+  }
   if (!moveNewSamplesToPitchBuffer(stream, originalNumOutputSamples)) {
     return 0;
   }
@@ -998,10 +2241,11 @@ static int adjustRate(sonicStream stream, float rate,
       }
       out = stream->outputBuffer + stream->numOutputSamples * numChannels;
       in = stream->pitchBuffer + position * numChannels;
-      for (i = 0; i < numChannels; i++) {
-        *out++ = interpolate(stream, in, oldSampleRate, newSampleRate);
-        in++;
-      }
+      /* Compute N-point sinc FIR-filter here.  Clip rather than overflow. */
+      stream->interpolate(
+          in, numChannels,
+          findFrameWeights(stream, oldSampleRate, newSampleRate, weights),
+          out);
       stream->newRatePosition++;
       stream->numOutputSamples++;
     }
@@ -1031,7 +2275,7 @@ static int skipPitchPeriod(sonicStream stream, short* samples, float speed,
   if (!enlargeOutputBufferIfNeeded(stream, newSamples)) {
     return 0;
   }
-  overlapAdd(newSamples, numChannels,
+  stream->overlap(newSamples, numChannels,
              stream->outputBuffer + stream->numOutputSamples * numChannels,
              samples, samples + period * numChannels);
   stream->numOutputSamples += newSamples;
@@ -1057,7 +2301,7 @@ static int insertPitchPeriod(sonicStream stream, short* samples, float speed,
   memcpy(out, samples, period * sizeof(short) * numChannels);
   out =
       stream->outputBuffer + (stream->numOutputSamples + period) * numChannels;
-  overlapAdd(newSamples, numChannels, out, samples + period * numChannels,
+  stream->overlap(newSamples, numChannels, out, samples + period * numChannels,
              samples);
   stream->numOutputSamples += period + newSamples;
   return newSamples;
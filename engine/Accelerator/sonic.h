@@ -73,6 +73,8 @@ extern "C" {
  * symbols and call the sonicIntXXX functions directly.
  */
 #define sonicCreateStream sonicIntCreateStream
+#define sonicGetArenaSize sonicIntGetArenaSize
+#define sonicCreateStreamInArena sonicIntCreateStreamInArena
 #define sonicDestroyStream sonicIntDestroyStream
 #define sonicWriteFloatToStream sonicIntWriteFloatToStream
 #define sonicWriteShortToStream sonicIntWriteShortToStream
@@ -82,6 +84,7 @@ extern "C" {
 #define sonicReadUnsignedCharFromStream sonicIntReadUnsignedCharFromStream
 #define sonicFlushStream sonicIntFlushStream
 #define sonicSamplesAvailable sonicIntSamplesAvailable
+#define sonicSamplesQueued sonicIntSamplesQueued
 #define sonicGetSpeed sonicIntGetSpeed
 #define sonicSetSpeed sonicIntSetSpeed
 #define sonicGetPitch sonicIntGetPitch
@@ -104,6 +107,14 @@ extern "C" {
 #define sonicSetDurationFeedbackStrength sonicIntSetDurationFeedbackStrength
 #define sonicComputeSpectrogram sonicIntComputeSpectrogram
 #define sonicGetSpectrogram sonicIntGetSpectrogram
+#define sonicEnableSimd sonicIntEnableSimd
+#define sonicGetSimdName sonicIntGetSimdName
+#define sonicSetPitchEstimator sonicIntSetPitchEstimator
+#define sonicGetPitchEstimator sonicIntGetPitchEstimator
+#define sonicEstimatePitchPeriod sonicIntEstimatePitchPeriod
+#define sonicGetPitchWindow sonicIntGetPitchWindow
+#define sonicSetChannelPitchMode sonicIntSetChannelPitchMode
+#define sonicGetChannelPitchMode sonicIntGetChannelPitchMode
 
 #endif /* SONIC_INTERNAL */
 
@@ -119,6 +130,14 @@ extern "C" {
 /* These are used to down-sample some inputs to improve speed */
 #define SONIC_AMDF_FREQ 4000
 
+/* Pitch estimators, see sonicSetPitchEstimator */
+#define SONIC_PITCH_AMDF 0
+#define SONIC_PITCH_FFT 1
+
+/* How channels are combined to find the pitch, see sonicSetChannelPitchMode */
+#define SONIC_CHANNELS_MIX 0
+#define SONIC_CHANNELS_JOINT 1
+
 struct sonicStreamStruct;
 typedef struct sonicStreamStruct* sonicStream;
 
@@ -128,6 +147,25 @@ typedef struct sonicStreamStruct* sonicStream;
 /* Create a sonic stream.  Return NULL only if we are out of memory and cannot
   allocate the stream. Set numChannels to 1 for mono, and 2 for stereo. */
 sonicStream sonicCreateStream(int sampleRate, int numChannels);
+/* Get the number of bytes sonicCreateStreamInArena needs for a stream that
+   never runs slower than minSpeed (the lowest of speed, speed/pitch and
+   speed*rate) and is written at most maxWriteSamples at a time.  Return 0 if
+   the arguments are out of range. */
+int sonicGetArenaSize(int sampleRate, int numChannels, float minSpeed,
+                      int maxWriteSamples);
+/* Create a sonic stream in arena, which must be at least sonicGetArenaSize
+   bytes and aligned like malloc'ed memory.  All of the stream's buffers are
+   allocated there up front, so it never calls malloc, and several streams
+   can run at once, unlike with SONIC_NO_MALLOC.  Read all the available output
+   after every write: buffers that would have to grow beyond the arena make the
+   write fail instead.  Return NULL if the arena is too small.  The arena
+   belongs to the caller and can be freed after sonicDestroyStream.
+   sonicSetSampleRate and sonicSetNumChannels leave the stream as it is when
+   the new format needs more than the arena holds, so size the arena for the
+   largest format the stream will be switched to. */
+sonicStream sonicCreateStreamInArena(void* arena, int arenaSize,
+                                     int sampleRate, int numChannels,
+                                     float minSpeed, int maxWriteSamples);
 /* Destroy the sonic stream. */
 void sonicDestroyStream(sonicStream stream);
 /* Attach user data to the stream. */
@@ -163,6 +201,9 @@ int sonicReadUnsignedCharFromStream(sonicStream stream, unsigned char* samples,
 int sonicFlushStream(sonicStream stream);
 /* Return the number of samples in the output buffer */
 int sonicSamplesAvailable(sonicStream stream);
+/* Return how many samples of output the input held back in the stream (to find
+   pitch periods in) will still make: the delay the stream adds, in samples. */
+int sonicSamplesQueued(sonicStream stream);
 /* Get the speed of the stream. */
 float sonicGetSpeed(sonicStream stream);
 /* Set the speed of the stream. */
@@ -194,13 +235,41 @@ void sonicSetQuality(sonicStream stream, int quality);
 /* Get the sample rate of the stream. */
 int sonicGetSampleRate(sonicStream stream);
 /* Set the sample rate of the stream.  This will drop any samples that have not
- * been read. */
+ * been read.  Ignored on an arena stream whose arena is too small for it. */
 void sonicSetSampleRate(sonicStream stream, int sampleRate);
 /* Get the number of channels. */
 int sonicGetNumChannels(sonicStream stream);
 /* Set the number of channels.  This will drop any samples that have not been
- * read. */
+ * read.  Ignored on an arena stream whose arena is too small for it. */
 void sonicSetNumChannels(sonicStream stream, int numChannels);
+/* Use SSE2/AVX2 or NEON for the pitch search, and SSE2/AVX2 for the
+   overlap-add and the down-sampling, when the CPU has it.  Default is on.  The
+   output is bit-exact with the plain C code either way. */
+void sonicEnableSimd(sonicStream stream, int enable);
+/* Get the name of the pitch search kernel in use: "avx2", "sse2", "neon" or
+   "scalar". */
+const char* sonicGetSimdName(sonicStream stream);
+/* Select how pitch periods are found.  SONIC_PITCH_AMDF (the default) is the
+   down-sampled AMDF search.  SONIC_PITCH_FFT finds the peak of the normalized
+   autocorrelation at the full sample rate, computed with an FFT, which is
+   O(n log n) instead of O(period^2) and more accurate at high sample rates. */
+void sonicSetPitchEstimator(sonicStream stream, int estimator);
+/* Get the pitch estimator. */
+int sonicGetPitchEstimator(sonicStream stream);
+/* Select how the channels of multi-channel input are combined to find the
+   pitch.  SONIC_CHANNELS_MIX (the default) averages them into one signal,
+   which can cancel out with wide or phase-inverted stereo.
+   SONIC_CHANNELS_JOINT looks for the period that matches every channel, each
+   counting by its own level, at the cost of one search per channel.  It only
+   pays off with SONIC_PITCH_FFT: the AMDF misses as often either way. */
+void sonicSetChannelPitchMode(sonicStream stream, int mode);
+/* Get how the channels are combined to find the pitch. */
+int sonicGetChannelPitchMode(sonicStream stream);
+/* Estimate the pitch period (in samples) of sonicGetPitchWindow samples with
+   the stream's estimator, without touching the stream's state. */
+int sonicEstimatePitchPeriod(sonicStream stream, short* samples);
+/* Get the number of samples sonicEstimatePitchPeriod looks at. */
+int sonicGetPitchWindow(sonicStream stream);
 /* This is a non-stream oriented interface to just change the speed of a sound
    sample.  It works in-place on the sample array, so there must be at least
    speed*numSamples available space in the array. Returns the new number of
@@ -0,0 +1,146 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sonic.h"
+
+/* Sonic throughput at 8/16/48 kHz, mono and stereo, with the plain C and the
+   SIMD kernels (pitch search, overlap-add, down-sampling and interpolation).
+   The input is a synthetic voice (harmonics on a gliding pitch, with pauses),
+   the outputs of both runs are compared sample by sample.
+   The SIMD run uses a stream created in an arena (the size is reported), which
+   must not change the output either.  A pitch other than 1 runs the pitch
+   shift (sinc interpolation) on top of the speed change.
+
+   Usage: SonicBench [speed] [seconds] [pitch] */
+
+#define CHUNK 1024
+
+static double cpuSeconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static short* makeVoice(int sampleRate, int numChannels, int numSamples) {
+  short* samples = (short*)malloc(sizeof(short) * numSamples * numChannels);
+  double phase = 0.0;
+  unsigned int noise = 1;
+  int i, c, h;
+
+  for (i = 0; i < numSamples; i++) {
+    double t = (double)i / sampleRate;
+    /* 100-250 Hz glide, 0.8 s of voice then 0.2 s of near silence */
+    double pitch = 175.0 + 75.0 * sin(2 * M_PI * 0.7 * t);
+    double envelope = fmod(t, 1.0) < 0.8 ? 1.0 : 0.02;
+    double value = 0.0;
+    phase += 2 * M_PI * pitch / sampleRate;
+    for (h = 1; h <= 8; h++) {
+      value += sin(h * phase) / h;
+    }
+    noise = noise * 1103515245 + 12345;
+    value = envelope * value * 6000.0 + ((int)(noise >> 16) % 400 - 200);
+    for (c = 0; c < numChannels; c++) {
+      samples[i * numChannels + c] = (short)(c == 0 ? value : value * 0.8);
+    }
+  }
+  return samples;
+}
+
+/* The slowest the stream runs, see sonicGetArenaSize */
+static float minSpeed(float speed, float pitch) {
+  return speed / pitch < speed ? speed / pitch : speed;
+}
+
+/* Runs the whole input through a stream, returns the CPU time. */
+static double run(const short* input, int numSamples, int sampleRate,
+                  int numChannels, float speed, float pitch, int simd,
+                  void* arena, int arenaSize, short* output, int maxOutput,
+                  int* numOutput, const char** kernel) {
+  sonicStream stream =
+      arena != NULL
+          ? sonicCreateStreamInArena(arena, arenaSize, sampleRate, numChannels,
+                                     minSpeed(speed, pitch), CHUNK)
+          : sonicCreateStream(sampleRate, numChannels);
+  short buffer[CHUNK * 2];
+  double start;
+  int pos, read, total = 0;
+
+  sonicSetSpeed(stream, speed);
+  sonicSetPitch(stream, pitch);
+  sonicEnableSimd(stream, simd);
+  *kernel = sonicGetSimdName(stream);
+  start = cpuSeconds();
+  for (pos = 0; pos <= numSamples; pos += CHUNK) {
+    if (pos < numSamples) {
+      int n = numSamples - pos < CHUNK ? numSamples - pos : CHUNK;
+      sonicWriteShortToStream(stream, input + pos * numChannels, n);
+    } else {
+      sonicFlushStream(stream);
+    }
+    while ((read = sonicReadShortFromStream(stream, buffer, CHUNK)) > 0) {
+      if (total + read <= maxOutput) {
+        memcpy(output + total * numChannels, buffer,
+               sizeof(short) * read * numChannels);
+      }
+      total += read;
+    }
+  }
+  start = cpuSeconds() - start;
+  sonicDestroyStream(stream);
+  *numOutput = total;
+  return start;
+}
+
+int main(int argc, char** argv) {
+  static const int rates[] = {8000, 16000, 48000};
+  float speed = argc > 1 ? (float)atof(argv[1]) : 1.5f;
+  int seconds = argc > 2 ? atoi(argv[2]) : 60;
+  float pitch = argc > 3 ? (float)atof(argv[3]) : 1.0f;
+  int r, numChannels;
+
+  if (speed <= 0.0f || seconds <= 0 || pitch <= 0.0f) {
+    fprintf(stderr, "Usage: %s [speed] [seconds] [pitch]\n", argv[0]);
+    return 1;
+  }
+  printf("speed %.2f, pitch %.2f, %d s of input\n", speed, pitch, seconds);
+  printf("%-6s %-3s %12s %12s %8s %9s %s\n", "rate", "ch", "scalar (xRT)",
+         "simd (xRT)", "gain", "arena KB", "kernel");
+  for (r = 0; r < 3; r++) {
+    for (numChannels = 1; numChannels <= 2; numChannels++) {
+      int numSamples = rates[r] * seconds;
+      int maxOutput = (int)(numSamples / speed) + rates[r];
+      short* input = makeVoice(rates[r], numChannels, numSamples);
+      short* plain = (short*)malloc(sizeof(short) * maxOutput * numChannels);
+      short* fast = (short*)malloc(sizeof(short) * maxOutput * numChannels);
+      int arenaSize = sonicGetArenaSize(rates[r], numChannels,
+                                        minSpeed(speed, pitch), CHUNK);
+      void* arena = malloc(arenaSize);
+      int plainCount, fastCount;
+      const char* kernel;
+      double plainTime =
+          run(input, numSamples, rates[r], numChannels, speed, pitch, 0, NULL,
+              0, plain, maxOutput, &plainCount, &kernel);
+      double fastTime =
+          run(input, numSamples, rates[r], numChannels, speed, pitch, 1,
+              arena, arenaSize, fast, maxOutput, &fastCount, &kernel);
+      int same = plainCount == fastCount &&
+                 memcmp(plain, fast, sizeof(short) * plainCount *
+                                         numChannels) == 0;
+
+      printf("%-6d %-3d %12.0f %12.0f %7.2fx %9.1f %s%s\n", rates[r],
+             numChannels, seconds / plainTime, seconds / fastTime,
+             plainTime / fastTime, arenaSize / 1024.0, kernel,
+             same ? "" : "  OUTPUT DIFFERS");
+      free(arena);
+      free(input);
+      free(plain);
+      free(fast);
+      if (!same) {
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
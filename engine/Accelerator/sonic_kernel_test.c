@@ -0,0 +1,175 @@
+/* The sonic SIMD kernels are static, so this takes the whole library in */
+#include "sonic.c"
+
+#include <stdio.h>
+
+/* Checks the SIMD overlap-add and down-sampling kernels bit for bit against
+   the plain C ones: 1 to 8 channels, ramps of 0 to MAX_RAMP frames (and a
+   few longer ones), down-sampling groups of 1 to MAX_GROUP samples, on
+   random full-scale input and on runs of SHRT_MIN and SHRT_MAX.  SSE2 and
+   AVX2 on x86-64, NEON on ARM.
+
+   Usage: SonicKernelTest, exits non-zero on the first mismatch */
+
+#define MAX_CHANNELS 8
+#define MAX_RAMP 300
+#define MAX_GROUP 48
+#define MAX_VALUES 40
+#define NUM_PATTERNS 3
+
+#if defined(SONIC_SAD_X86) || defined(SONIC_SAD_NEON)
+
+static const int longRamps[] = {511, 512, 1000, 2047, 4800};
+
+#define NUM_LONG_RAMPS (int)(sizeof(longRamps) / sizeof(longRamps[0]))
+#define LONGEST_RAMP 4800
+
+static unsigned int seed = 1;
+
+static short randomSample(void) {
+  seed = seed * 1103515245 + 12345;
+  return (short)(seed >> 16);
+}
+
+/* Pattern 0: random over the full range; 1: runs of SHRT_MIN and SHRT_MAX;
+   2: SHRT_MIN in one buffer against SHRT_MAX in the other. */
+static void fill(short* samples, int count, int pattern, int which) {
+  int i;
+
+  for (i = 0; i < count; i++) {
+    if (pattern == 0) {
+      samples[i] = randomSample();
+    } else if (pattern == 1) {
+      samples[i] = (i / 7) & 1 ? SHRT_MAX : SHRT_MIN;
+    } else {
+      samples[i] = which ? SHRT_MAX : SHRT_MIN;
+    }
+  }
+}
+
+/* Runs the kernel and the plain C overlap-add into buffers that start out
+   different, so that a value the kernel leaves out shows up too. */
+static int checkOverlap(sonicOverlapFunc kernel, const char* name,
+                        int numSamples, int numChannels, int pattern) {
+  static short down[LONGEST_RAMP * MAX_CHANNELS];
+  static short up[LONGEST_RAMP * MAX_CHANNELS];
+  static short expected[LONGEST_RAMP * MAX_CHANNELS + 1];
+  static short actual[LONGEST_RAMP * MAX_CHANNELS + 1];
+  int total = numSamples * numChannels;
+  int i;
+
+  fill(down, total, pattern, 0);
+  fill(up, total, pattern, 1);
+  for (i = 0; i <= total; i++) {
+    expected[i] = 0x1234;
+    actual[i] = -0x1234;
+  }
+  overlapAddScalar(numSamples, numChannels, expected, down, up);
+  kernel(numSamples, numChannels, actual, down, up);
+  for (i = 0; i < total; i++) {
+    if (actual[i] != expected[i]) {
+      fprintf(stderr,
+              "%s: %d channel(s), ramp %d, pattern %d: value %d is %d, "
+              "expected %d\n",
+              name, numChannels, numSamples, pattern, i, actual[i],
+              expected[i]);
+      return 0;
+    }
+  }
+  if (actual[total] != -0x1234) {
+    fprintf(stderr, "%s: %d channel(s), ramp %d: wrote past the end\n", name,
+            numChannels, numSamples);
+    return 0;
+  }
+  return 1;
+}
+
+static int checkOverlapKernel(sonicOverlapFunc kernel, const char* name) {
+  int numChannels, numSamples, pattern, i;
+
+  for (numChannels = 1; numChannels <= MAX_CHANNELS; numChannels++) {
+    for (pattern = 0; pattern < NUM_PATTERNS; pattern++) {
+      for (numSamples = 0; numSamples <= MAX_RAMP; numSamples++) {
+        if (!checkOverlap(kernel, name, numSamples, numChannels, pattern)) {
+          return 0;
+        }
+      }
+      for (i = 0; i < NUM_LONG_RAMPS; i++) {
+        if (!checkOverlap(kernel, name, longRamps[i], numChannels, pattern)) {
+          return 0;
+        }
+      }
+    }
+  }
+  printf("%s: ok\n", name);
+  return 1;
+}
+
+/* The input is sized exactly, so a read past the last group shows up under
+   a memory checker. */
+static int checkDownSample(sonicDownSampleFunc kernel, const char* name) {
+  short expected[MAX_VALUES + 1];
+  short actual[MAX_VALUES + 1];
+  int group, numValues, pattern, i;
+
+  for (group = 1; group <= MAX_GROUP; group++) {
+    for (numValues = 0; numValues <= MAX_VALUES; numValues++) {
+      for (pattern = 0; pattern < NUM_PATTERNS; pattern++) {
+        short* samples =
+            (short*)malloc(sizeof(short) * (group * numValues + 1));
+
+        fill(samples, group * numValues, pattern, numValues & 1);
+        for (i = 0; i <= numValues; i++) {
+          expected[i] = 0x1234;
+          actual[i] = -0x1234;
+        }
+        downSampleScalar(samples, expected, numValues, group);
+        kernel(samples, actual, numValues, group);
+        free(samples);
+        for (i = 0; i < numValues; i++) {
+          if (actual[i] != expected[i]) {
+            fprintf(stderr,
+                    "%s: group %d, %d values, pattern %d: value %d is %d, "
+                    "expected %d\n",
+                    name, group, numValues, pattern, i, actual[i],
+                    expected[i]);
+            return 0;
+          }
+        }
+        if (actual[numValues] != -0x1234) {
+          fprintf(stderr, "%s: group %d, %d values: wrote past the end\n",
+                  name, group, numValues);
+          return 0;
+        }
+      }
+    }
+  }
+  printf("%s: ok\n", name);
+  return 1;
+}
+
+#endif  /* SONIC_SAD_X86 || SONIC_SAD_NEON */
+
+int main(void) {
+  int ok = 1;
+
+#if defined(SONIC_SAD_X86) && !defined(SONIC_USE_SIN)
+  ok = ok && checkOverlapKernel(overlapAddSse2, "overlapAddSse2");
+  if (__builtin_cpu_supports("avx2")) {
+    ok = ok && checkOverlapKernel(overlapAddAvx2, "overlapAddAvx2");
+  } else {
+    printf("overlapAddAvx2: skipped, no AVX2\n");
+  }
+#endif
+#if defined(SONIC_SAD_NEON) && !defined(SONIC_USE_SIN)
+  ok = ok && checkOverlapKernel(overlapAddNeon, "overlapAddNeon");
+#endif
+#if defined(SONIC_SAD_X86)
+  ok = ok && checkDownSample(downSampleSse2, "downSampleSse2");
+#elif defined(SONIC_SAD_NEON)
+  ok = ok && checkDownSample(downSampleNeon, "downSampleNeon");
+#else
+  printf("No SIMD overlap-add or down-sampling kernel on this CPU\n");
+#endif
+  return ok ? 0 : 1;
+}
@@ -28,6 +28,11 @@ int AudioData::getSampleRate() const {
     return header.sampleRate;
 }
 
+void AudioData::setSampleRate(int sampleRate) {
+    header.sampleRate = sampleRate;
+    header.byteRate = sampleRate * header.blockAlign;
+}
+
 int AudioData::getChannels() const {
     return header.numChannels;
 }
@@ -113,4 +118,8 @@ size_t AudioData::getEncodedDataSizeSum() {
         totalSize += encodedData.data.size();
     }
     return totalSize;
-}
\ No newline at end of file
+}
+
+VoiceActivity& AudioData::getVoiceActivity() {
+    return voiceActivity;
+}
@@ -31,6 +31,7 @@ public:
     unsigned int getDataSize() const override;
 
     int getSampleRate() const override;
+    void setSampleRate(int sampleRate) override;
     int getChannels() const override;
     int getSampleSize() const override;
     void updateData(std::vector<int16_t> newData) override;
@@ -41,6 +42,7 @@ public:
     void removeEncodedData(uint32_t sequenceNumber);
     std::list<EncodedData>& getEncodedDataList() override;
     size_t getEncodedDataSizeSum() override;
+    VoiceActivity& getVoiceActivity() override;
 
 private:
     void loadFromFile(const std::string& filePath);
@@ -49,6 +51,7 @@ private:
 
     std::vector<int16_t> data;
     std::list<EncodedData> encodedDataList; // List to store encoded data
+    VoiceActivity voiceActivity;            // Set by the preprocessor's VAD
 
     WAVHeader header;
 };
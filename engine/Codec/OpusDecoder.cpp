@@ -106,6 +106,43 @@ std::vector<int16_t> OpusDecoder::fillGap(EncodedData& encodedData, int gap) {
     return combinedOutput;
 }
 
+// Conceals one missing frame of frameSize samples. future is the first packet received after the gap
+// (nullptr if none), distance is how many frames after the missing one it starts: FEC is used when
+// it's the very next packet, DRED when its redundancy reaches back far enough, PLC otherwise.
+std::vector<int16_t> OpusDecoder::concealFrame(const EncodedData* future, int distance, int frameSize) {
+    int maxOutputSamples = maxFrameSize * mNumChannels;
+    std::vector<int16_t> output(maxOutputSamples);
+    int outputSamples = 0;
+
+    if (future && distance == 1 && opus_packet_has_lbrr(future->data.data(), future->data.size())) {
+        mFECCount++;
+        outputSamples = opus_decode(decoder, future->data.data(), future->data.size(), output.data(), frameSize, 1);
+    } else {
+        int dredSamples = 0;
+        if (future && distance > 0) {
+            int dred_end = 0;
+            dredSamples = opus_dred_parse(dredDecoder, dred, future->data.data(), future->data.size(),
+                                          std::min(48000, distance * frameSize), mSampleRate, &dred_end, 0);
+            if (dredSamples < 0) {
+                throw std::runtime_error("Failed to parse DRED data");
+            }
+        }
+        if (dredSamples >= distance * frameSize && dredSamples > 0) {
+            mDREDCount++;
+            outputSamples = opus_decoder_dred_decode(decoder, dred, distance * frameSize, output.data(), frameSize);
+        } else {
+            mPLCCount++;
+            outputSamples = opus_decode(decoder, nullptr, 0, output.data(), frameSize, 0);
+        }
+    }
+    if (outputSamples < 0) {
+        throw std::runtime_error("Failed to conceal audio data");
+    }
+
+    output.resize(outputSamples * mNumChannels);
+    return output;
+}
+
 std::vector<int16_t> OpusDecoder::decodeAll(const std::list<EncodedData>& encodedDataList) {
     std::vector<int16_t> combinedOutput;
     int gap = 0;
@@ -16,9 +16,14 @@ public:
     std::vector<int16_t> decode(const uint8_t* inputData, int inputSize);
     std::vector<int16_t> decodeAll(const std::list<EncodedData>& encodedDataList);
     std::vector<int16_t> fillGap(EncodedData& encodedData, int gap);
+    std::vector<int16_t> concealFrame(const EncodedData* future, int distance, int frameSize);
     bool handleAudioData(IAudioData& audioData);
     void destroy();
     void setComplexity(int complexity);
+    bool isInitialized() const { return decoder != nullptr; }
+    int getPLCCount() const { return mPLCCount; }
+    int getFECCount() const { return mFECCount; }
+    int getDREDCount() const { return mDREDCount; }
 
 private:
     OpusDecoder(const OpusDecoder&) = delete;
@@ -5,6 +5,25 @@
 #include <stdexcept>
 #include "OpusEncoder.h"
 
+// Bit rate for the frames the preprocessor's VAD marked silent, enough for comfort noise
+#define SILENCE_BIT_RATE 6000
+
+// True if every VAD frame covering the numSamples samples (per channel) from pos is silent. Frames
+// past the end of the flags count as speech.
+static bool isSilent(const VoiceActivity& voiceActivity, int pos, int numSamples) {
+    size_t first = pos / voiceActivity.frameSamples;
+    size_t last = (pos + numSamples - 1) / voiceActivity.frameSamples;
+    if (last >= voiceActivity.flags.size()) {
+        return false;
+    }
+    for (size_t i = first; i <= last; i++) {
+        if (voiceActivity.flags[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
 OpusEncoder::OpusEncoder()
     : encoder(nullptr), maxPacketSize(4000),mFramePeriod(10) {
     
@@ -92,11 +111,26 @@ bool OpusEncoder::handleAudioData(IAudioData& audioData) {
     int offset = 0;
     int seqNum = 1;
 
+    // Silent frames still get a packet (the decoder would conceal a gap), just a cheaper one
+    const VoiceActivity& voiceActivity = audioData.getVoiceActivity();
+    bool useVad = voiceActivity.sampleRate == mSampleRate && voiceActivity.frameSamples > 0
+                  && !voiceActivity.flags.empty();
+    bool silence = false;
+    int silentFrames = 0;
+
     std::cout<<"input bytes: "<<inputSize<<" frame size: "<<frameSize<<std::endl;
     // Encode the audio data in chunks
     while (offset < inputSize) {
         int chunkSize = std::min(frameShorts, inputSize - offset);
         std::vector<uint8_t> encodedChunk;
+        if (useVad) {
+            bool silent = isSilent(voiceActivity, offset / audioData.getChannels(), chunkSize / audioData.getChannels());
+            if (silent != silence) {
+                setSilence(silent);
+                silence = silent;
+            }
+            silentFrames += silent ? 1 : 0;
+        }
         if (chunkSize < frameShorts) {
             std::vector<int16_t> tempBuffer(frameShorts, 0);
             std::copy(inputData + offset, inputData + offset + chunkSize, tempBuffer.begin());
@@ -118,15 +152,35 @@ bool OpusEncoder::handleAudioData(IAudioData& audioData) {
         seqNum++;
         offset += chunkSize;
     }
+    if (silence) {
+        setSilence(false);
+    }
     
     // Print the size of original data and encoded data
     std::cout << "Original audio data size: " << inputSize * sizeof(int16_t) << " bytes" << std::endl;
     std::cout << "Encoded audio data size: " << audioData.getEncodedDataSizeSum() << " bytes. Packet count(after loss): "
               << audioData.getEncodedDataList().size()<<" loss count: "<<packetLossCnt<< std::endl;
+    if (useVad) {
+        std::cout << "Silent frames (VAD): " << silentFrames << "/" << seqNum - 1 << " encoded at "
+                  << SILENCE_BIT_RATE << " bps" << std::endl;
+    }
 
     return true;
 }
 
+void OpusEncoder::setSilence(bool silent) {
+    if (silent) {
+        int bitRate = (mBitRate == OPUS_AUTO || mBitRate > SILENCE_BIT_RATE) ? SILENCE_BIT_RATE : mBitRate;
+        opus_encoder_ctl(encoder, OPUS_SET_BITRATE(bitRate));
+        opus_encoder_ctl(encoder, OPUS_SET_COMPLEXITY(0));
+    } else {
+        opus_encoder_ctl(encoder, OPUS_SET_BITRATE(mBitRate));
+        if ((mComplexity >= 0) && (mComplexity <= 10)) {
+            opus_encoder_ctl(encoder, OPUS_SET_COMPLEXITY(mComplexity));
+        }
+    }
+}
+
 void OpusEncoder::destroy() {
     if (encoder) {
         opus_encoder_destroy(encoder);
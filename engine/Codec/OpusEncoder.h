@@ -27,6 +27,9 @@ private:
     OpusEncoder(const OpusEncoder&) = delete;
     OpusEncoder& operator=(const OpusEncoder&) = delete;
 
+    // Switches between the configured bit rate/complexity and the cheap ones for silent frames
+    void setSilence(bool silent);
+
     OpusEncoder* encoder;
     int mSampleRate;
     int mNumChannels;
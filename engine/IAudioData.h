@@ -9,6 +9,15 @@ struct EncodedData {
     std::vector<uint8_t> data;     // Encoded data
 };
 
+// Voice activity per frame, filled by the preprocessor for the stages after it: flags[i] is 1 if
+// the frameSamples samples (per channel) from i * frameSamples hold speech. Only valid while the
+// data is still at sampleRate; empty (sampleRate 0) if nothing ran a VAD.
+struct VoiceActivity {
+    int sampleRate = 0;
+    int frameSamples = 0;
+    std::vector<uint8_t> flags;
+};
+
 class IAudioData {
 public:
     virtual ~IAudioData() {};
@@ -17,12 +26,15 @@ public:
     virtual unsigned int getDataSize() const = 0;
 
     virtual int getSampleRate() const = 0;
+    // For handlers that change the rate of the samples (the resampler)
+    virtual void setSampleRate(int sampleRate) = 0;
     virtual int getChannels() const = 0;
     virtual int getSampleSize() const = 0;
     virtual void updateData(std::vector<int16_t> newData) = 0;
     virtual void addEncodedData(uint32_t sequenceNumber, const std::vector<uint8_t>& data) = 0;
     virtual std::list<EncodedData>& getEncodedDataList() = 0;
     virtual size_t getEncodedDataSizeSum() = 0;
+    virtual VoiceActivity& getVoiceActivity() = 0;
 };
 
 #endif // IAUDIODATA_H
\ No newline at end of file
@@ -0,0 +1,228 @@
+#include "JitterBufferHandler.h"
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+
+#define MAX_PACKET_SIZE 4000
+// Most playout time after the last arrival, in case the buffer never gets past the last packet
+#define MAX_TAIL_MS 10000
+// The sound card takes this much audio at a time
+#define OUTPUT_MS 10
+
+JitterBufferHandler::JitterBufferHandler(std::shared_ptr<OpusDecoder> decoder, int networkDelayMs, int jitterMs)
+    : mDecoder(decoder), mJitter(nullptr), mGen(12345), mNetworkDelayMs(networkDelayMs), mJitterMs(jitterMs),
+      mFrameSize(0), mAdaptive(false), mPlayed(0), mConcealed(0), mInserted(0) {}
+
+void JitterBufferHandler::setAdaptivePlayout(bool adaptive) {
+    mAdaptive = adaptive;
+}
+
+JitterBufferHandler::~JitterBufferHandler() {
+    if (mJitter) {
+        jitter_buffer_destroy(mJitter);
+        mJitter = nullptr;
+    }
+}
+
+std::vector<int16_t> JitterBufferHandler::conceal(uint32_t timestamp, int span) {
+    std::vector<int16_t> output;
+    for (int offset = 0; offset + mFrameSize <= span; offset += mFrameSize) {
+        uint32_t missingSeq = (timestamp + offset) / mFrameSize + 1;
+
+        // Anything older than the missing frame can't be played any more
+        mArrived.erase(mArrived.begin(), mArrived.lower_bound(missingSeq + 1));
+
+        const EncodedData* future = nullptr;
+        int distance = 0;
+        if (!mArrived.empty()) {
+            future = mArrived.begin()->second;
+            distance = mArrived.begin()->first - missingSeq;
+        }
+        std::vector<int16_t> frame = mDecoder->concealFrame(future, distance, mFrameSize);
+        output.insert(output.end(), frame.begin(), frame.end());
+    }
+    return output;
+}
+
+bool JitterBufferHandler::handleAudioData(IAudioData& audioData) {
+    const std::list<EncodedData>& encodedDataList = audioData.getEncodedDataList();
+    if (encodedDataList.empty()) {
+        std::cerr << "JitterBufferHandler: no encoded data" << std::endl;
+        return false;
+    }
+
+    int sampleRate = audioData.getSampleRate();
+    if (!mDecoder->isInitialized()) {
+        mDecoder->initialize(sampleRate, audioData.getChannels());
+    }
+
+    const EncodedData& first = encodedDataList.front();
+    mFrameSize = opus_packet_get_nb_samples(first.data.data(), first.data.size(), sampleRate);
+    if (mFrameSize <= 0) {
+        throw std::runtime_error("Failed to get Opus frame size");
+    }
+    if (mJitter) {
+        jitter_buffer_destroy(mJitter);
+    }
+    mJitter = jitter_buffer_init(mFrameSize);
+    mArrived.clear();
+    if (mAdaptive) {
+        mController = std::make_unique<PlayoutController>(sampleRate, audioData.getChannels(), mFrameSize);
+        mController->attach(mJitter);
+    }
+
+    // Simulated network: packet n is sent at n frames and arrives after a fixed delay plus an
+    // exponentially distributed extra delay, which can reorder packets
+    uint64_t frameUs = (uint64_t)mFrameSize * 1000000 / sampleRate;
+    std::exponential_distribution<double> jitterDist(mJitterMs > 0 ? 1.0 / (mJitterMs * 1000.0) : 1.0);
+    std::vector<Arrival> arrivals;
+    for (const auto& encodedData : encodedDataList) {
+        uint64_t sendUs = (encodedData.sequenceNumber - 1) * frameUs;
+        uint64_t extraUs = mJitterMs > 0 ? (uint64_t)jitterDist(mGen) : 0;
+        arrivals.push_back({sendUs + mNetworkDelayMs * 1000 + extraUs, &encodedData});
+    }
+    std::stable_sort(arrivals.begin(), arrivals.end(),
+                     [](const Arrival& a, const Arrival& b) { return a.timeUs < b.timeUs; });
+
+    int channels = audioData.getChannels();
+    int outputSamples = std::max(1, sampleRate * OUTPUT_MS / 1000);
+    size_t outputLength = (size_t)outputSamples * channels;
+    std::vector<int16_t> output;
+    // Decoded (and stretched) audio the sound card has not taken yet
+    std::vector<int16_t> pending;
+    std::vector<int> latencyMs;
+    std::vector<JitterBufferPacket> batch;
+    std::vector<char> buffer(MAX_PACKET_SIZE);
+    // Playout clock: the sound card takes OUTPUT_MS of audio every OUTPUT_MS. Packets are taken from
+    // the jitter buffer until that much is ready, more than one when playing faster, none at all
+    // when slower and enough is still pending.
+    uint64_t now = arrivals.front().timeUs;
+    size_t next = 0;
+    // End of the newest packet put so far: once the playout pointer is past it, whatever is still
+    // stored (duplicates, packets that came in just too late) can never be played
+    uint32_t newestEnd = 0;
+    int tailTicks = 0;
+    int maxTailTicks = (int)((int64_t)MAX_TAIL_MS * sampleRate / 1000 / mFrameSize);
+    bool finished = false;
+    JitterBufferStats stats;
+
+    while (!finished) {
+        batch.clear();
+        while (next < arrivals.size() && arrivals[next].timeUs <= now) {
+            const EncodedData* packet = arrivals[next].packet;
+            JitterBufferPacket jitterPacket;
+            jitterPacket.data = (char*)packet->data.data();
+            jitterPacket.len = packet->data.size();
+            jitterPacket.timestamp = (packet->sequenceNumber - 1) * mFrameSize;
+            jitterPacket.span = mFrameSize;
+            jitterPacket.sequence = packet->sequenceNumber;
+            jitterPacket.user_data = packet->sequenceNumber;
+            batch.push_back(jitterPacket);
+            if (newestEnd == 0 || (int32_t)(jitterPacket.timestamp + jitterPacket.span - newestEnd) > 0) {
+                newestEnd = jitterPacket.timestamp + jitterPacket.span;
+            }
+            mArrived[packet->sequenceNumber] = packet;
+            next++;
+        }
+        if (!batch.empty()) {
+            jitter_buffer_put_many(mJitter, batch.data(), batch.size());
+        }
+
+        while (!finished && pending.size() < outputLength) {
+            if (mController) {
+                mController->update(mJitter);
+            }
+
+            JitterBufferPacket out;
+            out.data = buffer.data();
+            out.len = buffer.size();
+            std::vector<int16_t> frame;
+            int ret = jitter_buffer_get(mJitter, &out, mFrameSize, nullptr);
+            if (ret == JITTER_BUFFER_OK) {
+                frame = mDecoder->decode((const uint8_t*)out.data, out.len);
+                mArrived.erase(mArrived.begin(), mArrived.upper_bound(out.user_data));
+                // Latency at the point of output: the frame is heard once the sound card has played
+                // what is still pending and what sonic holds back ahead of it
+                int ahead = (int)(pending.size() / channels) + (mController ? mController->getQueued() : 0);
+                double playUs = now + (double)ahead * 1000000 / sampleRate;
+                latencyMs.push_back((int)((playUs - (out.user_data - 1) * frameUs) / 1000));
+                mPlayed++;
+            } else if (ret == JITTER_BUFFER_INSERTION) {
+                // The buffer wants to grow: play PLC without moving forward (the next packet is still to come).
+                // With adaptive playout that can be less than a frame, the delay step is a multiple of 2.5 ms.
+                for (int left = out.span; left > 0; left -= mFrameSize) {
+                    std::vector<int16_t> concealed = mDecoder->concealFrame(nullptr, 0, std::min(left, mFrameSize));
+                    frame.insert(frame.end(), concealed.begin(), concealed.end());
+                }
+                mInserted++;
+            } else if (ret == JITTER_BUFFER_MISSING && out.span > 0) {
+                frame = conceal(out.timestamp, out.span);
+                mConcealed++;
+            }
+
+            bool decoded = !frame.empty();
+            if (mController) {
+                frame = mController->process(mJitter, frame);
+            }
+            pending.insert(pending.end(), frame.begin(), frame.end());
+            jitter_buffer_tick(mJitter);
+
+            jitter_buffer_ctl(mJitter, JITTER_BUFFER_GET_STATS, &stats);
+            if (next == arrivals.size()) {
+                if (stats.stored == 0
+                    || (int32_t)((uint32_t)jitter_buffer_get_pointer_timestamp(mJitter) - newestEnd) >= 0) {
+                    finished = true;
+                } else if (++tailTicks > maxTailTicks) {
+                    std::cerr << "JitterBufferHandler: " << stats.stored << " packet(s) still stored "
+                              << MAX_TAIL_MS << " ms after the last arrival, giving up" << std::endl;
+                    finished = true;
+                }
+            }
+            if (!decoded) {
+                // Nothing to play this time, the sound card gets what there is
+                break;
+            }
+        }
+
+        size_t take = finished ? pending.size() : std::min(pending.size(), outputLength);
+        output.insert(output.end(), pending.begin(), pending.begin() + take);
+        pending.erase(pending.begin(), pending.begin() + take);
+        now += (uint64_t)outputSamples * 1000000 / sampleRate;
+    }
+    if (mController) {
+        std::vector<int16_t> rest = mController->flush();
+        output.insert(output.end(), rest.begin(), rest.end());
+    }
+
+    audioData.updateData(output);
+    printReport(latencyMs);
+    return true;
+}
+
+void JitterBufferHandler::printReport(const std::vector<int>& latencyMs) {
+    JitterBufferStats stats;
+    jitter_buffer_ctl(mJitter, JITTER_BUFFER_GET_STATS, &stats);
+
+    std::vector<int> sorted(latencyMs);
+    std::sort(sorted.begin(), sorted.end());
+    double average = 0;
+    for (int latency : sorted) {
+        average += latency;
+    }
+    if (!sorted.empty()) {
+        average /= sorted.size();
+    }
+
+    std::cout << "Jitter buffer: played " << mPlayed << " concealed " << mConcealed << " inserted " << mInserted
+              << " late " << stats.late << " discarded " << stats.discarded << " jitter " << stats.jitter << std::endl;
+    std::cout << "Concealment: PLC " << mDecoder->getPLCCount() << " FEC " << mDecoder->getFECCount()
+              << " DRED " << mDecoder->getDREDCount() << std::endl;
+    if (mController) {
+        std::cout << "Adaptive playout: average speed " << mController->getAverageSpeed()
+                  << " jumps " << mController->getJumps() << std::endl;
+    }
+    if (!sorted.empty()) {
+        std::cout << "Mouth-to-ear latency (ms, send to output): average " << average << " p50 " << sorted[sorted.size() / 2]
+                  << " p95 " << sorted[sorted.size() * 95 / 100] << " max " << sorted.back() << std::endl;
+    }
+}
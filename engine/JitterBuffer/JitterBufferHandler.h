@@ -0,0 +1,56 @@
+#ifndef JITTERBUFFERHANDLER_H
+#define JITTERBUFFERHANDLER_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <map>
+#include <random>
+#include "IAudioData.h"
+#include "IAudioDataHandler.h"
+#include "OpusDecoder.h"
+#include "PlayoutController.h"
+#include "speex/speex_jitter.h"
+
+// Sends the encoded packets through a simulated network into the Speex jitter buffer and decodes
+// what the playout side gets every frame, replacing OpusDecoder in the chain. Missing frames are
+// concealed by the decoder (FEC/DRED from the next packet that already arrived, PLC otherwise).
+class JitterBufferHandler : public IAudioDataHandler {
+public:
+    // networkDelayMs: fixed one-way delay, jitterMs: mean of the random extra delay (exponential)
+    JitterBufferHandler(std::shared_ptr<OpusDecoder> decoder, int networkDelayMs, int jitterMs);
+    ~JitterBufferHandler();
+
+    // Time-stretch the playout to follow the jitter buffer's delay (see PlayoutController)
+    void setAdaptivePlayout(bool adaptive);
+    bool handleAudioData(IAudioData& audioData);
+
+private:
+    JitterBufferHandler(const JitterBufferHandler&) = delete;
+    JitterBufferHandler& operator=(const JitterBufferHandler&) = delete;
+
+    struct Arrival {
+        uint64_t timeUs;            // Arrival time at the receiver
+        const EncodedData* packet;
+    };
+
+    std::vector<int16_t> conceal(uint32_t timestamp, int span);
+    void printReport(const std::vector<int>& latencyMs);
+
+    std::shared_ptr<OpusDecoder> mDecoder;
+    JitterBuffer* mJitter;
+    std::mt19937 mGen;
+    int mNetworkDelayMs;
+    int mJitterMs;
+    int mFrameSize;     // Samples per channel in one packet, also the jitter buffer step
+    bool mAdaptive;
+    std::unique_ptr<PlayoutController> mController;
+
+    std::map<uint32_t, const EncodedData*> mArrived;    // Arrived and not played yet, by sequence number
+
+    int mPlayed;
+    int mConcealed;
+    int mInserted;
+};
+
+#endif // JITTERBUFFERHANDLER_H
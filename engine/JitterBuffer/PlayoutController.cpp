@@ -0,0 +1,109 @@
+#include "PlayoutController.h"
+#include <algorithm>
+#include <cmath>
+
+#define MIN_SPEED 0.9f
+#define MAX_SPEED 1.3f
+// Speed change per ms of excess (or missing) buffering
+#define SPEED_PER_MS 0.01f
+// Once there is excess buffering, drain it to this far below the jitter buffer's optimum: that
+// prices in dropping and inserting, but a slowdown builds buffering back up before packets are late
+#define TARGET_OFFSET_MS 15
+// Shortfalls below the target smaller than this are left alone, so the speed sits at 1.0
+// (unstretched) most of the time instead of hunting around it
+#define DEAD_BAND_MS 10
+// Delay granularity asked of the jitter buffer, a multiple of 2.5 ms so that insertions can still
+// be concealed in whole Opus frames
+#define DELAY_STEP_MS 5
+// Deviations of this many frames or more are left to the jitter buffer (drop/insert)
+#define JUMP_FRAMES 6
+
+PlayoutController::PlayoutController(int sampleRate, int numChannels, int frameSize)
+    : mSampleRate(sampleRate), mNumChannels(numChannels), mFrameSize(frameSize), mSpeed(1.0f),
+      mWritten(0), mRead(0), mReported(0), mJumps(0), mSpeedSum(0), mFrames(0) {
+    mStream = sonicCreateStream(sampleRate, numChannels);
+}
+
+PlayoutController::~PlayoutController() {
+    if (mStream) {
+        sonicDestroyStream(mStream);
+        mStream = nullptr;
+    }
+}
+
+void PlayoutController::attach(JitterBuffer* jitter) {
+    spx_int32_t autoAdjust = 0;
+    jitter_buffer_ctl(jitter, JITTER_BUFFER_SET_AUTO_ADJUST, &autoAdjust);
+    spx_int32_t delayStep = std::max(1, mSampleRate * DELAY_STEP_MS / 1000);
+    jitter_buffer_ctl(jitter, JITTER_BUFFER_SET_DELAY_STEP, &delayStep);
+}
+
+void PlayoutController::update(JitterBuffer* jitter) {
+    spx_int32_t opt = 0;
+    jitter_buffer_ctl(jitter, JITTER_BUFFER_GET_OPT_DELAY, &opt);
+
+    // What sonic holds back is buffering too, it delays the output just like the jitter buffer
+    float excessMs = (opt + getQueued()) * 1000.0f / mSampleRate;
+    float aboveTargetMs = excessMs + TARGET_OFFSET_MS;
+    if (std::abs(opt) >= JUMP_FRAMES * mFrameSize) {
+        // Too far off to stretch it away in reasonable time
+        jitter_buffer_update_delay(jitter, nullptr, nullptr);
+        mSpeed = 1.0f;
+        mJumps++;
+    } else if (excessMs > 0 || (mSpeed > 1.0f && aboveTargetMs > 0)) {
+        // Started by any real excess, so a buffer that never has any (no jitter) is left alone
+        mSpeed = std::min(MAX_SPEED, 1.0f + SPEED_PER_MS * aboveTargetMs);
+    } else if (aboveTargetMs < -DEAD_BAND_MS) {
+        // Packets are about to be late: slow down to build up buffering
+        mSpeed = std::max(MIN_SPEED, 1.0f + SPEED_PER_MS * aboveTargetMs);
+    } else {
+        mSpeed = 1.0f;
+    }
+}
+
+std::vector<int16_t> PlayoutController::readAll() {
+    std::vector<int16_t> output;
+    int available = sonicSamplesAvailable(mStream);
+    if (available > 0) {
+        output.resize(available * mNumChannels);
+        int read = sonicReadShortFromStream(mStream, output.data(), available);
+        output.resize(read * mNumChannels);
+        mRead += read;
+    }
+    return output;
+}
+
+int64_t PlayoutController::removed() const {
+    // Whatever went in and neither came out nor is still held back was stretched away
+    return mWritten - mRead - getQueued();
+}
+
+std::vector<int16_t> PlayoutController::process(JitterBuffer* jitter, const std::vector<int16_t>& frame) {
+    if (mSpeed == 1.0f && sonicGetSpeed(mStream) != 1.0f) {
+        // Done stretching: play out what sonic held back to find pitch periods in, rather than
+        // carry its ~30 ms look-ahead as extra delay
+        sonicFlushStream(mStream);
+    }
+    sonicSetSpeed(mStream, mSpeed);
+    sonicWriteShortToStream(mStream, frame.data(), frame.size() / mNumChannels);
+    mWritten += frame.size() / mNumChannels;
+    std::vector<int16_t> output = readAll();
+
+    spx_int32_t adjustment = (spx_int32_t)(removed() - mReported);
+    if (adjustment != 0) {
+        jitter_buffer_ctl(jitter, JITTER_BUFFER_ADJUST_DELAY, &adjustment);
+        mReported += adjustment;
+    }
+    mSpeedSum += mSpeed;
+    mFrames++;
+    return output;
+}
+
+std::vector<int16_t> PlayoutController::flush() {
+    sonicFlushStream(mStream);
+    return readAll();
+}
+
+double PlayoutController::getAverageSpeed() const {
+    return mFrames > 0 ? mSpeedSum / mFrames : 1.0;
+}
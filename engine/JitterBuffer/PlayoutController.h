@@ -0,0 +1,54 @@
+#ifndef PLAYOUTCONTROLLER_H
+#define PLAYOUTCONTROLLER_H
+
+#include <cstdint>
+#include <vector>
+#include "sonic.h"
+#include "speex/speex_jitter.h"
+
+// Adaptive playout: instead of letting the jitter buffer drop or insert whole delay steps, reads
+// the adjustment it wants and plays the decoded frames slightly faster (to drain excess buffering)
+// or slower (to build some up) through a streaming sonic stretcher. Only large deviations are
+// still handed to the jitter buffer as a jump.
+class PlayoutController {
+public:
+    PlayoutController(int sampleRate, int numChannels, int frameSize);
+    ~PlayoutController();
+
+    // Takes over the delay adjustment of a new jitter buffer: turns its own drop/insert off and
+    // lets it aim at a finer delay than whole frames, which stretching can follow
+    void attach(JitterBuffer* jitter);
+    // Picks the speed for the next frame, call before each jitter_buffer_get()
+    void update(JitterBuffer* jitter);
+    // Time-stretches one decoded frame and tells the jitter buffer how much buffering that removed
+    std::vector<int16_t> process(JitterBuffer* jitter, const std::vector<int16_t>& frame);
+    // Whatever sonic still holds, at the end of the stream
+    std::vector<int16_t> flush();
+
+    // Samples per channel sonic holds back to find pitch periods in: delay after the jitter buffer
+    int getQueued() const { return sonicSamplesQueued(mStream); }
+    float getSpeed() const { return mSpeed; }
+    int getJumps() const { return mJumps; }
+    double getAverageSpeed() const;
+
+private:
+    PlayoutController(const PlayoutController&) = delete;
+    PlayoutController& operator=(const PlayoutController&) = delete;
+
+    std::vector<int16_t> readAll();
+    int64_t removed() const;
+
+    sonicStream mStream;
+    int mSampleRate;
+    int mNumChannels;
+    int mFrameSize;
+    float mSpeed;
+    int64_t mWritten;       // Samples per channel written to sonic
+    int64_t mRead;          // and read back out of it
+    int64_t mReported;      // Buffering removed by stretching and reported to the jitter buffer
+    int mJumps;
+    double mSpeedSum;
+    int mFrames;
+};
+
+#endif // PLAYOUTCONTROLLER_H
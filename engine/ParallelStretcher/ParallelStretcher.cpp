@@ -0,0 +1,311 @@
+#include "ParallelStretcher.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+#include <system_error>
+#include <thread>
+#include "Accelerator.h"
+#include "SoundToucher.h"
+
+// Segments shorter than this are not worth a thread of their own
+#define MIN_SEGMENT_MS 2000
+// More segments than threads, so a thread that finishes early can pick up another one
+#define SEGMENTS_PER_THREAD 4
+// A cut goes to the quietest frame within this distance of its nominal place (at most a quarter
+// of a segment either way)
+#define SEARCH_MS 500
+#define FRAME_MS 10
+// Input each segment gets on both sides of its cuts, crossfaded with the neighbour's
+#define OVERLAP_MS 20
+// And after that, stretched but dropped: the engines do not get the very end of a stream right.
+// The last segment gets silence there.
+#define TAIL_MS 50
+// Furthest a segment is moved to line its waveform up with the one it fades in from, either way.
+// Half of the longest pitch period, 20 ms, is enough to line up any voice.
+#define ALIGN_MS 10
+// Samples per channel written per call into the engines
+#define CHUNK_SAMPLES 960
+// Crossfade weights in Q15
+#define WEIGHT_ONE 32768
+
+ParallelStretcher::ParallelStretcher(const std::string& engine, float speed, int numThreads)
+    : mEngine(engine), mSpeed(speed), mNumThreads(numThreads) {
+    if (mNumThreads <= 0) {
+        mNumThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+}
+
+ParallelStretcher::~ParallelStretcher() {}
+
+int ParallelStretcher::toOutput(int pos) const {
+    // In double, a float runs out of precision past a few minutes of input
+    return (int)std::llround(pos / (double)mSpeed);
+}
+
+int ParallelStretcher::getLead(int sampleRate) const {
+    // Input that stretches to at least ALIGN_MS of output
+    return (int)std::ceil(sampleRate * ALIGN_MS / 1000 * (double)mSpeed) + 1;
+}
+
+// Energy of the numSamples frames from start on, all channels
+static int64_t frameEnergy(const int16_t* input, int start, int numSamples, int numChannels) {
+    int64_t energy = 0;
+    const int16_t* samples = input + (size_t)start * numChannels;
+    for (int i = 0; i < numSamples * numChannels; i++) {
+        energy += (int32_t)samples[i] * samples[i];
+    }
+    return energy;
+}
+
+void ParallelStretcher::findBounds(const int16_t* input, int numSamples, int numChannels, int sampleRate) {
+    int minSegment = (int)((int64_t)MIN_SEGMENT_MS * sampleRate / 1000);
+    int numSegments = std::max(1, std::min(numSamples / std::max(1, minSegment),
+                                           mNumThreads * SEGMENTS_PER_THREAD));
+    int segmentLength = numSamples / numSegments;
+    int frame = std::max(1, sampleRate * FRAME_MS / 1000);
+    int search = std::min(sampleRate * SEARCH_MS / 1000, segmentLength / 4);
+
+    mBounds.clear();
+    mBounds.push_back(0);
+    for (int i = 1; i < numSegments; i++) {
+        int nominal = i * segmentLength;
+        int best = nominal;
+        int64_t bestEnergy = INT64_MAX;
+        // Half-frame hops over the search window, the cut goes in the middle of the quietest frame
+        for (int start = nominal - search; start + frame <= nominal + search; start += std::max(1, frame / 2)) {
+            int64_t energy = frameEnergy(input, start, frame, numChannels);
+            if (energy < bestEnergy) {
+                bestEnergy = energy;
+                best = start + frame / 2;
+            }
+        }
+        mBounds.push_back(best);
+    }
+    mBounds.push_back(numSamples);
+}
+
+bool ParallelStretcher::stretchSegment(const int16_t* input, int numSamples, int numChannels, int sampleRate,
+                                       std::vector<int16_t>& output) {
+    if (mEngine == "soundtouch") {
+        AudioSoundToucher soundToucher(mSpeed);
+        soundToucher.open(sampleRate, numChannels);
+        soundToucher.process(input, numSamples, output);
+        soundToucher.flush(output);
+        return true;
+    }
+
+    AudioAccelerator accelerator(mSpeed);
+    if (!accelerator.open(sampleRate, numChannels)) {
+        return false;
+    }
+    for (int pos = 0; pos < numSamples; pos += CHUNK_SAMPLES) {
+        accelerator.process(input + (size_t)pos * numChannels, std::min(CHUNK_SAMPLES, numSamples - pos), output);
+    }
+    accelerator.flush(output);
+    return true;
+}
+
+bool ParallelStretcher::stretchSegments(const int16_t* input, int numSamples, int numChannels, int sampleRate,
+                                        std::vector<std::vector<int16_t>>& outputs) {
+    int numSegments = getNumSegments();
+    int overlap = sampleRate * OVERLAP_MS / 1000;
+    int lead = getLead(sampleRate);
+    // Room to move the segment by up to ALIGN_MS at its far end too
+    int extra = sampleRate * TAIL_MS / 1000 + lead;
+    std::atomic<int> next(0);
+    std::atomic<bool> ok(true);
+
+    auto worker = [&]() {
+        int i;
+        std::vector<int16_t> padded;
+        // An exception must not leave the thread (that would terminate the program): the segment
+        // fails like one whose engine could not be set up, and the others are not started
+        try {
+            while (ok && (i = next++) < numSegments) {
+                // Input before the overlap so that stitch() can move the segment back as well as forward
+                int start = std::max(0, mBounds[i] - overlap - lead);
+                int end = std::min(numSamples, mBounds[i + 1] + overlap);
+                int tail = end + extra;
+                // The most of the output stitch() reads: the span the segment covers, moved by ALIGN_MS
+                int length = toOutput(end) - toOutput(start) + sampleRate * ALIGN_MS / 1000;
+                outputs[i].reserve((size_t)(toOutput(tail) - toOutput(start) + CHUNK_SAMPLES) * numChannels);
+                if (tail <= numSamples) {
+                    if (!stretchSegment(input + (size_t)start * numChannels, tail - start, numChannels, sampleRate,
+                                        outputs[i])) {
+                        ok = false;
+                    }
+                } else {
+                    // The end of the input: silence instead of the tail, or the engines leave its last
+                    // few hundred samples out
+                    padded.assign((size_t)(tail - start) * numChannels, 0);
+                    std::copy(input + (size_t)start * numChannels, input + (size_t)numSamples * numChannels,
+                              padded.begin());
+                    if (!stretchSegment(padded.data(), tail - start, numChannels, sampleRate, outputs[i])) {
+                        ok = false;
+                    }
+                }
+                if (outputs[i].size() < (size_t)length * numChannels) {
+                    outputs[i].resize((size_t)length * numChannels);
+                }
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Parallel " << mEngine << " segment failed: " << e.what() << std::endl;
+            ok = false;
+        } catch (...) {
+            ok = false;
+        }
+    };
+
+    int numWorkers = std::min(mNumThreads, numSegments);
+    std::vector<std::thread> threads;
+    for (int t = 1; t < numWorkers; t++) {
+        try {
+            threads.emplace_back(worker);
+        } catch (const std::system_error& e) {
+            // Out of threads: the ones already running, and this one, share the segments
+            std::cerr << "Parallel " << mEngine << " runs on " << t << " thread(s): " << e.what() << std::endl;
+            break;
+        }
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return ok;
+}
+
+// Shift in [minShift, maxShift] that best lines the numSamples frames at fadeIn + shift up with
+// those at fadeOut: the highest normalised cross-correlation, on the channels summed
+static int findShift(const int16_t* fadeOut, const int16_t* fadeIn, int numSamples, int numChannels,
+                     int minShift, int maxShift) {
+    std::vector<int32_t> out(numSamples);
+    std::vector<int32_t> in(numSamples + maxShift - minShift);
+    for (int i = 0; i < numSamples; i++) {
+        for (int c = 0; c < numChannels; c++) {
+            out[i] += fadeOut[(size_t)i * numChannels + c];
+        }
+    }
+    for (int i = 0; i < (int)in.size(); i++) {
+        for (int c = 0; c < numChannels; c++) {
+            in[i] += fadeIn[(ptrdiff_t)(i + minShift) * numChannels + c];
+        }
+    }
+
+    int64_t energy = 0;
+    for (int i = 0; i < numSamples; i++) {
+        energy += (int64_t)in[i] * in[i];
+    }
+    int best = 0;
+    double bestScore = 0.0;
+    for (int shift = minShift; shift <= maxShift; shift++) {
+        const int32_t* candidate = in.data() + (shift - minShift);
+        int64_t correlation = 0;
+        for (int i = 0; i < numSamples; i++) {
+            correlation += (int64_t)out[i] * candidate[i];
+        }
+        // Silence or opposite phase everywhere: stay at the nominal place
+        if (correlation > 0 && energy > 0) {
+            double score = correlation / std::sqrt((double)energy);
+            if (score > bestScore) {
+                bestScore = score;
+                best = shift;
+            }
+        }
+        if (shift < maxShift) {
+            energy += (int64_t)candidate[numSamples] * candidate[numSamples] - (int64_t)candidate[0] * candidate[0];
+        }
+    }
+    return best;
+}
+
+void ParallelStretcher::stitch(const std::vector<std::vector<int16_t>>& outputs, int numSamples, int numChannels,
+                               int sampleRate, std::vector<int16_t>& output) {
+    int numSegments = getNumSegments();
+    int overlap = sampleRate * OVERLAP_MS / 1000;
+    int lead = getLead(sampleRate);
+    int maxShift = sampleRate * ALIGN_MS / 1000;
+    // Output sample o comes from outputs[i][o - starts[i] + shifts[i]]
+    std::vector<int> starts(numSegments);
+    std::vector<int> shifts(numSegments, 0);
+
+    output.resize((size_t)toOutput(numSamples) * numChannels);
+    for (int i = 0; i < numSegments; i++) {
+        starts[i] = toOutput(std::max(0, mBounds[i] - overlap - lead));
+    }
+    for (int i = 0; i < numSegments; i++) {
+        // Where the segment has the output to itself: between the crossfades with its neighbours
+        int from = i > 0 ? toOutput(mBounds[i] + overlap) : 0;
+        int to = i < numSegments - 1 ? toOutput(mBounds[i + 1] - overlap)
+                                     : (int)(output.size() / numChannels);
+        std::copy(outputs[i].begin() + (size_t)(from - starts[i] + shifts[i]) * numChannels,
+                  outputs[i].begin() + (size_t)(to - starts[i] + shifts[i]) * numChannels,
+                  output.begin() + (size_t)from * numChannels);
+        if (i == numSegments - 1) {
+            break;
+        }
+
+        // The segments were stretched separately, so their waveforms over the shared input are
+        // not in step; faded as they are, they would comb-filter. The next one moves to where it
+        // matches this one best, within what it has on either side.
+        int fadeEnd = toOutput(mBounds[i + 1] + overlap);
+        int length = fadeEnd - to;
+        const int16_t* fadeOut = outputs[i].data() + (size_t)(to - starts[i] + shifts[i]) * numChannels;
+        int base = to - starts[i + 1];
+        int nextEnd = i + 1 < numSegments - 1 ? toOutput(mBounds[i + 2] + overlap) : (int)(output.size() / numChannels);
+        int available = (int)(outputs[i + 1].size() / numChannels) - (nextEnd - starts[i + 1]);
+        int minShift = std::max(-maxShift, -base);
+        int maxShiftNext = std::max(minShift, std::min(maxShift, available));
+        shifts[i + 1] = findShift(fadeOut, outputs[i + 1].data() + (size_t)base * numChannels, length, numChannels,
+                                  minShift, maxShiftNext);
+
+        // Linear crossfade into the next segment over the output of the shared input
+        for (int o = to; o < fadeEnd; o++) {
+            int32_t weight = (int32_t)(((int64_t)(2 * (o - to) + 1) * WEIGHT_ONE) / (2 * length));
+            const int16_t* fadeOutFrame = fadeOut + (size_t)(o - to) * numChannels;
+            const int16_t* fadeIn = outputs[i + 1].data() + (size_t)(o - starts[i + 1] + shifts[i + 1]) * numChannels;
+            int16_t* out = output.data() + (size_t)o * numChannels;
+            for (int c = 0; c < numChannels; c++) {
+                out[c] = (int16_t)((fadeOutFrame[c] * (WEIGHT_ONE - weight) + fadeIn[c] * weight + WEIGHT_ONE / 2) >> 15);
+            }
+        }
+    }
+}
+
+bool ParallelStretcher::handleAudioData(IAudioData& audioData) {
+    int channels = audioData.getChannels();
+    int sampleRate = audioData.getSampleRate();
+    int numSamples = audioData.getDataSize() / channels;
+    const int16_t* input = audioData.getDataPointer();
+
+    if (mEngine != "sonic" && mEngine != "soundtouch") {
+        std::cerr << "Invalid audio accelerator engine: " << mEngine << std::endl;
+        return false;
+    }
+    if (numSamples == 0) {
+        return true;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    findBounds(input, numSamples, channels, sampleRate);
+    std::vector<std::vector<int16_t>> outputs(getNumSegments());
+    if (!stretchSegments(input, numSamples, channels, sampleRate, outputs)) {
+        return false;
+    }
+    std::vector<int16_t> output;
+    stitch(outputs, numSamples, channels, sampleRate, output);
+
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+
+    std::cout << "Parallel " << mEngine << " execution time: " << duration.count() << " milliseconds. threads: "
+              << std::min(mNumThreads, getNumSegments()) << " segments: " << getNumSegments() << std::endl;
+    std::cout << "Length of output: " << output.size() << " input: " << audioData.getDataSize()
+              << " sample rate: " << sampleRate << " channel:" << channels << std::endl;
+
+    audioData.updateData(output);
+    return true;
+}
@@ -0,0 +1,50 @@
+#ifndef PARALLELSTRETCHER_H
+#define PARALLELSTRETCHER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "IAudioData.h"
+#include "IAudioDataHandler.h"
+
+// Offline time-stretching on several cores: the input is cut at low-energy points into segments
+// that are stretched concurrently (one engine per segment, sonic or SoundTouch), each with a little
+// extra input on both sides. The outputs are put back near their nominal place, start / speed,
+// each moved by up to 10 ms to where its waveform lines up with the previous one's, and
+// crossfaded over the extra, so the output is exactly round(input / speed) samples long.
+class ParallelStretcher : public IAudioDataHandler {
+public:
+    // engine: "sonic" or "soundtouch"; numThreads 0 uses every core
+    ParallelStretcher(const std::string& engine, float speed, int numThreads = 0);
+    ~ParallelStretcher();
+
+    bool handleAudioData(IAudioData& audioData);
+
+    int getNumThreads() const { return mNumThreads; }
+    // Segments the last input was cut into
+    int getNumSegments() const { return (int)mBounds.size() - 1; }
+
+private:
+    ParallelStretcher(const ParallelStretcher&) = delete;
+    ParallelStretcher& operator=(const ParallelStretcher&) = delete;
+
+    // Where input sample pos goes in the output
+    int toOutput(int pos) const;
+    // Input a segment starts ahead of its overlap, to be moved back by in stitch()
+    int getLead(int sampleRate) const;
+    void findBounds(const int16_t* input, int numSamples, int numChannels, int sampleRate);
+    // False if an engine could not be set up for some segment
+    bool stretchSegments(const int16_t* input, int numSamples, int numChannels, int sampleRate,
+                         std::vector<std::vector<int16_t>>& outputs);
+    bool stretchSegment(const int16_t* input, int numSamples, int numChannels, int sampleRate,
+                        std::vector<int16_t>& output);
+    void stitch(const std::vector<std::vector<int16_t>>& outputs, int numSamples, int numChannels,
+                int sampleRate, std::vector<int16_t>& output);
+
+    std::string mEngine;
+    float mSpeed;
+    int mNumThreads;
+    std::vector<int> mBounds;       // Segment starts in samples per channel, then the input length
+};
+
+#endif // PARALLELSTRETCHER_H
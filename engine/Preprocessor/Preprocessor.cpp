@@ -0,0 +1,159 @@
+#include "Preprocessor.h"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+// Frame length: the Speex preprocessor is tuned for 10-20 ms, and 10 ms matches the Opus frames
+#define FRAME_MS 10
+// Speech probability (percent) to go from silence to speech, and to stay in speech. The library
+// defaults (35/20) hardly ever let go on stationary input, whose probability settles around 30-55:
+// steady background noise, and also a steady tone once the noise estimate has adopted it (about
+// 1.3 s in, falling to about 30). These thresholds only concern such stationary signals; they are
+// not a tone detector, and a held note is treated as silence like the noise is.
+#define VAD_PROB_START 80
+#define VAD_PROB_CONTINUE 65
+
+AudioPreprocessor::AudioPreprocessor()
+    : mDenoise(true), mSuppressDb(-15), mAgcLevel(0.0f), mVad(false),
+      mSampleRate(0), mNumChannels(0), mFrameSamples(0) {}
+
+AudioPreprocessor::~AudioPreprocessor() {
+    destroyStates();
+}
+
+void AudioPreprocessor::setDenoise(bool enabled, int suppressDb) {
+    mDenoise = enabled;
+    mSuppressDb = suppressDb;
+}
+
+void AudioPreprocessor::setAgcLevel(float level) {
+    mAgcLevel = level;
+}
+
+void AudioPreprocessor::setVad(bool enabled) {
+    mVad = enabled;
+}
+
+void AudioPreprocessor::destroyStates() {
+    for (SpeexPreprocessState* state : mStates) {
+        speex_preprocess_state_destroy(state);
+    }
+    mStates.clear();
+}
+
+bool AudioPreprocessor::open(int sampleRate, int numChannels) {
+    destroyStates();
+    if (sampleRate <= 0 || numChannels <= 0) {
+        std::cerr << "Invalid preprocessor format: " << sampleRate << " Hz " << numChannels
+                  << " channel(s)" << std::endl;
+        return false;
+    }
+    mSampleRate = sampleRate;
+    mNumChannels = numChannels;
+    mFrameSamples = std::max(1, sampleRate * FRAME_MS / 1000);
+    mChannelFrame.resize(mFrameSamples);
+
+    spx_int32_t denoise = mDenoise ? 1 : 0;
+    spx_int32_t suppress = mSuppressDb;
+    spx_int32_t agc = mAgcLevel > 0.0f ? 1 : 0;
+    float agcLevel = mAgcLevel;
+    spx_int32_t vad = mVad ? 1 : 0;
+    spx_int32_t probStart = VAD_PROB_START;
+    spx_int32_t probContinue = VAD_PROB_CONTINUE;
+    for (int c = 0; c < numChannels; c++) {
+        SpeexPreprocessState* state = speex_preprocess_state_init(mFrameSamples, sampleRate);
+        speex_preprocess_ctl(state, SPEEX_PREPROCESS_SET_DENOISE, &denoise);
+        speex_preprocess_ctl(state, SPEEX_PREPROCESS_SET_NOISE_SUPPRESS, &suppress);
+        speex_preprocess_ctl(state, SPEEX_PREPROCESS_SET_AGC, &agc);
+        if (agc) {
+            speex_preprocess_ctl(state, SPEEX_PREPROCESS_SET_AGC_LEVEL, &agcLevel);
+        }
+        speex_preprocess_ctl(state, SPEEX_PREPROCESS_SET_VAD, &vad);
+        speex_preprocess_ctl(state, SPEEX_PREPROCESS_SET_PROB_START, &probStart);
+        speex_preprocess_ctl(state, SPEEX_PREPROCESS_SET_PROB_CONTINUE, &probContinue);
+        mStates.push_back(state);
+    }
+    return true;
+}
+
+bool AudioPreprocessor::process(int16_t* frame) {
+    if (mNumChannels == 1) {
+        return speex_preprocess_run(mStates[0], frame) != 0;
+    }
+    bool speech = false;
+    for (int c = 0; c < mNumChannels; c++) {
+        for (int i = 0; i < mFrameSamples; i++) {
+            mChannelFrame[i] = frame[(size_t)i * mNumChannels + c];
+        }
+        if (speex_preprocess_run(mStates[c], mChannelFrame.data())) {
+            speech = true;
+        }
+        for (int i = 0; i < mFrameSamples; i++) {
+            frame[(size_t)i * mNumChannels + c] = mChannelFrame[i];
+        }
+    }
+    return speech;
+}
+
+bool AudioPreprocessor::handleAudioData(IAudioData& audioData) {
+    int channels = audioData.getChannels();
+    int sampleRate = audioData.getSampleRate();
+    int numSamples = audioData.getDataSize() / channels;
+    const int16_t* input = audioData.getDataPointer();
+
+    if (numSamples == 0) {
+        return true;
+    }
+    if (!open(sampleRate, channels)) {
+        return false;
+    }
+
+    int frame = mFrameSamples;
+    int numFrames = (numSamples + frame - 1) / frame;
+    std::vector<int16_t> output((size_t)numSamples * channels);
+    std::vector<int16_t> buffer((size_t)frame * channels);
+    std::vector<uint8_t> flags;
+    flags.reserve(numFrames);
+    int speechFrames = 0;
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    // Each frame comes back from the overlap-add one call later, together with the decision for
+    // the window that ends in the frame after it; a frame of silence at the end flushes the last
+    for (int i = 0; i <= numFrames; i++) {
+        int pos = i * frame;
+        int count = std::max(0, std::min(frame, numSamples - pos));
+        std::fill(buffer.begin(), buffer.end(), 0);
+        std::copy(input + (size_t)pos * channels, input + (size_t)(pos + count) * channels, buffer.begin());
+        bool speech = process(buffer.data());
+        if (i == 0) {
+            continue;
+        }
+        int outPos = pos - frame;
+        int outCount = std::min(frame, numSamples - outPos);
+        std::copy(buffer.begin(), buffer.begin() + (size_t)outCount * channels, output.begin() + (size_t)outPos * channels);
+        flags.push_back(speech ? 1 : 0);
+        speechFrames += speech ? 1 : 0;
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+
+    std::cout << "Preprocessor execution time: " << duration.count() << " milliseconds. denoise: " << mDenoise
+              << " agc: " << mAgcLevel << " vad: " << mVad << std::endl;
+    std::cout << "Length of output: " << output.size() << " input: " << audioData.getDataSize()
+              << " channel:" << channels;
+    if (mVad) {
+        std::cout << " speech frames: " << speechFrames << "/" << numFrames;
+    }
+    std::cout << std::endl;
+
+    audioData.updateData(output);
+    if (mVad) {
+        VoiceActivity& voiceActivity = audioData.getVoiceActivity();
+        voiceActivity.sampleRate = sampleRate;
+        voiceActivity.frameSamples = frame;
+        voiceActivity.flags = std::move(flags);
+    }
+    return true;
+}
@@ -0,0 +1,55 @@
+#ifndef PREPROCESSOR_H
+#define PREPROCESSOR_H
+
+#include <cstdint>
+#include <vector>
+#include "IAudioData.h"
+#include "IAudioDataHandler.h"
+#include <speex/speex_preprocess.h>
+
+// Speex preprocessor ahead of the encoder: noise suppression, automatic gain control and voice
+// activity detection on 10 ms frames, one Speex state per channel. With the VAD on, the decision
+// for every frame goes to IAudioData::getVoiceActivity() so the later stages (the Opus encoder)
+// can spend less on the silent ones; a frame is speech if any channel says so. Streaming like
+// AudioResampler: open() once, then process() a frame at a time. handleAudioData() does a whole
+// buffer and takes the frame of delay out, so the output lines up with the input.
+class AudioPreprocessor : public IAudioDataHandler {
+public:
+    AudioPreprocessor();
+    ~AudioPreprocessor();
+
+    bool handleAudioData(IAudioData& audioData);
+
+    // Noise suppression, on by default. suppressDb: most the noise is attenuated by (negative)
+    void setDenoise(bool enabled, int suppressDb = -15);
+    // Automatic gain control towards level (RMS, 16-bit scale), off while level is 0
+    void setAgcLevel(float level);
+    void setVad(bool enabled);
+
+    // Starts a new stream, returns false if the preprocessor could not be set up
+    bool open(int sampleRate, int numChannels);
+    // Samples per channel process() takes
+    int getFrameSamples() const { return mFrameSamples; }
+    // Processes one frame of interleaved samples in place (one frame late, the overlap-add delay).
+    // Returns whether the frame analysed holds speech, always true with the VAD off.
+    bool process(int16_t* frame);
+
+private:
+    AudioPreprocessor(const AudioPreprocessor&) = delete;
+    AudioPreprocessor& operator=(const AudioPreprocessor&) = delete;
+
+    void destroyStates();
+
+    bool mDenoise;
+    int mSuppressDb;
+    float mAgcLevel;
+    bool mVad;
+
+    int mSampleRate;
+    int mNumChannels;
+    int mFrameSamples;
+    std::vector<SpeexPreprocessState*> mStates;
+    std::vector<int16_t> mChannelFrame;     // One channel of the frame, deinterleaved
+};
+
+#endif // PREPROCESSOR_H
@@ -0,0 +1,119 @@
+#include "Resampler.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+// Samples per channel per process() call by handleAudioData: 10 ms frames, as a real-time
+// capture would deliver them
+#define FRAME_MS 10
+// Output room on top of the exact ratio, for the sample the fractional position can add
+#define OUTPUT_MARGIN 16
+
+AudioResampler::AudioResampler(int outputRate, int quality)
+    : mOutputRate(outputRate),
+      mQuality(std::min(SPEEX_RESAMPLER_QUALITY_MAX, std::max(SPEEX_RESAMPLER_QUALITY_MIN, quality))),
+      mInputRate(0), mNumChannels(0), mState(nullptr), mInputCount(0), mOutputCount(0) {}
+
+AudioResampler::~AudioResampler() {
+    if (mState) {
+        speex_resampler_destroy(mState);
+    }
+}
+
+bool AudioResampler::open(int inputRate, int numChannels) {
+    if (mState && numChannels == mNumChannels) {
+        // Same channels: keep the state, only the filter is rebuilt if the rate changed
+        speex_resampler_reset_mem(mState);
+        speex_resampler_set_rate(mState, inputRate, mOutputRate);
+    } else {
+        if (mState) {
+            speex_resampler_destroy(mState);
+        }
+        int error = RESAMPLER_ERR_SUCCESS;
+        mState = speex_resampler_init(numChannels, inputRate, mOutputRate, mQuality, &error);
+        if (!mState) {
+            std::cerr << "Failed to create resampler: " << speex_resampler_strerror(error) << std::endl;
+            return false;
+        }
+    }
+    mInputRate = inputRate;
+    mNumChannels = numChannels;
+    mInputCount = 0;
+    mOutputCount = 0;
+    // Drop the filter delay so the output lines up with the input; flush() brings the end back
+    speex_resampler_skip_zeros(mState);
+    return true;
+}
+
+int AudioResampler::process(const int16_t* samples, int numSamples, std::vector<int16_t>& output) {
+    int appended = 0;
+    mInputCount += numSamples;
+    while (numSamples > 0) {
+        spx_uint32_t inLen = numSamples;
+        spx_uint32_t outLen = (spx_uint32_t)((int64_t)numSamples * mOutputRate / mInputRate) + OUTPUT_MARGIN;
+        size_t offset = output.size();
+        output.resize(offset + (size_t)outLen * mNumChannels);
+        speex_resampler_process_interleaved_int(mState, samples, &inLen, output.data() + offset, &outLen);
+        output.resize(offset + (size_t)outLen * mNumChannels);
+        samples += (size_t)inLen * mNumChannels;
+        numSamples -= inLen;
+        appended += outLen;
+    }
+    mOutputCount += appended;
+    return appended;
+}
+
+int AudioResampler::flush(std::vector<int16_t>& output) {
+    int64_t expected = std::llround(mInputCount * (double)mOutputRate / mInputRate);
+    int appended = 0;
+    // Silence through the filter until the last input has come out, then cut at the exact length
+    while (mOutputCount + appended < expected) {
+        spx_uint32_t inLen = speex_resampler_get_input_latency(mState);
+        spx_uint32_t outLen = (spx_uint32_t)(expected - mOutputCount - appended);
+        size_t offset = output.size();
+        output.resize(offset + (size_t)outLen * mNumChannels);
+        speex_resampler_process_interleaved_int(mState, nullptr, &inLen, output.data() + offset, &outLen);
+        output.resize(offset + (size_t)outLen * mNumChannels);
+        appended += outLen;
+    }
+    mOutputCount += appended;
+    return appended;
+}
+
+bool AudioResampler::handleAudioData(IAudioData& audioData) {
+    int channels = audioData.getChannels();
+    int sampleRate = audioData.getSampleRate();
+    int numSamples = audioData.getDataSize() / channels;
+    const int16_t* input = audioData.getDataPointer();
+
+    if (sampleRate == mOutputRate) {
+        return true;
+    }
+    if (!open(sampleRate, channels)) {
+        return false;
+    }
+
+    std::vector<int16_t> output;
+    output.reserve((size_t)(std::llround(numSamples * (double)mOutputRate / sampleRate) + OUTPUT_MARGIN) * channels);
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    int frame = std::max(1, sampleRate * FRAME_MS / 1000);
+    for (int pos = 0; pos < numSamples; pos += frame) {
+        process(input + (size_t)pos * channels, std::min(frame, numSamples - pos), output);
+    }
+    flush(output);
+
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+
+    std::cout << "Resampler execution time: " << duration.count() << " milliseconds. quality: " << mQuality
+              << " " << sampleRate << " Hz -> " << mOutputRate << " Hz" << std::endl;
+    std::cout << "Length of output: " << output.size() << " input: " << audioData.getDataSize()
+              << " channel:" << channels << std::endl;
+
+    audioData.updateData(output);
+    audioData.setSampleRate(mOutputRate);
+    return true;
+}
@@ -0,0 +1,44 @@
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <cstdint>
+#include <vector>
+#include "IAudioData.h"
+#include "IAudioDataHandler.h"
+#include <speex/speex_resampler.h>
+
+// Converts the audio to another sample rate with the Speex resampler, e.g. 44.1 kHz WAVs to one
+// of the rates Opus takes. Streaming like AudioAccelerator: open() once, then process() 10 ms at
+// a time and flush() at the end; handleAudioData() does all of it for a whole buffer and updates
+// its sample rate. The output is aligned with the input and round(input * out / in) long.
+class AudioResampler : public IAudioDataHandler {
+public:
+    // quality: 0 (fastest) to 10 (best), see speex_resampler.h
+    AudioResampler(int outputRate, int quality = SPEEX_RESAMPLER_QUALITY_DEFAULT);
+    ~AudioResampler();
+
+    bool handleAudioData(IAudioData& audioData);
+
+    int getOutputRate() const { return mOutputRate; }
+    // Starts a new stream at inputRate, returns false if the resampler could not be set up
+    bool open(int inputRate, int numChannels);
+    // Resamples numSamples (per channel) and appends the result, returns the samples per channel
+    // appended
+    int process(const int16_t* samples, int numSamples, std::vector<int16_t>& output);
+    // End of the stream: appends what the filter still holds
+    int flush(std::vector<int16_t>& output);
+
+private:
+    AudioResampler(const AudioResampler&) = delete;
+    AudioResampler& operator=(const AudioResampler&) = delete;
+
+    int mOutputRate;
+    int mQuality;
+    int mInputRate;
+    int mNumChannels;
+    SpeexResamplerState* mState;
+    int64_t mInputCount;        // Samples per channel given to process() since open()
+    int64_t mOutputCount;       // And appended to the output
+};
+
+#endif // RESAMPLER_H
@@ -5,92 +5,183 @@
 #include <chrono>
 #include <algorithm>
 #include <cstdint>
-#include <fstream>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
-inline int saturate(float fvalue, float minval, float maxval)
-{
-    if (fvalue > maxval)
-    {
-        fvalue = maxval;
+// Samples per channel written per putSamples() call by handleAudioData
+#define CHUNK_SAMPLES 960
+
+#ifdef SOUNDTOUCH_INTEGER_SAMPLES
+
+// SoundTouch built for 16-bit samples takes ours as they are
+static void toSoundTouch(const int16_t* in, soundtouch::SAMPLETYPE* out, int count) {
+    std::copy(in, in + count, out);
+}
+
+static void fromSoundTouch(const soundtouch::SAMPLETYPE* in, int16_t* out, int count) {
+    std::copy(in, in + count, out);
+}
+
+#else
+
+// int16 to [-1, 1), 8 values at a time. The scale is a power of two, so every width gives the same
+// floats.
+static void toSoundTouch(const int16_t* in, float* out, int count) {
+    const float scale = 1.0f / 32768.0f;
+    int i = 0;
+#if defined(__SSE2__)
+    const __m128 factor = _mm_set1_ps(scale);
+    for (; i + 8 <= count; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(in + i));
+        // Sign-extend by putting each value in the top half of a 32-bit lane
+        __m128i low = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+        __m128i high = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(low), factor));
+        _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(high), factor));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 8 <= count; i += 8) {
+        int16x8_t x = vld1q_s16(in + i);
+        vst1q_f32(out + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(x))), scale));
+        vst1q_f32(out + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(x))), scale));
     }
-    else if (fvalue < minval)
-    {
-        fvalue = minval;
+#endif
+    for (; i < count; i++) {
+        out[i] = in[i] * scale;
     }
-    return (int)fvalue;
 }
 
+// Back to int16: scaled, clipped to the int16 range and truncated toward zero
+static void fromSoundTouch(const float* in, int16_t* out, int count) {
+    int i = 0;
+#if defined(__SSE2__)
+    const __m128 factor = _mm_set1_ps(32768.0f);
+    const __m128 top = _mm_set1_ps(32767.0f);
+    const __m128 bottom = _mm_set1_ps(-32768.0f);
+    for (; i + 8 <= count; i += 8) {
+        __m128 low = _mm_max_ps(_mm_min_ps(_mm_mul_ps(_mm_loadu_ps(in + i), factor), top), bottom);
+        __m128 high = _mm_max_ps(_mm_min_ps(_mm_mul_ps(_mm_loadu_ps(in + i + 4), factor), top), bottom);
+        _mm_storeu_si128((__m128i*)(out + i),
+                         _mm_packs_epi32(_mm_cvttps_epi32(low), _mm_cvttps_epi32(high)));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 8 <= count; i += 8) {
+        // vqmovn saturates, so the clipping comes with the narrowing
+        int32x4_t low = vcvtq_s32_f32(vmulq_n_f32(vld1q_f32(in + i), 32768.0f));
+        int32x4_t high = vcvtq_s32_f32(vmulq_n_f32(vld1q_f32(in + i + 4), 32768.0f));
+        vst1q_s16(out + i, vcombine_s16(vqmovn_s32(low), vqmovn_s32(high)));
+    }
+#endif
+    for (; i < count; i++) {
+        float value = std::min(32767.0f, std::max(-32768.0f, in[i] * 32768.0f));
+        out[i] = static_cast<int16_t>(value);
+    }
+}
+
+#endif  // SOUNDTOUCH_INTEGER_SAMPLES
+
 AudioSoundToucher::AudioSoundToucher(float speed):
-                                    speed(speed), putCounts(0) {}
+                                    sampleRate(0), numChannels(0), speed(speed), putCounts(0) {}
 
 AudioSoundToucher::~AudioSoundToucher() {}
 
-void AudioSoundToucher::RunSoundTouch(int16_t *inputData, int inputSize, int16_t *outputData, int outputSize, 
-                                      int sampleRate, int numChannels, float speed) {
-    // Initialize SoundTouch object
-    soundtouch::SoundTouch soundTouch;
-    soundTouch.setSampleRate(sampleRate);
-    soundTouch.setChannels(numChannels);
-    soundTouch.setTempo(speed);  // Set speed factor
-
-    // Process input data in chunks
-    const int chunkSize = 1920;  // Number of samples to process at a time
-    soundtouch::SAMPLETYPE buffer[chunkSize];
-    int numSamplesOut;
-    int outputIndex = 0;
-    double conv = 1.0 / 32768.0;
-
-    for (int i = 0; i < inputSize; i += chunkSize) {
-        int chunkLength = std::min(chunkSize, inputSize - i);
-        for (int j = 0; j < chunkLength; ++j) {
-            buffer[j] = static_cast<soundtouch::SAMPLETYPE>(inputData[i + j] * conv);
-        }
-        soundTouch.putSamples(buffer, chunkLength / numChannels);
-        putCounts++;
-        //std::cout<<"put chunkLength:"<<chunkLength<<" numChannels:"<<numChannels<<std::endl;
-        // Retrieve processed samples
-        while ((numSamplesOut = soundTouch.receiveSamples(buffer, chunkSize / numChannels)) > 0) {
-            if (outputIndex + numSamplesOut * numChannels > outputSize) {
-                std::cerr<<"put outputIndex:"<<outputIndex<<" numSamplesOut:"<<numSamplesOut<<" numChannels:"<<numChannels<<" outputSize:"<<outputSize<<std::endl;
-                return;
-            }
-
-            //std::cout<<buffer[0]<<" "<<buffer[1]<<std::endl;
-            for (int j = 0; j < numSamplesOut * numChannels; ++j) {
-                outputData[outputIndex + j] = saturate(buffer[j] * 32768.0f, -32768.0f, 32767.0f);
-            }
-            //std::cout<<"receive samples "<<numSamplesOut<<std::endl;
-            outputIndex += numSamplesOut * numChannels;
-        }
+void AudioSoundToucher::setSpeedMap(std::shared_ptr<SpeedMap> speedMap) {
+    this->speedMap = speedMap;
+}
+
+void AudioSoundToucher::setSpeed(float speed) {
+    this->speed = speed;
+    soundTouch.setTempo(speed);
+}
+
+void AudioSoundToucher::open(int sampleRate, int numChannels) {
+    if (sampleRate != this->sampleRate || numChannels != this->numChannels) {
+        this->sampleRate = sampleRate;
+        this->numChannels = numChannels;
+        soundTouch.setSampleRate(sampleRate);
+        soundTouch.setChannels(numChannels);
+        buffer.resize((size_t)CHUNK_SAMPLES * numChannels);
     }
+    // Drop a tail left over from an unflushed stream, the next call starts a new signal
+    soundTouch.clear();
+    soundTouch.setTempo(speed);
+}
 
-    // Flush remaining samples from SoundTouch buffer
-    soundTouch.flush();
-    while ((numSamplesOut = soundTouch.receiveSamples(buffer, chunkSize / numChannels)) > 0) {
-        if (outputIndex + numSamplesOut * numChannels > outputSize) {
-            std::cerr<<"flush outputIndex:"<<outputIndex<<" numSamplesOut:"<<numSamplesOut<<" numChannels:"<<numChannels<<" outputSize:"<<outputSize<<std::endl;
-            return;
-        }
-        for (int j = 0; j < numSamplesOut * numChannels; ++j) {
-            outputData[outputIndex + j] = saturate(buffer[j] * 32768.0f, -32768.0f, 32767.0f);
-        }
-        outputIndex += numSamplesOut * numChannels;
+int AudioSoundToucher::receiveAvailable(std::vector<int16_t>& output) {
+    int available = soundTouch.numSamples();
+    if (available <= 0) {
+        return 0;
+    }
+    // Exactly what SoundTouch holds, converted straight into the caller's buffer
+    size_t offset = output.size();
+    if (buffer.size() < (size_t)available * numChannels) {
+        buffer.resize((size_t)available * numChannels);
+    }
+    int received = soundTouch.receiveSamples(buffer.data(), available);
+    output.resize(offset + (size_t)received * numChannels);
+    fromSoundTouch(buffer.data(), output.data() + offset, received * numChannels);
+    return received;
+}
+
+int AudioSoundToucher::process(const int16_t* samples, int numSamples, std::vector<int16_t>& output) {
+    // No format before open(), and no conversion buffer to write into
+    if (numChannels <= 0) {
+        return 0;
+    }
+    int appended = 0;
+    for (int pos = 0; pos < numSamples; pos += CHUNK_SAMPLES) {
+        int count = std::min(CHUNK_SAMPLES, numSamples - pos);
+        toSoundTouch(samples + (size_t)pos * numChannels, buffer.data(), count * numChannels);
+        soundTouch.putSamples(buffer.data(), count);
+        putCounts++;
+        appended += receiveAvailable(output);
     }
+    return appended;
+}
 
+int AudioSoundToucher::flush(std::vector<int16_t>& output) {
+    if (numChannels <= 0) {
+        return 0;
+    }
+    soundTouch.flush();
+    return receiveAvailable(output);
 }
 
 bool AudioSoundToucher::handleAudioData(IAudioData& audioData) {
+    int inputSize = audioData.getDataSize();
+    int channels = audioData.getChannels();
+    int sampleRate = audioData.getSampleRate();
+    int numSamples = inputSize / channels;
+    const int16_t* input = audioData.getDataPointer();
+    float minSpeed = speedMap ? speedMap->getMinSpeed() : speed;
 
     std::vector<int16_t> output;
-    int inputSize = audioData.getDataSize();
-    output.resize(static_cast<int>(std::ceil(inputSize/speed)));
+    // Only a hint, process() grows the output by what SoundTouch actually produced
+    output.reserve(static_cast<size_t>(std::ceil(inputSize / minSpeed)) + CHUNK_SAMPLES * channels);
 
     // Record the start time
     auto start = std::chrono::high_resolution_clock::now();
 
-    RunSoundTouch(audioData.getDataPointer(), inputSize, output.data(), output.size(), 
-                 audioData.getSampleRate(), audioData.getChannels(), speed);
-    
+    open(sampleRate, channels);
+    if (speedMap) {
+        speedMap->reset();
+    }
+    for (int pos = 0; pos < numSamples;) {
+        int count = std::min(CHUNK_SAMPLES, numSamples - pos);
+        if (speedMap) {
+            // Cut the chunk where the map changes speed, SoundTouch picks the new tempo up mid-stream
+            count = (int)std::min<int64_t>(count, speedMap->samplesToNextChange(pos, sampleRate));
+            // Straight to SoundTouch: the constant speed stays for runs without the map
+            soundTouch.setTempo(speedMap->speedFor(input + (size_t)pos * channels, count, channels, sampleRate, pos));
+        }
+        process(input + (size_t)pos * channels, count, output);
+        pos += count;
+    }
+    flush(output);
+
     // Record the end time
     auto end = std::chrono::high_resolution_clock::now();
 
@@ -98,9 +189,9 @@ bool AudioSoundToucher::handleAudioData(IAudioData& audioData) {
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
     
     // Print the duration
-    std::cout << "RunSoundTouch execution time: " << duration.count() << " milliseconds. put count: "<<putCounts<< std::endl;
+    std::cout << "SoundTouch execution time: " << duration.count() << " milliseconds. put count: "<<putCounts<< std::endl;
     std::cout << "Length of output: " << output.size() << " input: "<< inputSize
-              << " sample rate: "<<audioData.getSampleRate()<<" channel:"<<audioData.getChannels()<< std::endl;
+              << " sample rate: "<<sampleRate<<" channel:"<<channels<< std::endl;
 
     audioData.updateData(output);
     return true;
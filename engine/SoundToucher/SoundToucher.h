@@ -2,23 +2,49 @@
 #define AUDIOSOUNDTOUCHER_H
 
 #include <cstdint>
+#include <memory>
 #include <vector>
 #include "IAudioData.h"
 #include "IAudioDataHandler.h"
+#include "SpeedMap.h"
 #include <SoundTouch.h>
 
+// Time-stretches with SoundTouch. Like AudioAccelerator the instance is kept across calls (its
+// FIFOs are only cleared, not reallocated), so it can be fed frame by frame with process(), e.g.
+// 10 ms at a time in a real-time pipeline.
 class AudioSoundToucher : public IAudioDataHandler{
 public:
     AudioSoundToucher(float speed);
     ~AudioSoundToucher();
 
     bool handleAudioData(IAudioData& audioData);
+    // Take the tempo of every chunk from the map instead of the constant speed (nullptr: back to it)
+    void setSpeedMap(std::shared_ptr<SpeedMap> speedMap);
+
+    // Takes effect for the samples written after the call
+    void setSpeed(float speed);
+    float getSpeed() const { return speed; }
+    // Sets the format, or clears what SoundTouch still holds if it did not change
+    void open(int sampleRate, int numChannels);
+    // Streams numSamples (per channel) from samples and appends everything SoundTouch has ready to
+    // output, returns the number of samples per channel appended (0 before open())
+    int process(const int16_t* samples, int numSamples, std::vector<int16_t>& output);
+    // End of the stream: appends what SoundTouch still holds
+    int flush(std::vector<int16_t>& output);
 
 private:
+    AudioSoundToucher(const AudioSoundToucher&) = delete;
+    AudioSoundToucher& operator=(const AudioSoundToucher&) = delete;
+
+    int receiveAvailable(std::vector<int16_t>& output);
+
+    soundtouch::SoundTouch soundTouch;
+    std::vector<soundtouch::SAMPLETYPE> buffer;    // Conversion to and from SoundTouch's samples
+    int sampleRate;
+    int numChannels;
     float speed;
+    std::shared_ptr<SpeedMap> speedMap;
     int putCounts;
-    void RunSoundTouch(int16_t *inputData, int inputSize, int16_t *outputData, int outputSize, 
-                       int sampleRate, int numChannels, float speed);
 };
 
-#endif // AUDIOSOUNDTOUCHER_H
\ No newline at end of file
+#endif // AUDIOSOUNDTOUCHER_H
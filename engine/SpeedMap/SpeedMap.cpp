@@ -0,0 +1,142 @@
+#include "SpeedMap.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <sstream>
+
+// Full scale of a 16-bit sample, 0 dBFS
+#define FULL_SCALE 32768.0
+
+SpeedMap::SpeedMap(float speed)
+    : mSpeed(speed), mVad(false), mSpeechSpeed(speed), mSilenceSpeed(speed), mThresholdDb(-45.0f),
+      mHangoverMs(200), mSinceSpeech(std::numeric_limits<int64_t>::max()) {}
+
+void SpeedMap::addPoint(double startSeconds, float speed) {
+    auto it = std::upper_bound(mPoints.begin(), mPoints.end(), startSeconds,
+                               [](double t, const std::pair<double, float>& p) { return t < p.first; });
+    mPoints.insert(it, std::make_pair(startSeconds, speed));
+}
+
+void SpeedMap::setVoiceActivity(float speechSpeed, float silenceSpeed, float thresholdDb, int hangoverMs) {
+    mVad = true;
+    mSpeechSpeed = speechSpeed;
+    mSilenceSpeed = silenceSpeed;
+    mThresholdDb = thresholdDb;
+    mHangoverMs = hangoverMs;
+    reset();
+}
+
+// Parses a whole field as a number, false if anything is left over
+static bool parseNumber(const std::string& field, double& value) {
+    char* end = nullptr;
+    value = std::strtod(field.c_str(), &end);
+    return !field.empty() && end == field.c_str() + field.size() && std::isfinite(value);
+}
+
+static std::vector<std::string> split(const std::string& text, char separator) {
+    std::vector<std::string> fields;
+    std::stringstream stream(text);
+    std::string field;
+    while (std::getline(stream, field, separator)) {
+        fields.push_back(field);
+    }
+    return fields;
+}
+
+std::shared_ptr<SpeedMap> SpeedMap::parse(const std::string& spec, float baseSpeed) {
+    auto map = std::make_shared<SpeedMap>(baseSpeed);
+    double values[4];
+
+    if (spec.compare(0, 4, "vad:") == 0) {
+        std::vector<std::string> fields = split(spec.substr(4), ':');
+        if (fields.size() < 2 || fields.size() > 4) {
+            return nullptr;
+        }
+        values[2] = -45.0;
+        values[3] = 200.0;
+        for (size_t i = 0; i < fields.size(); i++) {
+            if (!parseNumber(fields[i], values[i])) {
+                return nullptr;
+            }
+        }
+        if (values[0] <= 0.0 || values[1] <= 0.0 || values[3] < 0.0) {
+            return nullptr;
+        }
+        map->setVoiceActivity((float)values[0], (float)values[1], (float)values[2], (int)values[3]);
+        return map;
+    }
+
+    std::vector<std::string> points = split(spec, ',');
+    if (points.empty()) {
+        return nullptr;
+    }
+    for (const std::string& point : points) {
+        std::vector<std::string> fields = split(point, ':');
+        if (fields.size() != 2 || !parseNumber(fields[0], values[0]) ||
+            !parseNumber(fields[1], values[1]) || values[0] < 0.0 || values[1] <= 0.0) {
+            return nullptr;
+        }
+        map->addPoint(values[0], (float)values[1]);
+    }
+    return map;
+}
+
+void SpeedMap::reset() {
+    // Start as if the last speech was long ago: leading silence is sped up too
+    mSinceSpeech = std::numeric_limits<int64_t>::max();
+}
+
+float SpeedMap::speedFor(const int16_t* samples, int numSamples, int numChannels, int sampleRate,
+                         int64_t pos) {
+    if (!mVad) {
+        double seconds = (double)pos / sampleRate;
+        float speed = mSpeed;
+        for (const auto& point : mPoints) {
+            if (point.first > seconds) {
+                break;
+            }
+            speed = point.second;
+        }
+        return speed;
+    }
+
+    // Mean power against the threshold's, no log per block
+    int numValues = numSamples * numChannels;
+    double sum = 0.0;
+    for (int i = 0; i < numValues; i++) {
+        sum += (double)samples[i] * samples[i];
+    }
+    double threshold = FULL_SCALE * FULL_SCALE * std::pow(10.0, mThresholdDb / 10.0);
+    if (numValues > 0 && sum / numValues >= threshold) {
+        mSinceSpeech = 0;
+    } else if (mSinceSpeech < std::numeric_limits<int64_t>::max() - numSamples) {
+        mSinceSpeech += numSamples;
+    }
+    return mSinceSpeech <= (int64_t)mHangoverMs * sampleRate / 1000 ? mSpeechSpeed : mSilenceSpeed;
+}
+
+int64_t SpeedMap::samplesToNextChange(int64_t pos, int sampleRate) const {
+    if (!mVad) {
+        double seconds = (double)pos / sampleRate;
+        for (const auto& point : mPoints) {
+            if (point.first > seconds) {
+                // At least one sample, the point may fall within the current one
+                int64_t start = (int64_t)std::ceil(point.first * sampleRate);
+                return std::max<int64_t>(1, start - pos);
+            }
+        }
+    }
+    return std::numeric_limits<int64_t>::max();
+}
+
+float SpeedMap::getMinSpeed() const {
+    if (mVad) {
+        return std::min(mSpeechSpeed, mSilenceSpeed);
+    }
+    float speed = mSpeed;
+    for (const auto& point : mPoints) {
+        speed = std::min(speed, point.second);
+    }
+    return speed;
+}
@@ -0,0 +1,57 @@
+#ifndef SPEEDMAP_H
+#define SPEEDMAP_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Playback speed as a function of the input, for the accelerator handlers: either piecewise over
+// input time, or picked block by block by a simple energy voice activity detector (one speed for
+// speech, another for the pauses). The handlers ask it for the speed of every block they write to
+// their stretcher, so a single stream produces the variable-speed output.
+class SpeedMap {
+public:
+    // Constant speed until points are added or voice activity is turned on
+    explicit SpeedMap(float speed = 1.0f);
+
+    // Piecewise: the speed from startSeconds of input on, up to the next point. Before the first
+    // point the constructor's speed applies.
+    void addPoint(double startSeconds, float speed);
+    // Speech (frames above thresholdDb, in dBFS, and the hangoverMs after them so word endings are
+    // not rushed) plays at speechSpeed, the rest at silenceSpeed. Takes over from the points.
+    void setVoiceActivity(float speechSpeed, float silenceSpeed, float thresholdDb = -45.0f,
+                          int hangoverMs = 200);
+
+    // "vad:<speech>:<silence>[:<threshold dB>[:<hangover ms>]]" or a list of points
+    // "<seconds>:<speed>,<seconds>:<speed>,...". baseSpeed is the speed before the first point
+    // (the vad form sets both of its speeds). Returns nullptr if the spec is malformed or a speed
+    // is not positive.
+    static std::shared_ptr<SpeedMap> parse(const std::string& spec, float baseSpeed = 1.0f);
+
+    // Forgets the voice activity state, call at the start of a new signal
+    void reset();
+    // The speed of the numSamples samples (per channel) starting at input sample pos. Advances the
+    // voice activity state, so blocks must be passed in order.
+    float speedFor(const int16_t* samples, int numSamples, int numChannels, int sampleRate,
+                   int64_t pos);
+    // Samples from pos until the piecewise speed next changes (INT64_MAX if it does not), so
+    // blocks can be cut at the points
+    int64_t samplesToNextChange(int64_t pos, int sampleRate) const;
+    // Lowest speed the map can return, to size output buffers
+    float getMinSpeed() const;
+
+private:
+    float mSpeed;
+    std::vector<std::pair<double, float>> mPoints;     // (start seconds, speed), sorted
+
+    bool mVad;
+    float mSpeechSpeed;
+    float mSilenceSpeed;
+    float mThresholdDb;
+    int mHangoverMs;
+    int64_t mSinceSpeech;       // Samples since the last block above the threshold
+};
+
+#endif // SPEEDMAP_H
@@ -0,0 +1,572 @@
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "AudioData.h"
+#include "Accelerator.h"
+#include "SoundToucher.h"
+#include "ParallelStretcher.h"
+#include <speex/config.h>
+#include <speex/os_support.h>
+#include <speex/kiss_fftr.h>
+
+// Compares the time-stretch engines over a fixed corpus (synthetic speech, music and a pure tone,
+// plus any WAV files given) at speeds from 0.5 to 2.0. The engines are fed 10 ms frames as in a
+// real-time pipeline. Every run happens in a child process of its own, so its peak memory can be
+// read with wait4(). Reported per engine, clip and speed:
+//   xrt        input seconds processed per CPU second
+//   peak_kb    growth of the peak resident set while the engine runs
+//   frame_us   wall time of one 10 ms process() call: median, 99th percentile and max
+//   delay_ms   most input held back by the engine (written minus produced times speed)
+//   length     output length over input length / speed
+//   lsd_db     log-spectral distance to the input frame at the same position in input time,
+//              averaged over the frames where the input is not silent: a quality proxy that
+//              ignores phase, lower is better; null if no frame could be compared
+// A run fails, and the bench exits with 1, if the engine crashes or its length is off by more
+// than 10%: the other numbers mean little for an engine that drops or repeats that much.
+// The JSON report (stdout, or the file given with -o) has one result per line in a fixed order
+// and precision, so reports of two commits can be diffed. A table goes to stderr.
+// -t n adds a "scaling" section: ParallelStretcher on every clip at 1, 2, 4, ... up to n threads,
+// with the wall time of the whole clip (best of SCALING_RUNS), the segments it was cut into, and
+// the speedup over one thread. It can be no better than the number of cores, reported next to it.
+//
+// Usage: StretchBench [-s seconds] [-o report.json] [-t threads] [file.wav ...]
+// To add an engine, give it the AudioAccelerator interface (constructor taking the speed, open,
+// process and flush) and add it to engines[].
+
+#define FRAME_MS 10
+// Spectral frames: about 32 ms, rounded up to a power of two, half overlapping
+#define SPECTRUM_MS 32
+// Frames this far below the clip's loudest are silence, and bins this far below the frame's
+// loudest are floored, so noise does not dominate the distance
+#define SILENCE_DB 50.0
+#define FLOOR_DB 60.0
+// Output length (over input length / speed) outside this range fails the run
+#define MIN_LENGTH 0.9
+#define MAX_LENGTH 1.1
+// Thread scaling (-t): one speed, the best of a few runs
+#define SCALING_SPEED 1.5f
+#define SCALING_RUNS 3
+
+struct Clip {
+    std::string name;
+    int sampleRate;
+    int numChannels;
+    std::vector<int16_t> samples;
+};
+
+struct Result {
+    double xrt;
+    long peakKb;
+    double frameUs[3];      // Median, 99th percentile, max
+    double delayMs;
+    double length;
+    double lsdDb;
+    long startKb;           // Peak resident set before the engine ran, not reported
+};
+
+typedef void (*RunFunc)(const Clip& clip, float speed, Result& result, std::vector<int16_t>& output);
+
+struct Engine {
+    const char* name;
+    RunFunc run;
+};
+
+static const float speeds[] = {0.5f, 0.75f, 1.0f, 1.25f, 1.5f, 2.0f};
+#define NUM_SPEEDS (int)(sizeof(speeds) / sizeof(speeds[0]))
+
+static double cpuSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// ru_maxrss is in KB on Linux and in bytes on macOS
+static long maxRssKb(const struct rusage& usage) {
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+template <class Stretcher>
+static void runStretcher(const Clip& clip, float speed, Result& result, std::vector<int16_t>& output) {
+    int numSamples = (int)(clip.samples.size() / clip.numChannels);
+    int frame = clip.sampleRate * FRAME_MS / 1000;
+    std::vector<double> frameUs;
+    double maxHeld = 0.0;
+    int produced = 0;
+
+    // Touch the bench's own buffers first, so the peak resident set grows by the engine alone
+    output.resize((size_t)(numSamples / speed + clip.sampleRate) * clip.numChannels);
+    output.clear();
+    frameUs.resize(numSamples / frame + 1);
+    frameUs.clear();
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    result.startKb = maxRssKb(usage);
+
+    double start = cpuSeconds();
+    Stretcher stretcher(speed);
+    stretcher.open(clip.sampleRate, clip.numChannels);
+    for (int pos = 0; pos < numSamples; pos += frame) {
+        int count = std::min(frame, numSamples - pos);
+        auto before = std::chrono::steady_clock::now();
+        produced += stretcher.process(clip.samples.data() + (size_t)pos * clip.numChannels, count, output);
+        auto after = std::chrono::steady_clock::now();
+        frameUs.push_back(std::chrono::duration<double, std::micro>(after - before).count());
+        maxHeld = std::max(maxHeld, pos + count - produced * (double)speed);
+    }
+    produced += stretcher.flush(output);
+    double elapsed = cpuSeconds() - start;
+
+    std::sort(frameUs.begin(), frameUs.end());
+    result.xrt = (double)numSamples / clip.sampleRate / elapsed;
+    result.frameUs[0] = frameUs[frameUs.size() / 2];
+    result.frameUs[1] = frameUs[std::min(frameUs.size() - 1, frameUs.size() * 99 / 100)];
+    result.frameUs[2] = frameUs.back();
+    result.delayMs = maxHeld * 1000.0 / clip.sampleRate;
+    result.length = produced * (double)speed / numSamples;
+}
+
+static const Engine engines[] = {
+    {"sonic", runStretcher<AudioAccelerator>},
+    {"soundtouch", runStretcher<AudioSoundToucher>},
+};
+#define NUM_ENGINES (int)(sizeof(engines) / sizeof(engines[0]))
+
+// Power spectrum in dB of the Hann-windowed frame at sample start, channels mixed down
+static void spectrumDb(kiss_fftr_cfg fft, const std::vector<int16_t>& samples, int numChannels, int start,
+                       const std::vector<float>& window, std::vector<double>& db) {
+    size_t size = window.size();
+    std::vector<float> x(size);
+    std::vector<kiss_fft_cpx> bins(size / 2 + 1);
+    for (size_t i = 0; i < size; i++) {
+        double sum = 0.0;
+        for (int c = 0; c < numChannels; c++) {
+            sum += samples[(start + i) * numChannels + c];
+        }
+        x[i] = (float)(sum / numChannels) * window[i];
+    }
+    kiss_fftr(fft, x.data(), bins.data());
+    db.resize(size / 2 + 1);
+    for (size_t k = 0; k <= size / 2; k++) {
+        db[k] = 10.0 * std::log10((double)bins[k].r * bins[k].r + (double)bins[k].i * bins[k].i + 1e-9);
+    }
+}
+
+static double logSpectralDistance(const Clip& clip, float speed, const std::vector<int16_t>& output) {
+    int size = 1;
+    while (size < clip.sampleRate * SPECTRUM_MS / 1000) {
+        size <<= 1;
+    }
+    std::vector<float> window(size);
+    for (int i = 0; i < size; i++) {
+        window[i] = (float)(0.5 - 0.5 * std::cos(2.0 * M_PI * i / size));
+    }
+    kiss_fftr_cfg fft = kiss_fftr_alloc(size, 0, NULL, NULL);
+
+    int inputFrames = (int)(clip.samples.size() / clip.numChannels);
+    int outputFrames = (int)(output.size() / clip.numChannels);
+    std::vector<double> ref, out;
+    std::vector<std::pair<double, double>> frames;     // (loudest reference bin, distance)
+    double loudest = -1e9;
+
+    for (int o = 0; o + size <= outputFrames; o += size / 2) {
+        int i = (int)std::lround(o * (double)speed);
+        if (i + size > inputFrames) {
+            break;
+        }
+        spectrumDb(fft, clip.samples, clip.numChannels, i, window, ref);
+        spectrumDb(fft, output, clip.numChannels, o, window, out);
+        double peak = *std::max_element(ref.begin(), ref.end());
+        double floor = peak - FLOOR_DB, sum = 0.0;
+        for (size_t k = 0; k < ref.size(); k++) {
+            double d = std::max(ref[k], floor) - std::max(out[k], floor);
+            sum += d * d;
+        }
+        frames.push_back(std::make_pair(peak, std::sqrt(sum / ref.size())));
+        loudest = std::max(loudest, peak);
+    }
+    kiss_fftr_free(fft);
+
+    double total = 0.0;
+    int count = 0;
+    for (const auto& f : frames) {
+        if (f.first >= loudest - SILENCE_DB) {
+            total += f.second;
+            count++;
+        }
+    }
+    // No frame to compare (the output is shorter than a spectral frame): not a perfect 0 dB
+    return count > 0 ? total / count : NAN;
+}
+
+// The corpus. Deterministic, so reports of different commits compare the same input.
+
+// Voice: 8 harmonics of a 100-250 Hz glide through two formant-like resonances, 4 Hz syllables,
+// a pause every 1.5 s, and a little noise
+static Clip makeSpeech(const char* name, int sampleRate, int numChannels, int seconds) {
+    Clip clip = {name, sampleRate, numChannels, {}};
+    clip.samples.reserve((size_t)sampleRate * seconds * numChannels);
+    unsigned int noise = 1;
+    double phase = 0.0;
+    for (int i = 0; i < sampleRate * seconds; i++) {
+        double t = (double)i / sampleRate;
+        double pitch = 175.0 + 75.0 * std::sin(2 * M_PI * 0.7 * t);
+        double syllable = std::pow(std::sin(M_PI * 4.0 * t), 2.0);
+        double envelope = std::fmod(t, 1.5) < 1.1 ? syllable : 0.0;
+        double value = 0.0;
+        phase += 2 * M_PI * pitch / sampleRate;
+        for (int h = 1; h <= 8; h++) {
+            double f = h * pitch;
+            double formants = 1.0 / (1.0 + std::pow((f - 700.0) / 300.0, 2)) +
+                              0.5 / (1.0 + std::pow((f - 1200.0) / 400.0, 2));
+            value += formants * std::sin(h * phase);
+        }
+        noise = noise * 1103515245 + 12345;
+        value = envelope * value * 9000.0 + ((int)(noise >> 16) % 200 - 100);
+        for (int c = 0; c < numChannels; c++) {
+            clip.samples.push_back((int16_t)(c == 0 ? value : value * 0.8));
+        }
+    }
+    return clip;
+}
+
+// Music: a chord change every second, plucked (decaying) harmonic notes, a click every 0.5 s
+static Clip makeMusic(const char* name, int sampleRate, int numChannels, int seconds) {
+    static const double chords[4][3] = {
+        {261.63, 329.63, 392.00}, {220.00, 261.63, 329.63}, {174.61, 220.00, 261.63}, {196.00, 246.94, 293.66}};
+    Clip clip = {name, sampleRate, numChannels, {}};
+    clip.samples.reserve((size_t)sampleRate * seconds * numChannels);
+    for (int i = 0; i < sampleRate * seconds; i++) {
+        double t = (double)i / sampleRate;
+        const double* chord = chords[(int)t % 4];
+        double since = std::fmod(t, 1.0);
+        double value = 0.0;
+        for (int n = 0; n < 3; n++) {
+            for (int h = 1; h <= 5; h++) {
+                value += std::exp(-3.0 * since * h) * std::sin(2 * M_PI * chord[n] * h * t) / h;
+            }
+        }
+        double click = std::fmod(t, 0.5);
+        value = value * 4000.0 + (click < 0.003 ? 8000.0 * std::sin(2 * M_PI * 2000.0 * click) : 0.0);
+        for (int c = 0; c < numChannels; c++) {
+            // A little wider on the right
+            clip.samples.push_back((int16_t)(c == 0 ? value : value * 0.7 + 1500.0 * std::sin(2 * M_PI * 523.25 * t)));
+        }
+    }
+    return clip;
+}
+
+static Clip makeTone(const char* name, int sampleRate, int seconds) {
+    Clip clip = {name, sampleRate, 1, {}};
+    clip.samples.reserve((size_t)sampleRate * seconds);
+    for (int i = 0; i < sampleRate * seconds; i++) {
+        clip.samples.push_back((int16_t)(10000.0 * std::sin(2 * M_PI * 440.0 * i / sampleRate)));
+    }
+    return clip;
+}
+
+// Clip names are file paths, quote them for JSON
+static std::string jsonString(const std::string& text) {
+    std::string quoted = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+        }
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+#define NUM_SYNTHETIC_CLIPS 4
+
+static std::string clipName(int index, char** files) {
+    static const char* names[NUM_SYNTHETIC_CLIPS] = {"speech-16k-mono", "speech-48k-stereo", "music-44k-stereo",
+                                                     "tone-48k-mono"};
+    return index < NUM_SYNTHETIC_CLIPS ? names[index] : files[index - NUM_SYNTHETIC_CLIPS];
+}
+
+// Clip index of the corpus: the synthetic clips, then the files. False if a file cannot be read.
+static bool loadClip(int index, int seconds, char** files, Clip& clip) {
+    std::string name = clipName(index, files);
+    switch (index) {
+        case 0:
+            clip = makeSpeech(name.c_str(), 16000, 1, seconds);
+            return true;
+        case 1:
+            clip = makeSpeech(name.c_str(), 48000, 2, seconds);
+            return true;
+        case 2:
+            clip = makeMusic(name.c_str(), 44100, 2, seconds);
+            return true;
+        case 3:
+            clip = makeTone(name.c_str(), 48000, seconds);
+            return true;
+    }
+    AudioData wav(name);
+    if (wav.getDataPointer() == nullptr || wav.getChannels() <= 0) {
+        return false;
+    }
+    clip = {name, wav.getSampleRate(), wav.getChannels(), {}};
+    clip.samples.assign(wav.getDataPointer(), wav.getDataPointer() + wav.getDataSize());
+    return true;
+}
+
+// The child side of measure(): one engine on one clip, the result goes to fd
+static int runChild(const char* spec, int seconds, char** files) {
+    int e, c, s, fd;
+    Clip clip;
+    Result result = {};
+    std::vector<int16_t> output;
+
+    if (sscanf(spec, "%d:%d:%d:%d", &e, &c, &s, &fd) != 4 || e < 0 || e >= NUM_ENGINES || s < 0 ||
+        s >= NUM_SPEEDS || !loadClip(c, seconds, files, clip)) {
+        return 1;
+    }
+    engines[e].run(clip, speeds[s], result, output);
+    result.lsdDb = logSpectralDistance(clip, speeds[s], output);
+    return write(fd, &result, sizeof(result)) == (ssize_t)sizeof(result) ? 0 : 1;
+}
+
+// Runs one engine on one clip in a fresh process (this program again, with -r), whose peak
+// resident set wait4() reports. Forking alone would hand the child the parent's heap. False if the
+// child failed or the output length is off.
+static bool measure(char* program, int e, int c, int s, int seconds, char** files, int numFiles, Result& result) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return false;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (pid == 0) {
+        std::string spec = std::to_string(e) + ":" + std::to_string(c) + ":" + std::to_string(s) + ":" +
+                           std::to_string(fds[1]);
+        std::string secondsArg = std::to_string(seconds);
+        std::vector<char*> args = {program, (char*)"-s", (char*)secondsArg.c_str(), (char*)"-r", (char*)spec.c_str()};
+        args.insert(args.end(), files, files + numFiles);
+        args.push_back(nullptr);
+        close(fds[0]);
+        execvp(program, args.data());
+        _exit(127);
+    }
+
+    close(fds[1]);
+    ssize_t got = read(fds[0], &result, sizeof(result));
+    close(fds[0]);
+    int status = 0;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0 ||
+        got != (ssize_t)sizeof(result)) {
+        return false;
+    }
+    result.peakKb = maxRssKb(usage) - result.startKb;
+    if (!(result.length >= MIN_LENGTH && result.length <= MAX_LENGTH)) {
+        fprintf(stderr, "%s: output length %.4f of the expected\n", engines[e].name, result.length);
+        return false;
+    }
+    return true;
+}
+
+// A clip as the IAudioData ParallelStretcher takes, for the thread scaling runs
+class ClipData : public IAudioData {
+public:
+    explicit ClipData(const Clip& clip) : clip(clip), samples(clip.samples) {}
+
+    int16_t* getDataPointer() override { return samples.data(); }
+    unsigned int getDataSize() const override { return (unsigned int)samples.size(); }
+    int getSampleRate() const override { return clip.sampleRate; }
+    void setSampleRate(int sampleRate) override {}
+    int getChannels() const override { return clip.numChannels; }
+    int getSampleSize() const override { return sizeof(int16_t); }
+    void updateData(std::vector<int16_t> newData) override { samples = std::move(newData); }
+    void addEncodedData(uint32_t sequenceNumber, const std::vector<uint8_t>& data) override {}
+    std::list<EncodedData>& getEncodedDataList() override { return encoded; }
+    size_t getEncodedDataSizeSum() override { return 0; }
+    VoiceActivity& getVoiceActivity() override { return voiceActivity; }
+
+private:
+    const Clip& clip;
+    std::vector<int16_t> samples;
+    std::list<EncodedData> encoded;
+    VoiceActivity voiceActivity;
+};
+
+// Wall time in ms of ParallelStretcher on the whole clip, the best of SCALING_RUNS; negative if it
+// failed. Its timing lines on stdout are dropped, they would end up in the report.
+static double runScaling(const Clip& clip, const char* engine, int numThreads, int& numSegments) {
+    double best = -1.0;
+    std::streambuf* console = std::cout.rdbuf(nullptr);
+    for (int run = 0; run < SCALING_RUNS; run++) {
+        ClipData data(clip);
+        ParallelStretcher stretcher(engine, SCALING_SPEED, numThreads);
+        auto before = std::chrono::steady_clock::now();
+        bool ok = stretcher.handleAudioData(data);
+        auto after = std::chrono::steady_clock::now();
+        if (!ok) {
+            best = -1.0;
+            break;
+        }
+        double ms = std::chrono::duration<double, std::milli>(after - before).count();
+        best = best < 0.0 ? ms : std::min(best, ms);
+        numSegments = stretcher.getNumSegments();
+    }
+    std::cout.rdbuf(console);
+    std::cout.clear();
+    return best;
+}
+
+// JSON has no NaN
+static std::string jsonNumber(double value, int precision) {
+    if (std::isnan(value)) {
+        return "null";
+    }
+    char text[32];
+    snprintf(text, sizeof(text), "%.*f", precision, value);
+    return text;
+}
+
+int main(int argc, char** argv) {
+    int seconds = 10;
+    const char* reportPath = nullptr;
+    const char* childSpec = nullptr;
+    int maxThreads = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:o:r:t:")) != -1) {
+        switch (opt) {
+            case 's':
+                seconds = atoi(optarg);
+                break;
+            case 'o':
+                reportPath = optarg;
+                break;
+            case 'r':
+                childSpec = optarg;
+                break;
+            case 't':
+                maxThreads = atoi(optarg);
+                if (maxThreads <= 0) {
+                    seconds = 0;
+                }
+                break;
+            default:
+                seconds = 0;
+                break;
+        }
+    }
+    if (seconds <= 0) {
+        fprintf(stderr, "Usage: %s [-s seconds] [-o report.json] [-t threads] [file.wav ...]\n", argv[0]);
+        return 1;
+    }
+    char** files = argv + optind;
+    int numFiles = argc - optind;
+    if (childSpec != nullptr) {
+        return runChild(childSpec, seconds, files);
+    }
+    for (int i = 0; i < numFiles; i++) {
+        Clip clip;
+        if (!loadClip(NUM_SYNTHETIC_CLIPS + i, 1, files, clip)) {
+            fprintf(stderr, "Cannot read %s\n", files[i]);
+            return 1;
+        }
+    }
+
+    FILE* report = reportPath ? fopen(reportPath, "w") : stdout;
+    if (report == nullptr) {
+        fprintf(stderr, "Cannot write %s\n", reportPath);
+        return 1;
+    }
+    fprintf(report, "{\"seconds\": %d, \"frame_ms\": %d, \"results\": [\n", seconds, FRAME_MS);
+    fprintf(stderr, "%-11s %-20s %5s %8s %8s %8s %8s %8s %8s %7s %7s\n", "engine", "clip", "speed", "xRT", "peak KB",
+            "p50 us", "p99 us", "max us", "delay ms", "length", "LSD dB");
+
+    bool first = true, failed = false;
+    for (int e = 0; e < NUM_ENGINES; e++) {
+        for (int c = 0; c < NUM_SYNTHETIC_CLIPS + numFiles; c++) {
+            std::string name = clipName(c, files);
+            for (int s = 0; s < NUM_SPEEDS; s++) {
+                Result r;
+                if (!measure(argv[0], e, c, s, seconds, files, numFiles, r)) {
+                    fprintf(stderr, "%s failed on %s at %.2f\n", engines[e].name, name.c_str(), speeds[s]);
+                    failed = true;
+                    continue;
+                }
+                fprintf(report,
+                        "%s{\"engine\": \"%s\", \"clip\": %s, \"speed\": %.2f, \"xrt\": %.1f, \"peak_kb\": %ld, "
+                        "\"frame_us\": [%.1f, %.1f, %.1f], \"delay_ms\": %.1f, \"length\": %.4f, \"lsd_db\": %s}",
+                        first ? "" : ",\n", engines[e].name, jsonString(name).c_str(), speeds[s], r.xrt, r.peakKb,
+                        r.frameUs[0], r.frameUs[1], r.frameUs[2], r.delayMs, r.length, jsonNumber(r.lsdDb, 2).c_str());
+                fprintf(stderr, "%-11s %-20s %5.2f %8.0f %8ld %8.1f %8.1f %8.1f %8.1f %7.4f %7.2f\n", engines[e].name,
+                        name.c_str(), speeds[s], r.xrt, r.peakKb, r.frameUs[0], r.frameUs[1], r.frameUs[2],
+                        r.delayMs, r.length, r.lsdDb);
+                first = false;
+            }
+        }
+    }
+    fprintf(report, "\n]");
+
+    if (maxThreads > 0) {
+        unsigned int cores = std::thread::hardware_concurrency();
+        fprintf(report, ", \"cores\": %u, \"scaling\": [\n", cores);
+        fprintf(stderr, "\nParallelStretcher at %.2f, %u core(s)\n%-11s %-20s %7s %8s %9s %7s\n", SCALING_SPEED,
+                cores, "engine", "clip", "threads", "segments", "wall ms", "speedup");
+        first = true;
+        for (int e = 0; e < NUM_ENGINES; e++) {
+            for (int c = 0; c < NUM_SYNTHETIC_CLIPS + numFiles; c++) {
+                Clip clip;
+                loadClip(c, seconds, files, clip);
+                double single = 0.0;
+                // 1, 2, 4, ... and maxThreads itself
+                for (int t = 1;; t = std::min(t * 2, maxThreads)) {
+                    int segments = 0;
+                    double ms = runScaling(clip, engines[e].name, t, segments);
+                    if (ms < 0.0) {
+                        fprintf(stderr, "Parallel %s failed on %s with %d thread(s)\n", engines[e].name,
+                                clip.name.c_str(), t);
+                        failed = true;
+                        break;
+                    }
+                    if (t == 1) {
+                        single = ms;
+                    }
+                    fprintf(report,
+                            "%s{\"engine\": \"%s\", \"clip\": %s, \"threads\": %d, \"segments\": %d, "
+                            "\"wall_ms\": %.1f, \"speedup\": %.2f}",
+                            first ? "" : ",\n", engines[e].name, jsonString(clip.name).c_str(), t, segments, ms,
+                            single / ms);
+                    fprintf(stderr, "%-11s %-20s %7d %8d %9.1f %7.2f\n", engines[e].name, clip.name.c_str(), t,
+                            segments, ms, single / ms);
+                    first = false;
+                    if (t == maxThreads) {
+                        break;
+                    }
+                }
+            }
+        }
+        fprintf(report, "\n]");
+    }
+    fprintf(report, "}\n");
+    if (report != stdout) {
+        fclose(report);
+    }
+    return failed ? 1 : 0;
+}
@@ -9,19 +9,35 @@
 #include "SoundToucher.h"
 #include "OpusEncoder.h"
 #include "OpusDecoder.h"
+#include "JitterBufferHandler.h"
 #include "AudioHelper.h"
+#include "SpeedMap.h"
+#include "ParallelStretcher.h"
+#include "Resampler.h"
+#include "Preprocessor.h"
 
 int main(int argc, char* argv[]) {
     int opt;
     std::string file;
     std::string accelerate;
     std::string speed;
+    std::string speed_map;
+    std::string threads;
+    std::string stereo_pitch;
+    std::string resample;
+    std::string resample_quality;
+    bool denoise = false;
+    std::string agc;
+    bool vad = false;
     std::string codec;
     std::string encoder_complexity;
     std::string decoder_complexity;
     std::string packet_loss;
     std::string bit_rate;
     std::string dred_duration;
+    std::string jitter;
+    std::string network_delay;
+    bool adaptive_playout = false;
 
     const struct option long_options[] = {
         {"file", required_argument, nullptr, 'f'}, 
@@ -33,6 +49,17 @@ int main(int argc, char* argv[]) {
         {"packet_loss", required_argument, nullptr, 4}, 
         {"bit_rate", required_argument, nullptr, 5}, 
         {"dred_duration", required_argument, nullptr, 6}, 
+        {"jitter", required_argument, nullptr, 7}, 
+        {"network_delay", required_argument, nullptr, 8}, 
+        {"adaptive_playout", no_argument, nullptr, 9}, 
+        {"speed_map", required_argument, nullptr, 10}, 
+        {"threads", required_argument, nullptr, 11}, 
+        {"resample", required_argument, nullptr, 12}, 
+        {"resample_quality", required_argument, nullptr, 13}, 
+        {"denoise", no_argument, nullptr, 14}, 
+        {"agc", required_argument, nullptr, 15}, 
+        {"vad", no_argument, nullptr, 16}, 
+        {"stereo_pitch", required_argument, nullptr, 17}, 
         {nullptr, 0, nullptr, 0}
     };
 
@@ -68,6 +95,39 @@ int main(int argc, char* argv[]) {
             case 6:
                 dred_duration = optarg;
                 break;
+            case 7:
+                jitter = optarg;
+                break;
+            case 8:
+                network_delay = optarg;
+                break;
+            case 9:
+                adaptive_playout = true;
+                break;
+            case 10:
+                speed_map = optarg;
+                break;
+            case 11:
+                threads = optarg;
+                break;
+            case 12:
+                resample = optarg;
+                break;
+            case 13:
+                resample_quality = optarg;
+                break;
+            case 14:
+                denoise = true;
+                break;
+            case 15:
+                agc = optarg;
+                break;
+            case 16:
+                vad = true;
+                break;
+            case 17:
+                stereo_pitch = optarg;
+                break;
             case '?':
                 std::cerr << "Unknown option: " << optopt << std::endl;
                 return 1;
@@ -80,8 +140,11 @@ int main(int argc, char* argv[]) {
     
     if (file.empty()) {
         std::cerr << "Usage: " << argv[0] << " --file <path_to_pcm_file.pcm> \
-        [-a <sonic/soundtouch> --speed [0.5~2.0]]] \
-        [-c <opus> --encoder_complexity <1~10> --decoder_complexity <1~10> --packet_loss <0~100> --bit_rate <500~512000> --dred_duration <1~100>]"
+        [-a <sonic/soundtouch> --speed [0.5~2.0] --speed_map <vad:speech:silence[:dB[:ms]] | sec:speed,...> --threads <n, 0: all cores> --stereo_pitch <mix/fft-joint>]] \
+        [-c <opus> --encoder_complexity <1~10> --decoder_complexity <1~10> --packet_loss <0~100> --bit_rate <500~512000> --dred_duration <1~100> \
+        [--jitter <ms> --network_delay <ms> --adaptive_playout]] \
+        [--resample <rate> --resample_quality <0~10>] \
+        [--denoise --agc <level, 1~32768> --vad]"
         << std::endl;
         return 1;
     }
@@ -89,6 +152,7 @@ int main(int argc, char* argv[]) {
     std::shared_ptr<IAudioDataHandler> accHandler = nullptr;
     std::shared_ptr<OpusEncoder> opusEncoder = nullptr;
     std::shared_ptr<OpusDecoder> opusDecoder = nullptr;
+    std::shared_ptr<JitterBufferHandler> jitterHandler = nullptr;
 
     if (!accelerate.empty()) {
         float fSpeed = 1.0;
@@ -96,16 +160,71 @@ int main(int argc, char* argv[]) {
             fSpeed = std::stof(speed);
         }
 
-        if (accelerate == "sonic") {
-            accHandler = std::make_shared<AudioAccelerator>(fSpeed);
+        std::shared_ptr<SpeedMap> speedMap = nullptr;
+        if (!speed_map.empty()) {
+            if (!speed.empty() && speed_map.compare(0, 4, "vad:") == 0) {
+                std::cerr << "--speed does not apply to a vad speed map, it sets both speeds" << std::endl;
+                return 1;
+            }
+            // --speed plays until the map's first point
+            speedMap = SpeedMap::parse(speed_map, fSpeed);
+            if (!speedMap) {
+                std::cerr << "Invalid speed map: " << speed_map << std::endl;
+                return 1;
+            }
+        }
+
+        // fft-joint: each channel's FFT autocorrelation, searched together. Finds the period on
+        // out-of-phase stereo too, where the mix cancels out, at about 5x (8 kHz) to 15-20x
+        // (48 kHz) the cost of mix per search (PitchBench)
+        int pitchEstimator = SONIC_PITCH_AMDF;
+        int channelPitchMode = SONIC_CHANNELS_MIX;
+        if (!stereo_pitch.empty()) {
+            if (accelerate != "sonic" || !threads.empty()) {
+                std::cerr << "--stereo_pitch only applies to -a sonic without --threads" << std::endl;
+                return 1;
+            }
+            if (stereo_pitch == "fft-joint") {
+                pitchEstimator = SONIC_PITCH_FFT;
+                channelPitchMode = SONIC_CHANNELS_JOINT;
+            } else if (stereo_pitch != "mix") {
+                std::cerr << "Invalid stereo pitch mode: " << stereo_pitch << std::endl;
+                return 1;
+            }
+        }
+
+        if (!threads.empty()) {
+            // Offline: segments stretched in parallel, at one constant speed
+            if (speedMap) {
+                std::cerr << "--threads does not take a speed map" << std::endl;
+                return 1;
+            }
+            if (accelerate != "sonic" && accelerate != "soundtouch") {
+                std::cerr << "Invalid audio accelerator engine: " << accelerate << std::endl;
+                return 1;
+            }
+            accHandler = std::make_shared<ParallelStretcher>(accelerate, fSpeed, std::stoi(threads));
+        } else if (accelerate == "sonic") {
+            auto accelerator = std::make_shared<AudioAccelerator>(fSpeed);
+            accelerator->setSpeedMap(speedMap);
+            accelerator->setPitchEstimator(pitchEstimator);
+            accelerator->setChannelPitchMode(channelPitchMode);
+            accHandler = accelerator;
         } else if (accelerate == "soundtouch") {
-            accHandler = std::make_shared<AudioSoundToucher>(fSpeed);
+            auto soundToucher = std::make_shared<AudioSoundToucher>(fSpeed);
+            soundToucher->setSpeedMap(speedMap);
+            accHandler = soundToucher;
         } else {
             std::cerr << "Invalid audio accelerator engine: " << accelerate << std::endl;
             return 1;
         }
     }
 
+    if (codec.empty() && (!jitter.empty() || !network_delay.empty() || adaptive_playout)) {
+        std::cerr << "--jitter, --network_delay and --adaptive_playout need -c opus" << std::endl;
+        return 1;
+    }
+
     if (!codec.empty()) {
         if (codec != "opus") {
             std::cerr << "Invalid codec: " << codec << std::endl;
@@ -130,6 +249,13 @@ int main(int argc, char* argv[]) {
         if (!decoder_complexity.empty()) {
             opusDecoder->setComplexity(std::stoi(decoder_complexity));
         }
+        // Adaptive playout on its own runs the jitter buffer over a network without delay or jitter
+        if (!jitter.empty() || !network_delay.empty() || adaptive_playout) {
+            int jitterMs = jitter.empty() ? 0 : std::stoi(jitter);
+            int delayMs = network_delay.empty() ? 0 : std::stoi(network_delay);
+            jitterHandler = std::make_shared<JitterBufferHandler>(opusDecoder, delayMs, jitterMs);
+            jitterHandler->setAdaptivePlayout(adaptive_playout);
+        }
 
     }
 
@@ -138,12 +264,44 @@ int main(int argc, char* argv[]) {
     if (dataPointer) {
         std::shared_ptr<IAudioDataHandler> player = std::make_shared<CoreAudioPlayer>();
 
+        // Opus only takes 8/12/16/24/48 kHz, anything else goes to 48 kHz unless --resample says otherwise
+        int inputRate = audioData.getSampleRate();
+        int resampleRate = resample.empty() ? 0 : std::stoi(resample);
+        if (resampleRate == 0 && opusEncoder && inputRate != 8000 && inputRate != 12000 && inputRate != 16000
+            && inputRate != 24000 && inputRate != 48000) {
+            resampleRate = 48000;
+        }
+        std::shared_ptr<AudioResampler> resampler = nullptr;
+        if (resampleRate > 0) {
+            int quality = resample_quality.empty() ? SPEEX_RESAMPLER_QUALITY_DEFAULT : std::stoi(resample_quality);
+            resampler = std::make_shared<AudioResampler>(resampleRate, quality);
+        }
+
+        // Speex preprocessor ahead of the encoder, its VAD tells the encoder which frames are silent
+        std::shared_ptr<AudioPreprocessor> preprocessor = nullptr;
+        if (denoise || !agc.empty() || vad) {
+            preprocessor = std::make_shared<AudioPreprocessor>();
+            preprocessor->setDenoise(denoise);
+            if (!agc.empty()) {
+                preprocessor->setAgcLevel(std::stof(agc));
+            }
+            preprocessor->setVad(vad);
+        }
+
         AudioHandlerChain processor;
+        if (resampler) {
+            processor.addHandler(resampler);
+        }
+        if (preprocessor) {
+            processor.addHandler(preprocessor);
+        }
         //processor.addHandler(player);
         if (opusEncoder) {
             processor.addHandler(opusEncoder);
         }
-        if (opusDecoder) {
+        if (jitterHandler) {
+            processor.addHandler(jitterHandler);
+        } else if (opusDecoder) {
             processor.addHandler(opusDecoder);
         }
         if (accHandler) {
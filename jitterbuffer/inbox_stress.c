@@ -0,0 +1,155 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <speex/speex_jitter.h>
+
+// Several threads feed one jitter buffer with jitter_buffer_put_async() while the main thread
+// plays it out with jitter_buffer_get()/jitter_buffer_tick() and resets it now and then. Run once
+// with the data copied and once with it adopted (destroy callback). Checks that every packet
+// returned has the data it was put with, and, when adopted, that every packet is either returned
+// or handed to the destroy callback exactly once. Built with ThreadSanitizer by the CMake test.
+// Usage: JitterInboxStress [producers] [packets per producer], exits non-zero on failure
+
+#define STEP 20
+#define MAX_LEN 128
+#define RESET_EVERY 1000
+
+static JitterBuffer *jitter;
+static int numProducers = 4;
+static int numPackets = 20000;
+static int adopting;
+static int producersDone;
+static int destroyed;
+
+// Packets of all producers interleave on the timeline, so they race for the same slots
+static spx_uint32_t timestampOf(int producer, int i) {
+    return (spx_uint32_t)(i * numProducers + producer) * STEP;
+}
+
+static int lengthOf(spx_uint32_t timestamp) {
+    return 8 + (int)(timestamp / STEP % (MAX_LEN - 8));
+}
+
+static void fill(char *data, spx_uint32_t timestamp) {
+    int j, len = lengthOf(timestamp);
+    for (j = 0; j < len; j++) {
+        data[j] = (char)(timestamp + j);
+    }
+}
+
+static int check(const JitterBufferPacket *packet) {
+    int j, len = lengthOf(packet->timestamp);
+    if ((int)packet->len != len) {
+        return 0;
+    }
+    for (j = 0; j < len; j++) {
+        if (packet->data[j] != (char)(packet->timestamp + j)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void destroyData(void *data) {
+    __atomic_fetch_add(&destroyed, 1, __ATOMIC_RELAXED);
+    free(data);
+}
+
+static void *produce(void *arg) {
+    int producer = (int)(size_t)arg;
+    int i;
+    char copy[MAX_LEN];
+
+    for (i = 0; i < numPackets; i++) {
+        JitterBufferPacket packet;
+        packet.timestamp = timestampOf(producer, i);
+        packet.span = STEP;
+        packet.len = lengthOf(packet.timestamp);
+        packet.sequence = 0;
+        packet.user_data = 0;
+        packet.data = adopting ? (char *)malloc(MAX_LEN) : copy;
+        fill(packet.data, packet.timestamp);
+        jitter_buffer_put_async(jitter, &packet);
+        // Give the playout thread a chance between packets, even on a single core
+        sched_yield();
+    }
+    __atomic_fetch_add(&producersDone, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static int run(int adopt) {
+    pthread_t *threads = (pthread_t *)malloc(sizeof(pthread_t) * numProducers);
+    char data[MAX_LEN];
+    int p, iteration = 0, returned = 0, bad = 0, done = 0;
+    int total = numProducers * numPackets;
+
+    jitter = jitter_buffer_init(STEP);
+    adopting = adopt;
+    producersDone = 0;
+    destroyed = 0;
+    if (adopt) {
+        jitter_buffer_ctl(jitter, JITTER_BUFFER_SET_DESTROY_CALLBACK, (void *)destroyData);
+    }
+    for (p = 0; p < numProducers; p++) {
+        pthread_create(&threads[p], NULL, produce, (void *)(size_t)p);
+    }
+    // One last round after the producers are done, so their last packets get drained too
+    while (done < 2) {
+        JitterBufferPacket packet;
+        spx_int32_t offset;
+        if (__atomic_load_n(&producersDone, __ATOMIC_ACQUIRE) == numProducers) {
+            done++;
+        }
+        packet.data = data;
+        packet.len = MAX_LEN;
+        if (jitter_buffer_get(jitter, &packet, STEP, &offset) == JITTER_BUFFER_OK) {
+            if (!check(&packet)) {
+                bad++;
+            }
+            if (adopt) {
+                free(packet.data);
+            }
+            returned++;
+        }
+        jitter_buffer_tick(jitter);
+        if (++iteration % RESET_EVERY == 0) {
+            jitter_buffer_reset(jitter);
+        }
+    }
+    for (p = 0; p < numProducers; p++) {
+        pthread_join(threads[p], NULL);
+    }
+    jitter_buffer_destroy(jitter);
+    free(threads);
+
+    printf("%s: %d packets put, %d returned, %d destroyed, %d corrupt\n", adopt ? "adopted" : "copied",
+           total, returned, destroyed, bad);
+    if (bad != 0) {
+        return 0;
+    }
+    if (adopt && returned + destroyed != total) {
+        fprintf(stderr, "adopted: %d packets were neither returned nor destroyed\n",
+                total - returned - destroyed);
+        return 0;
+    }
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    int ok;
+
+    if (argc > 1) {
+        numProducers = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        numPackets = atoi(argv[2]);
+    }
+    if (numProducers < 1 || numPackets < 1) {
+        fprintf(stderr, "Usage: %s [producers] [packets per producer]\n", argv[0]);
+        return 2;
+    }
+    ok = run(0);
+    ok = run(1) && ok;
+    return ok ? 0 : 1;
+}
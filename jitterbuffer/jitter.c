@@ -34,7 +34,6 @@
 
 /*
 TODO:
-- Add short-term estimate
 - Defensive programming
   + warn when last returned < last desired (begative buffering)
   + warn if update_delay not called between get() and tick() or is called twice in a row
@@ -42,12 +41,6 @@ TODO:
   + return memory to a pool
   + allow pre-allocation of the pool
   + optional max number of elements
-- Statistics
-  + drift
-  + loss
-  + late
-  + jitter
-  + buffering delay
 */
 #ifdef HAVE_CONFIG_H
 #include <speex/config.h>
@@ -68,6 +61,13 @@ TODO:
 
 #define TSUB(a,b) ((spx_int32_t)((a)-(b)))
 
+/* Trace events cost nothing unless the library is built with JITTER_BUFFER_TRACE */
+#ifdef JITTER_BUFFER_TRACE
+#define JB_TRACE(jitter, type, a, b, c) do { if ((jitter)->trace.callback) jitter_trace(jitter, type, a, b, c); } while (0)
+#else
+#define JB_TRACE(jitter, type, a, b, c) do { } while (0)
+#endif
+
 #define GT32(a,b) (((spx_int32_t)((a)-(b)))>0)
 #define GE32(a,b) (((spx_int32_t)((a)-(b)))>=0)
 #define LT32(a,b) (((spx_int32_t)((a)-(b)))<0)
@@ -79,6 +79,14 @@ TODO:
 #define MAX_BUFFERS 3
 #define TOP_DELAY 40
 
+#define MAX_SHORT_TERM 64          /**< Maximum number of recent timings used for the short-term estimate */
+#define DEFAULT_SHORT_TERM 16      /**< Default short-term window (320 ms with 20 ms packets) */
+#define DEFAULT_SHORT_WEIGHT 50    /**< Default weight (percent) of the short-term estimate when reducing the delay */
+
+#define PUT_MANY_CHUNK 64          /**< jitter_buffer_put_many() sorts the packets by chunks of this size */
+#define TS_HASH_SIZE 256           /**< Number of timestamp hash buckets (power of two) */
+#define TS_HASH(ts) ((spx_uint32_t)((ts)*2654435761u) >> 24)
+
 /** Buffer that keeps the time of arrival of the latest packets */
 struct TimingBuffer {
    int filled;                         /**< Number of entries occupied in "timing" and "counts"*/
@@ -93,8 +101,12 @@ static void tb_init(struct TimingBuffer *tb)
    tb->curr_count = 0;
 }
 
+#define TB_DISCARDED 0   /**< Timing was too early to make it into the list */
+#define TB_INSERTED  1   /**< Timing was inserted in the list */
+#define TB_REPLACED  2   /**< Timing was inserted and the earliest one of the (full) list was dropped */
+
 /* Add the timing of a new packet to the TimingBuffer */
-static void tb_add(struct TimingBuffer *tb, spx_int16_t timing)
+static int tb_add(struct TimingBuffer *tb, spx_int16_t timing)
 {
    int pos;
    /* Discard packet that won't make it into the list because they're too early */
@@ -102,7 +114,7 @@ static void tb_add(struct TimingBuffer *tb, spx_int16_t timing)
    {
       tb->curr_count++;
       //printf("tb_add skipped because they are too early timing %d\n", timing);
-      return;
+      return TB_DISCARDED;
    }
    //printf("tb_add added timing %d\n", timing);
    
@@ -131,12 +143,102 @@ static void tb_add(struct TimingBuffer *tb, spx_int16_t timing)
    
    tb->curr_count++;
    if (tb->filled<MAX_TIMINGS)
+   {
       tb->filled++;
+      return TB_INSERTED;
+   }
+   return TB_REPLACED;
+}
+
+/** Timings of all the sub-windows merged in a single sorted list. It is kept up to date as timings are
+    added and sub-windows are rotated, so that compute_opt_delay() never has to merge the sub-windows.
+    That is not free: an insertion is a binary search plus a move of everything after it, so O(n) in the
+    number of timings held (at most MAX_BUFFERS*MAX_TIMINGS), and so are the removals. */
+struct TimingHistogram {
+   int filled;                                     /**< Number of entries occupied in "timing" and "owner" */
+   spx_int32_t timing[MAX_BUFFERS*MAX_TIMINGS];    /**< Sorted list of the timings of all sub-windows ("latest" packets first) */
+   spx_int16_t owner[MAX_BUFFERS*MAX_TIMINGS];     /**< Sub-window (index in _tb) each timing belongs to */
+};
+
+static void th_init(struct TimingHistogram *th)
+{
+   th->filled = 0;
+}
+
+/* Insert a timing that was just added to sub-window "owner" (after the equal timings, like tb_add() does),
+   O(log n) to find the place and O(n) to make room for it */
+static void th_insert(struct TimingHistogram *th, spx_int16_t timing, int owner)
+{
+   int lo = 0;
+   int hi = th->filled;
+   speex_assert(th->filled < MAX_BUFFERS*MAX_TIMINGS);
+   while (lo < hi)
+   {
+      int mid = (lo+hi)>>1;
+      if (timing >= th->timing[mid])
+         lo = mid+1;
+      else
+         hi = mid;
+   }
+   if (lo < th->filled)
+   {
+      SPEEX_MOVE(&th->timing[lo+1], &th->timing[lo], th->filled-lo);
+      SPEEX_MOVE(&th->owner[lo+1], &th->owner[lo], th->filled-lo);
+   }
+   th->timing[lo] = timing;
+   th->owner[lo] = owner;
+   th->filled++;
 }
 
+/* Remove the earliest timing of sub-window "owner" (the one tb_add() dropped from a full list) */
+static void th_remove_earliest(struct TimingHistogram *th, int owner)
+{
+   int pos = th->filled-1;
+   while (pos >= 0 && th->owner[pos] != owner)
+      pos--;
+   speex_assert(pos >= 0);
+   SPEEX_MOVE(&th->timing[pos], &th->timing[pos+1], th->filled-pos-1);
+   SPEEX_MOVE(&th->owner[pos], &th->owner[pos+1], th->filled-pos-1);
+   th->filled--;
+}
 
+/* Remove all the timings of sub-window "owner" (when it gets rotated out) */
+static void th_remove_owner(struct TimingHistogram *th, int owner)
+{
+   int i, j;
+   for (i=0,j=0;i<th->filled;i++)
+   {
+      if (th->owner[i] != owner)
+      {
+         th->timing[j] = th->timing[i];
+         th->owner[j] = th->owner[i];
+         j++;
+      }
+   }
+   th->filled = j;
+}
+
+
+
+/** Min-heap of stored slots, ordered by timestamp or by end of packet (timestamp+span). pos[] 
+    gives the place of each slot in the heap so any packet can be taken out in O(log n). */
+struct SlotHeap {
+   spx_int16_t slot[SPEEX_JITTER_MAX_BUFFER_SIZE];   /**< Heap of slot indices */
+   spx_int16_t pos[SPEEX_JITTER_MAX_BUFFER_SIZE];    /**< Index in slot[] of each stored slot */
+   int size;
+   int by_end;                                        /**< Key is timestamp+span instead of timestamp */
+};
 
 /** Jitter buffer structure */
+/** Packet waiting in the inbox (see jitter_buffer_put_async()). Nodes are allocated by the producers and
+    handed back to them through the recycle stack once drained, so they are never freed on the playout thread. */
+struct InboxNode {
+   struct InboxNode *next;
+   JitterBufferPacket packet;   /**< Data points to buf, or is the caller's (adopted) data if there's a destroy callback */
+   char *buf;                   /**< Copy of the data, stays with the node when it is recycled */
+   spx_uint32_t buf_size;       /**< Allocated size of buf */
+};
+
 struct JitterBuffer_ {
    spx_uint32_t pointer_timestamp;                             /**< Timestamp of what we will *get* next */
    spx_uint32_t last_returned_timestamp;                       /**< Useful for getting the next packet with the same timestamp (for fragmented media) */
@@ -166,8 +268,85 @@ struct JitterBuffer_ {
    int auto_tradeoff;                                          /**< Latency equivalent of losing one percent of packets (automatic default) */
    
    int lost_count;                                             /**< Number of consecutive lost packets  */
+
+   struct TimingHistogram histogram;                           /**< All the timings of timeBuffers, merged and sorted */
+   int tot_count;                                              /**< Number of packet timings we have received in the whole window */
+   int opt_valid;                                              /**< True if "opt" is still what compute_opt_delay() would return */
+   spx_int16_t opt;                                            /**< Last result of compute_opt_delay() */
+   int opt_tradeoff;                                           /**< auto_tradeoff used to compute "opt" */
+   
+   spx_int32_t short_timing[MAX_SHORT_TERM];                   /**< Ring buffer of the latest timings, in the order they were received */
+   int short_pos;                                              /**< Where the next timing goes in short_timing */
+   int short_filled;                                           /**< Number of entries occupied in short_timing */
+   int short_window;                                           /**< Number of recent timings the short-term estimate looks at */
+   int short_weight;                                           /**< Weight (percent) of the short-term estimate when it allows a lower delay */
+   
+   int packet_count;                                           /**< Number of packets stored in "packets" */
+   spx_uint32_t newest_end;                                    /**< End (timestamp+span) of the newest packet stored */
+   spx_int32_t last_transit;                                   /**< Timestamp minus arrival time of the previous packet */
+   int have_transit;                                           /**< True if last_transit is valid */
+   spx_int32_t jitter_q4;                                      /**< Interarrival jitter estimate (Q4 timestamp units) */
+   JitterBufferStats stats;                                    /**< Counters returned by JITTER_BUFFER_GET_STATS */
+   struct InboxNode *inbox;                                    /**< Packets put by other threads (lock-free stack) */
+   struct InboxNode *recycled;                                 /**< Drained inbox nodes for the producers to reuse (lock-free stack) */
+   spx_int16_t hash_head[TS_HASH_SIZE];                        /**< First slot of each timestamp bucket (-1 if empty) */
+   spx_int16_t hash_tail[TS_HASH_SIZE];                        /**< Last slot of each timestamp bucket, packets are chained in insertion order */
+   spx_int16_t hash_next[SPEEX_JITTER_MAX_BUFFER_SIZE];        /**< Next slot in the same bucket */
+   spx_int16_t hash_prev[SPEEX_JITTER_MAX_BUFFER_SIZE];        /**< Previous slot in the same bucket */
+   struct SlotHeap by_start;                                   /**< Stored slots by timestamp (evict the earliest when full) */
+   struct SlotHeap by_end;                                     /**< Stored slots by end of packet (cleanup of stale packets) */
+   spx_int16_t free_slots[SPEEX_JITTER_MAX_BUFFER_SIZE];       /**< Stack of empty slots */
+   int free_count;                                             /**< Number of entries in free_slots */
+#ifdef JITTER_BUFFER_TRACE
+   JitterBufferTrace trace;                                    /**< Trace callback, see JITTER_BUFFER_SET_TRACE */
+#endif
 };
 
+#ifdef JITTER_BUFFER_TRACE
+static void jitter_trace(JitterBuffer *jitter, int type, spx_int32_t a, spx_int32_t b, spx_int32_t c)
+{
+   JitterBufferTraceEvent ev;
+   ev.type = type;
+   ev.pointer_timestamp = jitter->pointer_timestamp;
+   ev.next_stop = jitter->next_stop;
+   ev.a = a;
+   ev.b = b;
+   ev.c = c;
+   jitter->trace.callback(&ev, jitter->trace.arg);
+}
+#endif
+
+/** Short-term estimate of the optimal delay: the delay that would have kept the late packets of the
+    short window under max_late_rate. Unlike the long-term estimate, it forgets a congestion spike
+    as soon as it leaves the window.
+ */
+static spx_int16_t compute_short_term_delay(JitterBuffer *jitter)
+{
+   int i, j, k;
+   int n = 0;
+   int allowed;
+   spx_int32_t lowest[MAX_SHORT_TERM];
+   
+   /* Number of late packets the window can have without exceeding the max late rate */
+   allowed = jitter->short_window*jitter->max_late_rate/100;
+   
+   /* Keep the allowed+1 "latest" packets of the window, sorted */
+   for (i=0;i<jitter->short_window;i++)
+   {
+      spx_int32_t timing = jitter->short_timing[(jitter->short_pos-1-i+MAX_SHORT_TERM)%MAX_SHORT_TERM];
+      if (n > allowed && timing >= lowest[n-1])
+         continue;
+      for (j=0;j<n && timing >= lowest[j];j++);
+      k = n > allowed ? n-1 : n;
+      for (;k>j;k--)
+         lowest[k] = lowest[k-1];
+      lowest[j] = timing;
+      if (n <= allowed)
+         n++;
+   }
+   return ROUND_DOWN(lowest[n-1], jitter->delay_step);
+}
+
 /** Based on available data, this computes the optimal delay for the jitter buffer. 
    The optimised function is in timestamp units and is:
    cost = delay + late_factor*[number of frames that would be late if we used that delay]
@@ -180,21 +359,25 @@ static spx_int16_t compute_opt_delay(JitterBuffer *jitter)
    spx_int16_t opt=0;
    spx_int32_t best_cost=0x7fffffff;
    int late = 0;
-   int pos[MAX_BUFFERS];
    int tot_count;
    float late_factor;
    int penalty_taken = 0;
    int best = 0;
    int worst = 0;
    spx_int32_t deltaT;
-   struct TimingBuffer *tb;
+   struct TimingHistogram *th;
+   
+   /* Nothing changed since last time (the automatic tradeoff may have, it depends on the result) */
+   if (jitter->opt_valid && (jitter->latency_tradeoff != 0 || jitter->opt_tradeoff == jitter->auto_tradeoff))
+      return jitter->opt;
    
-   tb = jitter->_tb;
+   th = &jitter->histogram;
    
    /* Number of packet timings we have received (including those we didn't keep) */
-   tot_count = 0;
-   for (i=0;i<MAX_BUFFERS;i++)
-      tot_count += tb[i].curr_count;
+   tot_count = jitter->tot_count;
+   jitter->opt_valid = 1;
+   jitter->opt_tradeoff = jitter->auto_tradeoff;
+   jitter->opt = 0;
    if (tot_count==0)
       return 0;
    
@@ -205,46 +388,29 @@ static spx_int16_t compute_opt_delay(JitterBuffer *jitter)
       late_factor = jitter->auto_tradeoff * jitter->window_size/tot_count;
    
    //fprintf(stderr, "late_factor = %f, tot_count %d\n", late_factor, tot_count);
-   for (i=0;i<MAX_BUFFERS;i++)
-      pos[i] = 0;
    
    /* Pick the TOP_DELAY "latest" packets (doesn't need to actually be late 
-      for the current settings) */
-   for (i=0;i<TOP_DELAY;i++)
-   {
-      int j;
-      int next=-1;
-      int latest = 32767;
-      /* Pick latest amoung all sub-windows */
-      for (j=0;j<MAX_BUFFERS;j++)
-      {
-         if (pos[j] < tb[j].filled && tb[j].timing[pos[j]] < latest)
-         {
-            next = j;
-            latest = tb[j].timing[pos[j]];
-         }
-      }
-      if (next != -1)
-      {
-         spx_int32_t cost;
-         
-         if (i==0)
-            worst = latest;
-         best = latest;
-         //fprintf(stderr, "original latest %d\n", latest);
-         latest = ROUND_DOWN(latest, jitter->delay_step);
-         pos[next]++;
-         
-         /* Actual cost function that tells us how bad using this delay would be */
-         cost = -latest + late_factor*late;
-         //fprintf(stderr, "cost %d = %d + %f * %d\n", cost, -latest, late_factor, late);
-         if (cost < best_cost)
-         {
-            best_cost = cost;
-            opt = latest;
-         }
-      } else {
+      for the current settings). The histogram already has them sorted. */
+   for (i=0;i<TOP_DELAY && i<th->filled;i++)
+   {
+      spx_int32_t cost;
+      int latest = th->timing[i];
+      
+      if (latest >= 32767)
          break;
+      if (i==0)
+         worst = latest;
+      best = latest;
+      //fprintf(stderr, "original latest %d\n", latest);
+      latest = ROUND_DOWN(latest, jitter->delay_step);
+      
+      /* Actual cost function that tells us how bad using this delay would be */
+      cost = -latest + late_factor*late;
+      //fprintf(stderr, "cost %d = %d + %f * %d\n", cost, -latest, late_factor, late);
+      if (cost < best_cost)
+      {
+         best_cost = cost;
+         opt = latest;
       }
       
       /* For the next timing we will consider, there will be one more late packet to count */
@@ -262,18 +428,135 @@ static spx_int16_t compute_opt_delay(JitterBuffer *jitter)
    jitter->auto_tradeoff = 1 + deltaT/TOP_DELAY;
    /*fprintf(stderr, "auto_tradeoff = %d (%d %d %d)\n", jitter->auto_tradeoff, best, worst, i);*/
    
-   /* FIXME: Compute a short-term estimate too and combine with the long-term one */
-   if ((tot_count >= TOP_DELAY) && (opt != 0)) {
-      fprintf(stderr, "final chosen cost %d\n", best_cost);
+   /* Combine with the short-term estimate: follow it right away when the latest packets need more
+      buffering than the long-term window says, and only partially when it allows a lower delay */
+   if (jitter->short_weight > 0 && jitter->short_filled >= jitter->short_window)
+   {
+      spx_int16_t short_opt = compute_short_term_delay(jitter);
+      if (short_opt < opt)
+         opt = short_opt;
+      else
+         opt = ROUND_DOWN(opt + (short_opt-opt)*jitter->short_weight/100, jitter->delay_step);
    }
    
    /* Prevents reducing the buffer size when we haven't really had much data */
    if (tot_count < TOP_DELAY && opt > 0)
-      return 0;
+      opt = 0;
+   /* After the clamp, so the trace shows the delay that is actually used */
+   JB_TRACE(jitter, JITTER_BUFFER_TRACE_OPT_DELAY, opt, best_cost, tot_count);
+   jitter->opt = opt;
    return opt;
 }
 
 
+static spx_uint32_t heap_key(const JitterBuffer *jitter, const struct SlotHeap *heap, int i)
+{
+   return jitter->packets[i].timestamp + (heap->by_end ? jitter->packets[i].span : 0);
+}
+
+static void heap_set(struct SlotHeap *heap, int k, int i)
+{
+   heap->slot[k] = i;
+   heap->pos[i] = k;
+}
+
+/** Move the entry at k up or down until the heap is ordered again */
+static void heap_fix(const JitterBuffer *jitter, struct SlotHeap *heap, int k)
+{
+   int i = heap->slot[k];
+   spx_uint32_t key = heap_key(jitter, heap, i);
+   while (k > 0 && LT32(key, heap_key(jitter, heap, heap->slot[(k-1)/2])))
+   {
+      heap_set(heap, k, heap->slot[(k-1)/2]);
+      k = (k-1)/2;
+   }
+   for (;;)
+   {
+      int c = 2*k+1;
+      if (c >= heap->size)
+         break;
+      if (c+1 < heap->size && LT32(heap_key(jitter, heap, heap->slot[c+1]), heap_key(jitter, heap, heap->slot[c])))
+         c++;
+      if (!LT32(heap_key(jitter, heap, heap->slot[c]), key))
+         break;
+      heap_set(heap, k, heap->slot[c]);
+      k = c;
+   }
+   heap_set(heap, k, i);
+}
+
+static void heap_insert(const JitterBuffer *jitter, struct SlotHeap *heap, int i)
+{
+   heap_set(heap, heap->size++, i);
+   heap_fix(jitter, heap, heap->size-1);
+}
+
+static void heap_remove(const JitterBuffer *jitter, struct SlotHeap *heap, int i)
+{
+   int k = heap->pos[i];
+   heap->size--;
+   if (k < heap->size)
+   {
+      heap_set(heap, k, heap->slot[heap->size]);
+      heap_fix(jitter, heap, k);
+   }
+}
+
+/** Chain a newly stored slot into the bucket of its timestamp */
+static void hash_link(JitterBuffer *jitter, int i)
+{
+   int h = TS_HASH(jitter->packets[i].timestamp);
+   jitter->hash_next[i] = -1;
+   jitter->hash_prev[i] = jitter->hash_tail[h];
+   if (jitter->hash_tail[h] >= 0)
+      jitter->hash_next[jitter->hash_tail[h]] = i;
+   else
+      jitter->hash_head[h] = i;
+   jitter->hash_tail[h] = i;
+}
+
+/** First stored slot with this exact timestamp, -1 if there is none */
+static int hash_find(JitterBuffer *jitter, spx_uint32_t timestamp)
+{
+   int i;
+   for (i=jitter->hash_head[TS_HASH(timestamp)];i>=0;i=jitter->hash_next[i])
+   {
+      if (jitter->packets[i].timestamp == timestamp)
+         break;
+   }
+   return i;
+}
+
+/** Empty a slot (the data has already been freed or handed out) */
+static void remove_packet(JitterBuffer *jitter, int i)
+{
+   int h = TS_HASH(jitter->packets[i].timestamp);
+   if (jitter->hash_prev[i] >= 0)
+      jitter->hash_next[jitter->hash_prev[i]] = jitter->hash_next[i];
+   else
+      jitter->hash_head[h] = jitter->hash_next[i];
+   if (jitter->hash_next[i] >= 0)
+      jitter->hash_prev[jitter->hash_next[i]] = jitter->hash_prev[i];
+   else
+      jitter->hash_tail[h] = jitter->hash_prev[i];
+   heap_remove(jitter, &jitter->by_start, i);
+   heap_remove(jitter, &jitter->by_end, i);
+   jitter->free_slots[jitter->free_count++] = i;
+   jitter->packets[i].data = NULL;
+   jitter->packet_count--;
+}
+
+/** Drop a stored packet that will never be returned */
+static void discard_packet(JitterBuffer *jitter, int i)
+{
+   if (jitter->destroy)
+      jitter->destroy(jitter->packets[i].data);
+   else
+      speex_free(jitter->packets[i].data);
+   remove_packet(jitter, i);
+   jitter->stats.discarded++;
+}
+
 /** Initialise jitter buffer */
 EXPORT JitterBuffer *jitter_buffer_init(int step_size)
 {
@@ -284,6 +567,16 @@ EXPORT JitterBuffer *jitter_buffer_init(int step_size)
       spx_int32_t tmp;
       for (i=0;i<SPEEX_JITTER_MAX_BUFFER_SIZE;i++)
          jitter->packets[i].data=NULL;
+      for (i=0;i<TS_HASH_SIZE;i++)
+         jitter->hash_head[i] = jitter->hash_tail[i] = -1;
+      /* Hand out the slots from 0 up */
+      for (i=0;i<SPEEX_JITTER_MAX_BUFFER_SIZE;i++)
+         jitter->free_slots[i] = SPEEX_JITTER_MAX_BUFFER_SIZE-1-i;
+      jitter->free_count = SPEEX_JITTER_MAX_BUFFER_SIZE;
+      jitter->by_start.size = 0;
+      jitter->by_start.by_end = 0;
+      jitter->by_end.size = 0;
+      jitter->by_end.by_end = 1;
       jitter->delay_step = step_size;
       jitter->concealment_size = step_size;
       /*FIXME: Should this be 0 or 1?*/
@@ -292,6 +585,16 @@ EXPORT JitterBuffer *jitter_buffer_init(int step_size)
       jitter->destroy = NULL;
       jitter->latency_tradeoff = 0;
       jitter->auto_adjust = 1;
+      jitter->short_window = DEFAULT_SHORT_TERM;
+      jitter->short_weight = DEFAULT_SHORT_WEIGHT;
+      jitter->packet_count = 0;
+      SPEEX_MEMSET(&jitter->stats, 0, 1);
+      jitter->inbox = NULL;
+      jitter->recycled = NULL;
+#ifdef JITTER_BUFFER_TRACE
+      jitter->trace.callback = NULL;
+      jitter->trace.arg = NULL;
+#endif
       tmp = 4;
       jitter_buffer_ctl(jitter, JITTER_BUFFER_SET_MAX_LATE_RATE, &tmp);
       jitter_buffer_reset(jitter);
@@ -299,21 +602,37 @@ EXPORT JitterBuffer *jitter_buffer_init(int step_size)
    return jitter;
 }
 
+/** Push the chain of nodes from first to last on the recycle stack (any thread) */
+static void recycle_nodes(JitterBuffer *jitter, struct InboxNode *first, struct InboxNode *last)
+{
+   struct InboxNode *head = __atomic_load_n(&jitter->recycled, __ATOMIC_RELAXED);
+   do {
+      last->next = head;
+   } while (!__atomic_compare_exchange_n(&jitter->recycled, &head, first, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
 /** Reset jitter buffer */
 EXPORT void jitter_buffer_reset(JitterBuffer *jitter)
 {
    int i;
-   for (i=0;i<SPEEX_JITTER_MAX_BUFFER_SIZE;i++)
+   struct InboxNode *node, *tail;
+   /* Packets put before the reset must not be linked in after it */
+   node = __atomic_exchange_n(&jitter->inbox, NULL, __ATOMIC_ACQUIRE);
+   for (tail=node;tail;tail=tail->next)
    {
-      if (jitter->packets[i].data)
+      if (jitter->destroy)
+         jitter->destroy(tail->packet.data);
+      if (!tail->next)
       {
-         if (jitter->destroy)
-            jitter->destroy(jitter->packets[i].data);
-         else
-            speex_free(jitter->packets[i].data);
-         jitter->packets[i].data = NULL;
+         recycle_nodes(jitter, node, tail);
+         break;
       }
    }
+   for (i=0;i<SPEEX_JITTER_MAX_BUFFER_SIZE;i++)
+   {
+      if (jitter->packets[i].data)
+         discard_packet(jitter, i);
+   }
    /* Timestamp is actually undefined at this point */
    jitter->pointer_timestamp = 0;
    jitter->next_stop = 0;
@@ -327,36 +646,79 @@ EXPORT void jitter_buffer_reset(JitterBuffer *jitter)
       tb_init(&jitter->_tb[i]);
       jitter->timeBuffers[i] = &jitter->_tb[i];
    }
+   th_init(&jitter->histogram);
+   jitter->tot_count = 0;
+   jitter->opt_valid = 0;
+   jitter->short_pos = 0;
+   jitter->short_filled = 0;
+   jitter->have_transit = 0;
+   jitter->jitter_q4 = 0;
    /*fprintf (stderr, "reset\n");*/
 }
 
 /** Destroy jitter buffer */
 EXPORT void jitter_buffer_destroy(JitterBuffer *jitter)
 {
+   struct InboxNode *node;
+   /* The reset empties the inbox into the recycle stack */
    jitter_buffer_reset(jitter);
+   node = jitter->recycled;
+   while (node)
+   {
+      struct InboxNode *next = node->next;
+      speex_free(node->buf);
+      speex_free(node);
+      node = next;
+   }
    speex_free(jitter);
 }
 
-/** Take the following timing into consideration for future calculations */
-static void update_timings(JitterBuffer *jitter, spx_int32_t timing)
+/** Timings are kept within the range of an spx_int16_t, the type tb_add() and th_insert() take them as */
+static spx_int32_t clamp_timing(spx_int32_t timing)
 {
    if (timing < -32767)
-      timing = -32767;
+      return -32767;
    if (timing > 32767)
-      timing = 32767;
+      return 32767;
+   return timing;
+}
+
+/** Take the following timing into consideration for future calculations */
+static void update_timings(JitterBuffer *jitter, spx_int32_t timing)
+{
+   timing = clamp_timing(timing);
+   JB_TRACE(jitter, JITTER_BUFFER_TRACE_TIMING, timing, 0, 0);
    /* If the current sub-window is full, perform a rotation and discard oldest sub-widow */
    //printf("update timings %d\n", timing);
    if (jitter->timeBuffers[0]->curr_count >= jitter->subwindow_size)
    {
       int i;
-      fprintf(stderr, "Rotate buffer\n");
       struct TimingBuffer *tmp = jitter->timeBuffers[MAX_BUFFERS-1];
       for (i=MAX_BUFFERS-1;i>=1;i--)
          jitter->timeBuffers[i] = jitter->timeBuffers[i-1];
       jitter->timeBuffers[0] = tmp;
+      /* The oldest sub-window goes away, and so do its timings */
+      jitter->tot_count -= tmp->curr_count;
+      th_remove_owner(&jitter->histogram, tmp - jitter->_tb);
       tb_init(jitter->timeBuffers[0]);
+      JB_TRACE(jitter, JITTER_BUFFER_TRACE_ROTATE, jitter->tot_count, 0, 0);
    }
-   tb_add(jitter->timeBuffers[0], timing);
+   switch (tb_add(jitter->timeBuffers[0], timing))
+   {
+      case TB_REPLACED:
+         th_remove_earliest(&jitter->histogram, jitter->timeBuffers[0] - jitter->_tb);
+         /* fall through */
+      case TB_INSERTED:
+         th_insert(&jitter->histogram, timing, jitter->timeBuffers[0] - jitter->_tb);
+         break;
+   }
+   jitter->tot_count++;
+   
+   jitter->short_timing[jitter->short_pos] = timing;
+   jitter->short_pos = (jitter->short_pos+1)%MAX_SHORT_TERM;
+   if (jitter->short_filled < MAX_SHORT_TERM)
+      jitter->short_filled++;
+   jitter->opt_valid = 0;
 }
 
 /** Compensate all timings when we do an adjustment of the buffering */
@@ -367,34 +729,51 @@ static void shift_timings(JitterBuffer *jitter, spx_int16_t amount)
    for (i=0;i<MAX_BUFFERS;i++)
    {
       for (j=0;j<jitter->timeBuffers[i]->filled;j++)
-         jitter->timeBuffers[i]->timing[j] += amount;
+         jitter->timeBuffers[i]->timing[j] = clamp_timing(jitter->timeBuffers[i]->timing[j] + amount);
    }
+   /* Shifting and clamping everything the same way keeps the merged list sorted and equal to the
+      sub-windows, even for timings that hit the limit */
+   for (j=0;j<jitter->histogram.filled;j++)
+      jitter->histogram.timing[j] = clamp_timing(jitter->histogram.timing[j] + amount);
+   for (j=0;j<jitter->short_filled;j++)
+      jitter->short_timing[j] = clamp_timing(jitter->short_timing[j] + amount);
+   jitter->opt_valid = 0;
 }
 
 
-/** Put one packet into the jitter buffer */
-EXPORT void jitter_buffer_put(JitterBuffer *jitter, const JitterBufferPacket *packet)
+/** Cleanup buffer (remove old packets that weren't played), O(log n) per packet removed */
+static void cleanup_buffer(JitterBuffer *jitter)
+{
+   if (jitter->reset_state)
+      return;
+   /* Make sure we don't discard a "just-late" packet in case we want to play it next (if we interpolate). */
+   while (jitter->by_end.size > 0 && LE32(heap_key(jitter, &jitter->by_end, jitter->by_end.slot[0]), jitter->pointer_timestamp))
+   {
+      /*fprintf (stderr, "cleaned (not played)\n");*/
+      discard_packet(jitter, jitter->by_end.slot[0]);
+   }
+}
+
+/** Account for a new packet and find the slot it goes into. Everything but the data is filled in, 
+    the caller stores the data right away. Returns -1 if the packet is too late to be stored. */
+static int reserve_slot(JitterBuffer *jitter, const JitterBufferPacket *packet)
 {
-   spx_uint32_t i,j;
+   int i;
    int late;
    /*fprintf (stderr, "put packet %d %d\n", timestamp, span);*/
    
-   /* Cleanup buffer (remove old packets that weren't played) */
+   jitter->stats.received++;
    if (!jitter->reset_state)
    {
-      for (i=0;i<SPEEX_JITTER_MAX_BUFFER_SIZE;i++)
+      /* Interarrival jitter, the same way RTP does it (J += (|D|-J)/16) */
+      spx_int32_t transit = TSUB(packet->timestamp, jitter->next_stop);
+      if (jitter->have_transit)
       {
-         /* Make sure we don't discard a "just-late" packet in case we want to play it next (if we interpolate). */
-         if (jitter->packets[i].data && LE32(jitter->packets[i].timestamp + jitter->packets[i].span, jitter->pointer_timestamp))
-         {
-            /*fprintf (stderr, "cleaned (not played)\n");*/
-            if (jitter->destroy)
-               jitter->destroy(jitter->packets[i].data);
-            else
-               speex_free(jitter->packets[i].data);
-            jitter->packets[i].data = NULL;
-         }
+         spx_int32_t d = transit - jitter->last_transit;
+         jitter->jitter_q4 += (d < 0 ? -d : d) - ((jitter->jitter_q4+8)>>4);
       }
+      jitter->last_transit = transit;
+      jitter->have_transit = 1;
    }
    
    /*fprintf(stderr, "arrival: %d %d %d\n", packet->timestamp, jitter->next_stop, jitter->pointer_timestamp);*/
@@ -404,6 +783,7 @@ EXPORT void jitter_buffer_put(JitterBuffer *jitter, const JitterBufferPacket *pa
       update_timings(jitter, ((spx_int32_t)packet->timestamp) - ((spx_int32_t)jitter->next_stop) - jitter->buffer_margin);
       //printf("update timings for put, timestamp %d, next_stop %d, buffer_margin %d\n", packet->timestamp, jitter->next_stop, jitter->buffer_margin);
       late = 1;
+      jitter->stats.late++;
    } else {
       late = 0;
    }
@@ -413,50 +793,20 @@ EXPORT void jitter_buffer_put(JitterBuffer *jitter, const JitterBufferPacket *pa
    if (jitter->lost_count>20)
    {
       jitter_buffer_reset(jitter);
-      printf("jitter_buffer_reset\n");
+      JB_TRACE(jitter, JITTER_BUFFER_TRACE_RESET, packet->timestamp, 0, 0);
    }
    
    /* Only insert the packet if it's not hopelessly late (i.e. totally useless) */
    if (jitter->reset_state || GE32(packet->timestamp+packet->span+jitter->delay_step, jitter->pointer_timestamp))
    {
 
-      /*Find an empty slot in the buffer*/
-      for (i=0;i<SPEEX_JITTER_MAX_BUFFER_SIZE;i++)
-      {
-         if (jitter->packets[i].data==NULL)
-            break;
-      }
-      
       /*No place left in the buffer, need to make room for it by discarding the oldest packet */
-      if (i==SPEEX_JITTER_MAX_BUFFER_SIZE)
+      if (jitter->free_count == 0)
       {
-         int earliest=jitter->packets[0].timestamp;
-         i=0;
-         for (j=1;j<SPEEX_JITTER_MAX_BUFFER_SIZE;j++)
-         {
-            if (!jitter->packets[i].data || LT32(jitter->packets[j].timestamp,earliest))
-            {
-               earliest = jitter->packets[j].timestamp;
-               i=j;
-            }
-         }
-         if (jitter->destroy)
-            jitter->destroy(jitter->packets[i].data);
-         else
-            speex_free(jitter->packets[i].data);
-         jitter->packets[i].data=NULL;
-         //fprintf (stderr, "Buffer is full, discarding earliest frame %d (currently at %d)\n", earliest, jitter->pointer_timestamp);    
+         discard_packet(jitter, jitter->by_start.slot[0]);
       }
+      i = jitter->free_slots[--jitter->free_count];
    
-      /* Copy packet in buffer */
-      if (jitter->destroy)
-      {
-         jitter->packets[i].data = packet->data;
-      } else {
-         jitter->packets[i].data=(char*)speex_alloc(packet->len);
-         for (j=0;j<packet->len;j++)
-            jitter->packets[i].data[j]=packet->data[j];
-      }
       jitter->packets[i].timestamp=packet->timestamp;
       jitter->packets[i].span=packet->span;
       jitter->packets[i].len=packet->len;
@@ -466,9 +816,155 @@ EXPORT void jitter_buffer_put(JitterBuffer *jitter, const JitterBufferPacket *pa
          jitter->arrival[i] = 0;
       else
          jitter->arrival[i] = jitter->next_stop;
+      if (jitter->packet_count == 0 || GT32(packet->timestamp+packet->span, jitter->newest_end))
+         jitter->newest_end = packet->timestamp+packet->span;
+      jitter->packet_count++;
+      hash_link(jitter, i);
+      heap_insert(jitter, &jitter->by_start, i);
+      heap_insert(jitter, &jitter->by_end, i);
+      return i;
+   } else {
+      /* Hopelessly late */
+      jitter->stats.discarded++;
+      return -1;
+   }
+}
+
+/** Copy packet in buffer */
+static void store_data(JitterBuffer *jitter, int i, const JitterBufferPacket *packet)
+{
+   spx_uint32_t j;
+   if (jitter->destroy)
+   {
+      jitter->packets[i].data = packet->data;
+   } else {
+      jitter->packets[i].data=(char*)speex_alloc(packet->len);
+      for (j=0;j<packet->len;j++)
+         jitter->packets[i].data[j]=packet->data[j];
    }
+}
+
+/** Put one packet into the jitter buffer */
+EXPORT void jitter_buffer_put(JitterBuffer *jitter, const JitterBufferPacket *packet)
+{
+   int i;
+   cleanup_buffer(jitter);
+   i = reserve_slot(jitter, packet);
+   if (i >= 0)
+      store_data(jitter, i, packet);
+}
+
+/** Put several packets into the jitter buffer */
+EXPORT void jitter_buffer_put_many(JitterBuffer *jitter, const JitterBufferPacket *packets, int nb_packets)
+{
+   int order[PUT_MANY_CHUNK];
+   int base, n, i, j;
    
+   /* The playout pointer doesn't move while we insert, so one sweep covers the whole batch */
+   cleanup_buffer(jitter);
+   for (base=0;base<nb_packets;base+=n)
+   {
+      n = nb_packets-base < PUT_MANY_CHUNK ? nb_packets-base : PUT_MANY_CHUNK;
+      /* Insertion sort by timestamp, batches are small and usually almost in order already */
+      for (i=0;i<n;i++)
+      {
+         for (j=i;j>0 && LT32(packets[base+i].timestamp, packets[order[j-1]].timestamp);j--)
+            order[j] = order[j-1];
+         order[j] = base+i;
+      }
+      for (i=0;i<n;i++)
+      {
+         int slot = reserve_slot(jitter, &packets[order[i]]);
+         if (slot >= 0)
+            store_data(jitter, slot, &packets[order[i]]);
+      }
+   }
+}
+
+/** Take a node off the recycle stack, NULL if there's none (any thread). The whole stack is taken and the
+    rest pushed back: unlike popping a single node, this can't be fooled by a node that was popped and
+    pushed again in between (ABA). */
+static struct InboxNode *take_recycled_node(JitterBuffer *jitter)
+{
+   struct InboxNode *node, *tail;
+   if (__atomic_load_n(&jitter->recycled, __ATOMIC_RELAXED) == NULL)
+      return NULL;
+   node = __atomic_exchange_n(&jitter->recycled, NULL, __ATOMIC_ACQUIRE);
+   if (node && node->next)
+   {
+      for (tail=node->next;tail->next;tail=tail->next)
+         ;
+      recycle_nodes(jitter, node->next, tail);
+   }
+   return node;
+}
+
+/** Put one packet into the inbox, from any thread */
+EXPORT void jitter_buffer_put_async(JitterBuffer *jitter, const JitterBufferPacket *packet)
+{
+   spx_uint32_t j;
+   struct InboxNode *head;
+   struct InboxNode *node = take_recycled_node(jitter);
    
+   if (!node)
+   {
+      node = (struct InboxNode*)speex_alloc(sizeof(struct InboxNode));
+      node->buf = NULL;
+      node->buf_size = 0;
+   }
+   /* The data is copied into the node's own buffer (or adopted), so the caller can reuse it right away */
+   node->packet = *packet;
+   if (!jitter->destroy)
+   {
+      if (node->buf_size < packet->len)
+      {
+         speex_free(node->buf);
+         node->buf = (char*)speex_alloc(packet->len);
+         node->buf_size = packet->len;
+      }
+      for (j=0;j<packet->len;j++)
+         node->buf[j]=packet->data[j];
+      node->packet.data = node->buf;
+   }
+   
+   /* Push on the stack, the release pairs with the acquire in drain_inbox() */
+   head = __atomic_load_n(&jitter->inbox, __ATOMIC_RELAXED);
+   do {
+      node->next = head;
+   } while (!__atomic_compare_exchange_n(&jitter->inbox, &head, node, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/** Take everything out of the inbox and insert it in arrival order (playout thread only) */
+static void drain_inbox(JitterBuffer *jitter)
+{
+   struct InboxNode *node, *next, *list = NULL, *tail;
+   
+   /* Plain load first so an empty inbox doesn't cost a locked instruction */
+   if (__atomic_load_n(&jitter->inbox, __ATOMIC_RELAXED) == NULL)
+      return;
+   node = __atomic_exchange_n(&jitter->inbox, NULL, __ATOMIC_ACQUIRE);
+   
+   /* The stack is newest first */
+   tail = node;
+   while (node)
+   {
+      next = node->next;
+      node->next = list;
+      list = node;
+      node = next;
+   }
+   cleanup_buffer(jitter);
+   /* The data is copied out of the node (or adopted) like jitter_buffer_put() does, so that what the
+      playout thread allocates it also frees, and the nodes go back to the producers with their buffers */
+   for (node=list;node;node=node->next)
+   {
+      int i = reserve_slot(jitter, &node->packet);
+      if (i >= 0)
+         store_data(jitter, i, &node->packet);
+      else if (jitter->destroy)
+         jitter->destroy(node->packet.data);
+   }
+   recycle_nodes(jitter, list, tail);
 }
 
 /** Get one packet from the jitter buffer */
@@ -482,22 +978,15 @@ EXPORT int jitter_buffer_get(JitterBuffer *jitter, JitterBufferPacket *packet, s
    if (start_offset != NULL)
       *start_offset = 0;
 
+   drain_inbox(jitter);
+   
    /* Syncing on the first call */
    if (jitter->reset_state)
    {
-      int found = 0;
-      /* Find the oldest packet */
-      spx_uint32_t oldest=0;
-      for (i=0;i<SPEEX_JITTER_MAX_BUFFER_SIZE;i++)
-      {
-         if (jitter->packets[i].data && (!found || LT32(jitter->packets[i].timestamp,oldest)))
-         {
-            oldest = jitter->packets[i].timestamp;
-            found = 1;
-         }
-      }
-      if (found)
+      if (jitter->by_start.size > 0)
       {
+         /* Start from the oldest packet */
+         spx_uint32_t oldest = jitter->packets[jitter->by_start.slot[0]].timestamp;
          jitter->reset_state=0;         
          jitter->pointer_timestamp = oldest;
          jitter->next_stop = oldest;
@@ -531,11 +1020,13 @@ EXPORT int jitter_buffer_get(JitterBuffer *jitter, JitterBufferPacket *packet, s
    /* Searching for the packet that fits best */
    
    /* Search the buffer for a packet with the right timestamp and spanning the whole current chunk */
-   for (i=0;i<SPEEX_JITTER_MAX_BUFFER_SIZE;i++)
+   for (i=hash_find(jitter, jitter->pointer_timestamp);i>=0;i=jitter->hash_next[i])
    {
-      if (jitter->packets[i].data && jitter->packets[i].timestamp==jitter->pointer_timestamp && GE32(jitter->packets[i].timestamp+jitter->packets[i].span,jitter->pointer_timestamp+desired_span))
+      if (jitter->packets[i].timestamp==jitter->pointer_timestamp && GE32(jitter->packets[i].timestamp+jitter->packets[i].span,jitter->pointer_timestamp+desired_span))
          break;
    }
+   if (i<0)
+      i = SPEEX_JITTER_MAX_BUFFER_SIZE;
    
    /* If no match, try for an "older" packet that still spans (fully) the current chunk */
    if (i==SPEEX_JITTER_MAX_BUFFER_SIZE)
@@ -618,7 +1109,8 @@ EXPORT int jitter_buffer_get(JitterBuffer *jitter, JitterBufferPacket *packet, s
          /* Remove packet */
          speex_free(jitter->packets[i].data);
       }
-      jitter->packets[i].data = NULL;
+      remove_packet(jitter, i);
+      jitter->stats.returned++;
       /* Set timestamp and span (if requested) */
       offset = (spx_int32_t)jitter->packets[i].timestamp-(spx_int32_t)jitter->pointer_timestamp;
       if (start_offset != NULL)
@@ -648,10 +1140,12 @@ EXPORT int jitter_buffer_get(JitterBuffer *jitter, JitterBufferPacket *packet, s
    
    //fprintf (stderr, "not found for timestamp %d\n", jitter->pointer_timestamp);
    jitter->lost_count++;
+   jitter->stats.lost++;
    /*fprintf (stderr, "m");*/
    /*fprintf (stderr, "lost_count = %d\n", jitter->lost_count);*/
    
    opt = compute_opt_delay(jitter);
+   jitter->stats.target_delay = opt;
    
    /* Should we force an increase in the buffer or just do normal interpolation? */   
    if (opt < 0)
@@ -660,6 +1154,7 @@ EXPORT int jitter_buffer_get(JitterBuffer *jitter, JitterBufferPacket *packet, s
       
       /* Shift histogram to compensate */
       shift_timings(jitter, -opt);
+      jitter->stats.inserted += -opt;
       
       packet->timestamp = jitter->pointer_timestamp;
       packet->span = -opt;
@@ -667,9 +1162,9 @@ EXPORT int jitter_buffer_get(JitterBuffer *jitter, JitterBufferPacket *packet, s
       packet->len = 0;
       
       jitter->buffered = packet->span - desired_span;
+      JB_TRACE(jitter, JITTER_BUFFER_TRACE_LOSS, packet->span, 1, 0);
       return JITTER_BUFFER_INSERTION;
       /*jitter->pointer_timestamp -= jitter->delay_step;*/
-      fprintf (stderr, "Forced to interpolate\n");
    } else {
       /* Normal packet loss */
       packet->timestamp = jitter->pointer_timestamp;
@@ -680,8 +1175,8 @@ EXPORT int jitter_buffer_get(JitterBuffer *jitter, JitterBufferPacket *packet, s
       packet->len = 0;
       
       jitter->buffered = packet->span - desired_span;
+      JB_TRACE(jitter, JITTER_BUFFER_TRACE_LOSS, packet->span, 0, 0);
       return JITTER_BUFFER_MISSING;
-      fprintf (stderr, "Normal loss\n");
    }
 
 
@@ -689,13 +1184,10 @@ EXPORT int jitter_buffer_get(JitterBuffer *jitter, JitterBufferPacket *packet, s
 
 EXPORT int jitter_buffer_get_another(JitterBuffer *jitter, JitterBufferPacket *packet)
 {
-   spx_uint32_t i, j;
-   for (i=0;i<SPEEX_JITTER_MAX_BUFFER_SIZE;i++)
-   {
-      if (jitter->packets[i].data && jitter->packets[i].timestamp==jitter->last_returned_timestamp)
-         break;
-   }
-   if (i!=SPEEX_JITTER_MAX_BUFFER_SIZE)
+   spx_uint32_t j;
+   /* Fragments of the same timestamp are chained together, in the order they arrived */
+   int i = hash_find(jitter, jitter->last_returned_timestamp);
+   if (i>=0)
    {
       /* Copy packet */
       packet->len = jitter->packets[i].len;
@@ -708,7 +1200,8 @@ EXPORT int jitter_buffer_get_another(JitterBuffer *jitter, JitterBufferPacket *p
          /* Remove packet */
          speex_free(jitter->packets[i].data);
       }
-      jitter->packets[i].data = NULL;
+      remove_packet(jitter, i);
+      jitter->stats.returned++;
       packet->timestamp = jitter->packets[i].timestamp;
       packet->span = jitter->packets[i].span;
       packet->sequence = jitter->packets[i].sequence;
@@ -726,9 +1219,9 @@ EXPORT int jitter_buffer_get_another(JitterBuffer *jitter, JitterBufferPacket *p
 static int _jitter_buffer_update_delay(JitterBuffer *jitter, JitterBufferPacket *packet, spx_int32_t *start_offset)
 {
    spx_int16_t opt = compute_opt_delay(jitter);
-   if (opt != 0) {
-      fprintf(stderr, "opt adjustment is %d\n", opt);
-   }
+   jitter->stats.target_delay = opt;
+   if (opt != 0)
+      JB_TRACE(jitter, JITTER_BUFFER_TRACE_ADJUST, opt, 0, 0);
    
    if (opt < 0)
    {
@@ -736,11 +1229,13 @@ static int _jitter_buffer_update_delay(JitterBuffer *jitter, JitterBufferPacket
       
       jitter->pointer_timestamp += opt;
       jitter->interp_requested = -opt;
+      jitter->stats.inserted += -opt;
       /*fprintf (stderr, "Decision to interpolate %d samples\n", -opt);*/
    } else if (opt > 0)
    {
       shift_timings(jitter, -opt);
       jitter->pointer_timestamp += opt;
+      jitter->stats.dropped += opt;
       /*fprintf (stderr, "Decision to drop %d samples\n", opt);*/
    }
    
@@ -765,6 +1260,9 @@ EXPORT int jitter_buffer_get_pointer_timestamp(JitterBuffer *jitter)
 
 EXPORT void jitter_buffer_tick(JitterBuffer *jitter)
 {
+   /* Packets that arrived before this tick are stamped with the current time */
+   drain_inbox(jitter);
+   
    /* Automatically-adjust the buffering delay if requested */
    if (jitter->auto_adjust)
       _jitter_buffer_update_delay(jitter, NULL, NULL);
@@ -804,6 +1302,7 @@ EXPORT int jitter_buffer_ctl(JitterBuffer *jitter, int request, void *ptr)
          *(spx_int32_t*)ptr = jitter->buffer_margin;
          break;
       case JITTER_BUFFER_GET_AVALIABLE_COUNT:
+         drain_inbox(jitter);
          count = 0;
          for (i=0;i<SPEEX_JITTER_MAX_BUFFER_SIZE;i++)
          {
@@ -822,6 +1321,7 @@ EXPORT int jitter_buffer_ctl(JitterBuffer *jitter, int request, void *ptr)
          break;
       case JITTER_BUFFER_SET_DELAY_STEP:
          jitter->delay_step = *(spx_int32_t*)ptr;
+         jitter->opt_valid = 0;
          break;
       case JITTER_BUFFER_GET_DELAY_STEP:
          *(spx_int32_t*)ptr = jitter->delay_step;
@@ -836,16 +1336,84 @@ EXPORT int jitter_buffer_ctl(JitterBuffer *jitter, int request, void *ptr)
          jitter->max_late_rate = *(spx_int32_t*)ptr;
          jitter->window_size = 100*TOP_DELAY/jitter->max_late_rate;
          jitter->subwindow_size = jitter->window_size/MAX_BUFFERS;
+         jitter->opt_valid = 0;
          break;
       case JITTER_BUFFER_GET_MAX_LATE_RATE:
          *(spx_int32_t*)ptr = jitter->max_late_rate;
          break;
       case JITTER_BUFFER_SET_LATE_COST:
          jitter->latency_tradeoff = *(spx_int32_t*)ptr;
+         jitter->opt_valid = 0;
          break;
       case JITTER_BUFFER_GET_LATE_COST:
          *(spx_int32_t*)ptr = jitter->latency_tradeoff;
          break;
+      case JITTER_BUFFER_SET_SHORT_TERM_WINDOW:
+         jitter->short_window = *(spx_int32_t*)ptr;
+         if (jitter->short_window < 1 || jitter->short_window > MAX_SHORT_TERM)
+         {
+            speex_warning_int("Short-term window out of range, clamping. Value is ", jitter->short_window);
+            jitter->short_window = jitter->short_window < 1 ? 1 : MAX_SHORT_TERM;
+         }
+         jitter->opt_valid = 0;
+         break;
+      case JITTER_BUFFER_GET_SHORT_TERM_WINDOW:
+         *(spx_int32_t*)ptr = jitter->short_window;
+         break;
+      case JITTER_BUFFER_SET_SHORT_TERM_WEIGHT:
+         jitter->short_weight = *(spx_int32_t*)ptr;
+         if (jitter->short_weight < 0 || jitter->short_weight > 100)
+         {
+            speex_warning_int("Short-term weight out of range, clamping. Value is ", jitter->short_weight);
+            jitter->short_weight = jitter->short_weight < 0 ? 0 : 100;
+         }
+         jitter->opt_valid = 0;
+         break;
+      case JITTER_BUFFER_GET_SHORT_TERM_WEIGHT:
+         *(spx_int32_t*)ptr = jitter->short_weight;
+         break;
+      case JITTER_BUFFER_GET_STATS:
+         jitter->stats.drift = (spx_int32_t)(jitter->stats.dropped - jitter->stats.inserted);
+         jitter->stats.jitter = jitter->jitter_q4>>4;
+         jitter->stats.buffer_delay = 0;
+         if (jitter->packet_count > 0 && GT32(jitter->newest_end, jitter->pointer_timestamp))
+            jitter->stats.buffer_delay = TSUB(jitter->newest_end, jitter->pointer_timestamp);
+         jitter->stats.stored = jitter->packet_count;
+         *(JitterBufferStats*)ptr = jitter->stats;
+         break;
+      case JITTER_BUFFER_RESET_STATS:
+         SPEEX_MEMSET(&jitter->stats, 0, 1);
+         break;
+      case JITTER_BUFFER_SET_AUTO_ADJUST:
+         jitter->auto_adjust = *(spx_int32_t*)ptr != 0;
+         break;
+      case JITTER_BUFFER_GET_AUTO_ADJUST:
+         *(spx_int32_t*)ptr = jitter->auto_adjust;
+         break;
+      case JITTER_BUFFER_GET_OPT_DELAY:
+         *(spx_int32_t*)ptr = compute_opt_delay(jitter);
+         break;
+      case JITTER_BUFFER_ADJUST_DELAY:
+         /* The application changed the buffering itself (e.g. by time-stretching), the timings 
+            now look that much earlier or later, just like after a drop or an insertion */
+         if (*(spx_int32_t*)ptr != 0)
+         {
+            spx_int32_t amount = *(spx_int32_t*)ptr;
+            if (amount > 32767)
+               amount = 32767;
+            if (amount < -32767)
+               amount = -32767;
+            shift_timings(jitter, -amount);
+         }
+         break;
+      case JITTER_BUFFER_SET_TRACE:
+#ifdef JITTER_BUFFER_TRACE
+         jitter->trace = *(JitterBufferTrace*)ptr;
+         break;
+#else
+         speex_warning("jitter buffer built without JITTER_BUFFER_TRACE, tracing is not available");
+         return -1;
+#endif
       default:
          speex_warning_int("Unknown jitter_buffer_ctl request: ", request);
          return -1;
@@ -853,3 +1421,170 @@ EXPORT int jitter_buffer_ctl(JitterBuffer *jitter, int request, void *ptr)
    return 0;
 }
 
+
+
+/* Multi-stream manager: the scalars touched by every tick live in arrays (one entry per stream) 
+   instead of in each JitterBuffer, so ticking thousands of streams streams through a few 
+   contiguous arrays. The copy in the JitterBuffer is only up to date while one of the per-stream 
+   calls below is running. */
+struct JitterManager_ {
+   int nb_streams;                     /**< Number of streams added so far */
+   int max_streams;                    /**< Size of the arrays */
+   JitterBuffer **streams;             /**< Per-stream state (everything but the hot scalars) */
+   spx_uint32_t *pointer_timestamp;    /**< Hot copy of JitterBuffer::pointer_timestamp */
+   spx_uint32_t *next_stop;            /**< Hot copy of JitterBuffer::next_stop */
+   spx_int32_t *buffered;              /**< Hot copy of JitterBuffer::buffered */
+   int *lost_count;                    /**< Hot copy of JitterBuffer::lost_count */
+   unsigned char *settled;             /**< True if the next delay update is known to do nothing */
+   unsigned char *auto_adjust;         /**< Copy of JitterBuffer::auto_adjust */
+};
+
+/** True if the next compute_opt_delay() is a cache hit returning 0 (same test as at its top), 
+    in which case a delay update does nothing at all */
+static int delay_settled(JitterBuffer *jitter)
+{
+   return jitter->opt_valid && jitter->opt == 0 && 
+          (jitter->latency_tradeoff != 0 || jitter->opt_tradeoff == jitter->auto_tradeoff);
+}
+
+static void manager_load(JitterManager *mgr, int s)
+{
+   JitterBuffer *jitter = mgr->streams[s];
+   jitter->pointer_timestamp = mgr->pointer_timestamp[s];
+   jitter->next_stop = mgr->next_stop[s];
+   jitter->buffered = mgr->buffered[s];
+   jitter->lost_count = mgr->lost_count[s];
+}
+
+static void manager_store(JitterManager *mgr, int s)
+{
+   JitterBuffer *jitter = mgr->streams[s];
+   mgr->pointer_timestamp[s] = jitter->pointer_timestamp;
+   mgr->next_stop[s] = jitter->next_stop;
+   mgr->buffered[s] = jitter->buffered;
+   mgr->lost_count[s] = jitter->lost_count;
+   mgr->auto_adjust[s] = jitter->auto_adjust;
+   mgr->settled[s] = delay_settled(jitter);
+}
+
+EXPORT JitterManager *jitter_manager_init(int max_streams)
+{
+   JitterManager *mgr = (JitterManager*)speex_alloc(sizeof(JitterManager));
+   if (mgr)
+   {
+      mgr->nb_streams = 0;
+      mgr->max_streams = max_streams;
+      mgr->streams = (JitterBuffer**)speex_alloc(max_streams*sizeof(JitterBuffer*));
+      mgr->pointer_timestamp = (spx_uint32_t*)speex_alloc(max_streams*sizeof(spx_uint32_t));
+      mgr->next_stop = (spx_uint32_t*)speex_alloc(max_streams*sizeof(spx_uint32_t));
+      mgr->buffered = (spx_int32_t*)speex_alloc(max_streams*sizeof(spx_int32_t));
+      mgr->lost_count = (int*)speex_alloc(max_streams*sizeof(int));
+      mgr->settled = (unsigned char*)speex_alloc(max_streams);
+      mgr->auto_adjust = (unsigned char*)speex_alloc(max_streams);
+   }
+   return mgr;
+}
+
+EXPORT void jitter_manager_destroy(JitterManager *mgr)
+{
+   int s;
+   for (s=0;s<mgr->nb_streams;s++)
+      jitter_buffer_destroy(mgr->streams[s]);
+   speex_free(mgr->streams);
+   speex_free(mgr->pointer_timestamp);
+   speex_free(mgr->next_stop);
+   speex_free(mgr->buffered);
+   speex_free(mgr->lost_count);
+   speex_free(mgr->settled);
+   speex_free(mgr->auto_adjust);
+   speex_free(mgr);
+}
+
+EXPORT int jitter_manager_add_stream(JitterManager *mgr, int step_size)
+{
+   int s = mgr->nb_streams;
+   if (s == mgr->max_streams)
+      return -1;
+   mgr->streams[s] = jitter_buffer_init(step_size);
+   if (!mgr->streams[s])
+      return -1;
+   mgr->nb_streams++;
+   manager_store(mgr, s);
+   return s;
+}
+
+EXPORT void jitter_manager_put(JitterManager *mgr, int stream, const JitterBufferPacket *packet)
+{
+   manager_load(mgr, stream);
+   jitter_buffer_put(mgr->streams[stream], packet);
+   manager_store(mgr, stream);
+}
+
+EXPORT void jitter_manager_put_many(JitterManager *mgr, int stream, const JitterBufferPacket *packets, int nb_packets)
+{
+   manager_load(mgr, stream);
+   jitter_buffer_put_many(mgr->streams[stream], packets, nb_packets);
+   manager_store(mgr, stream);
+}
+
+EXPORT int jitter_manager_get(JitterManager *mgr, int stream, JitterBufferPacket *packet, spx_int32_t desired_span, spx_int32_t *start_offset)
+{
+   int ret;
+   manager_load(mgr, stream);
+   ret = jitter_buffer_get(mgr->streams[stream], packet, desired_span, start_offset);
+   manager_store(mgr, stream);
+   return ret;
+}
+
+EXPORT int jitter_manager_get_another(JitterManager *mgr, int stream, JitterBufferPacket *packet)
+{
+   int ret;
+   manager_load(mgr, stream);
+   ret = jitter_buffer_get_another(mgr->streams[stream], packet);
+   manager_store(mgr, stream);
+   return ret;
+}
+
+EXPORT int jitter_manager_ctl(JitterManager *mgr, int stream, int request, void *ptr)
+{
+   int ret;
+   manager_load(mgr, stream);
+   ret = jitter_buffer_ctl(mgr->streams[stream], request, ptr);
+   manager_store(mgr, stream);
+   return ret;
+}
+
+EXPORT void jitter_manager_tick_all(JitterManager *mgr)
+{
+   int s;
+   int n = mgr->nb_streams;
+   int negative = 0;
+   spx_uint32_t *pointer_timestamp = mgr->pointer_timestamp;
+   spx_uint32_t *next_stop = mgr->next_stop;
+   spx_int32_t *buffered = mgr->buffered;
+   
+   /* Delay adjustment needs the per-stream timings, but a stream whose cached optimum is "no 
+      change" (typically a silent one) is skipped until new timings come in */
+   for (s=0;s<n;s++)
+   {
+      JitterBuffer *jitter;
+      if (!mgr->auto_adjust[s] || mgr->settled[s])
+         continue;
+      jitter = mgr->streams[s];
+      jitter->pointer_timestamp = pointer_timestamp[s];
+      jitter->next_stop = next_stop[s];
+      _jitter_buffer_update_delay(jitter, NULL, NULL);
+      pointer_timestamp[s] = jitter->pointer_timestamp;
+      mgr->settled[s] = delay_settled(jitter);
+   }
+   
+   for (s=0;s<n;s++)
+   {
+      spx_int32_t b = buffered[s];
+      negative += b < 0;
+      next_stop[s] = pointer_timestamp[s] - (b > 0 ? b : 0);
+      buffered[s] = 0;
+   }
+   if (negative)
+      speex_warning_int("jitter manager sees negative buffering, your code might be broken. Streams affected: ", negative);
+}
@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <speex/speex_jitter.h>
+
+// Replays a recorded packet arrival trace through the jitter buffer on a simulated clock and
+// reports how late packets were and how much delay the buffer added.
+//
+// Trace formats:
+//   CSV:    one packet per line, "timestamp,seq,arrival_us,size" (lines starting with '#' or a
+//           letter are skipped, so a header line is fine)
+//   binary: "JBTR" followed by little-endian records of
+//           uint32 timestamp, uint16 seq, uint16 size, uint64 arrival_us
+// -o writes the loaded trace in the binary format.
+
+#define MAX_PAYLOAD 65536
+
+typedef struct {
+    uint32_t timestamp;
+    uint16_t seq;
+    uint16_t size;
+    uint64_t arrival;   // microseconds
+} TracePacket;
+
+static char payload[MAX_PAYLOAD];
+static char output[MAX_PAYLOAD];
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [options] trace.{csv,bin}\n", prog);
+    fprintf(stderr, "  -r rate       Timestamp rate in Hz (default 48000)\n");
+    fprintf(stderr, "  -f ms         Frame duration, also the playout tick (default 20)\n");
+    fprintf(stderr, "  -s step       JITTER_BUFFER_SET_DELAY_STEP in timestamp units (default one frame)\n");
+    fprintf(stderr, "  -c cost       JITTER_BUFFER_SET_LATE_COST\n");
+    fprintf(stderr, "  -m percent    JITTER_BUFFER_SET_MAX_LATE_RATE\n");
+    fprintf(stderr, "  -o file       Write the trace in binary format\n");
+}
+
+static uint16_t get16(const unsigned char *p) {
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t get32(const unsigned char *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void put16(unsigned char *p, uint16_t v) {
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+}
+
+static void put32(unsigned char *p, uint32_t v) {
+    put16(p, v & 0xffff);
+    put16(p + 2, v >> 16);
+}
+
+// Loads a trace, returns the number of packets (-1 on error)
+static long loadTrace(const char *path, TracePacket **trace) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        perror(path);
+        return -1;
+    }
+
+    long count = 0, capacity = 1024;
+    TracePacket *packets = (TracePacket*)malloc(capacity * sizeof(TracePacket));
+    unsigned char magic[4];
+    size_t got = fread(magic, 1, 4, file);
+
+    if (got == 4 && memcmp(magic, "JBTR", 4) == 0) {
+        unsigned char record[16];
+        while (fread(record, 1, sizeof(record), file) == sizeof(record)) {
+            if (count == capacity) {
+                capacity *= 2;
+                packets = (TracePacket*)realloc(packets, capacity * sizeof(TracePacket));
+            }
+            packets[count].timestamp = get32(record);
+            packets[count].seq = get16(record + 4);
+            packets[count].size = get16(record + 6);
+            packets[count].arrival = get32(record + 8) | (uint64_t)get32(record + 12) << 32;
+            count++;
+        }
+    } else {
+        char line[256];
+        rewind(file);
+        while (fgets(line, sizeof(line), file)) {
+            unsigned long timestamp, seq, size;
+            unsigned long long arrival;
+            if (sscanf(line, "%lu,%lu,%llu,%lu", &timestamp, &seq, &arrival, &size) != 4)
+                continue;
+            if (count == capacity) {
+                capacity *= 2;
+                packets = (TracePacket*)realloc(packets, capacity * sizeof(TracePacket));
+            }
+            packets[count].timestamp = (uint32_t)timestamp;
+            packets[count].seq = (uint16_t)seq;
+            packets[count].size = (uint16_t)(size < MAX_PAYLOAD ? size : MAX_PAYLOAD - 1);
+            packets[count].arrival = arrival;
+            count++;
+        }
+    }
+    fclose(file);
+    *trace = packets;
+    return count;
+}
+
+static int saveTrace(const char *path, const TracePacket *packets, long count) {
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        perror(path);
+        return -1;
+    }
+    fwrite("JBTR", 1, 4, file);
+    for (long i = 0; i < count; i++) {
+        unsigned char record[16];
+        put32(record, packets[i].timestamp);
+        put16(record + 4, packets[i].seq);
+        put16(record + 6, packets[i].size);
+        put32(record + 8, (uint32_t)packets[i].arrival);
+        put32(record + 12, (uint32_t)(packets[i].arrival >> 32));
+        fwrite(record, 1, sizeof(record), file);
+    }
+    fclose(file);
+    return 0;
+}
+
+static int compareArrival(const void *a, const void *b) {
+    const TracePacket *pa = (const TracePacket*)a;
+    const TracePacket *pb = (const TracePacket*)b;
+    return (pa->arrival > pb->arrival) - (pa->arrival < pb->arrival);
+}
+
+static int compareInt(const void *a, const void *b) {
+    return (*(const int*)a > *(const int*)b) - (*(const int*)a < *(const int*)b);
+}
+
+static double cpuNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(int argc, char **argv) {
+    int rate = 48000;
+    int frameMs = 20;
+    int delayStep = -1, lateCost = -1, maxLateRate = -1;
+    const char *outPath = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:f:s:c:m:o:h")) != -1) {
+        switch (opt) {
+            case 'r': rate = atoi(optarg); break;
+            case 'f': frameMs = atoi(optarg); break;
+            case 's': delayStep = atoi(optarg); break;
+            case 'c': lateCost = atoi(optarg); break;
+            case 'm': maxLateRate = atoi(optarg); break;
+            case 'o': outPath = optarg; break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind >= argc || rate <= 0 || frameMs <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    TracePacket *trace;
+    long count = loadTrace(argv[optind], &trace);
+    if (count < 0)
+        return 1;
+    if (count == 0) {
+        fprintf(stderr, "No packets in %s\n", argv[optind]);
+        return 1;
+    }
+    if (outPath && saveTrace(outPath, trace, count) < 0)
+        return 1;
+    qsort(trace, count, sizeof(TracePacket), compareArrival);
+
+    spx_int32_t frameSpan = (spx_int32_t)((long long)rate * frameMs / 1000);
+    JitterBuffer *jitter = jitter_buffer_init(delayStep > 0 ? delayStep : frameSpan);
+    if (lateCost >= 0)
+        jitter_buffer_ctl(jitter, JITTER_BUFFER_SET_LATE_COST, &lateCost);
+    if (maxLateRate >= 0)
+        jitter_buffer_ctl(jitter, JITTER_BUFFER_SET_MAX_LATE_RATE, &maxLateRate);
+
+    // Delay added by the buffer for each packet played (arrival to playout, in us)
+    int *addedDelay = (int*)malloc(count * sizeof(int));
+    long played = 0, missing = 0, inserted = 0;
+    double cpu = 0;
+    JitterBufferPacket *batch = (JitterBufferPacket*)malloc(count * sizeof(JitterBufferPacket));
+    uint64_t tickUs = (uint64_t)frameMs * 1000;
+    uint64_t now = trace[0].arrival;
+    long next = 0;
+    // End of the newest packet put so far: once the playout pointer is past it, whatever is
+    // still stored (duplicates, packets that came in just too late) can never be played
+    spx_uint32_t newestEnd = trace[0].timestamp + frameSpan;
+    JitterBufferStats stats;
+
+    for (;;) {
+        // Everything that arrived during this tick goes in as one batch
+        int n = 0;
+        while (next < count && trace[next].arrival <= now) {
+            batch[n].data = payload;
+            batch[n].len = trace[next].size;
+            batch[n].timestamp = trace[next].timestamp;
+            batch[n].span = frameSpan;
+            batch[n].sequence = trace[next].seq;
+            batch[n].user_data = (spx_uint32_t)next;
+            if ((spx_int32_t)(trace[next].timestamp + frameSpan - newestEnd) > 0)
+                newestEnd = trace[next].timestamp + frameSpan;
+            n++;
+            next++;
+        }
+
+        JitterBufferPacket packet;
+        packet.data = output;
+        packet.len = MAX_PAYLOAD;
+        double start = cpuNs();
+        if (n)
+            jitter_buffer_put_many(jitter, batch, n);
+        int ret = jitter_buffer_get(jitter, &packet, frameSpan, NULL);
+        jitter_buffer_tick(jitter);
+        cpu += cpuNs() - start;
+
+        if (ret == JITTER_BUFFER_OK)
+            addedDelay[played++] = (int)(now - trace[packet.user_data].arrival);
+        else if (ret == JITTER_BUFFER_INSERTION)
+            inserted++;
+        else if (next < count)
+            missing++;
+
+        jitter_buffer_ctl(jitter, JITTER_BUFFER_GET_STATS, &stats);
+        if (next == count && (stats.stored == 0 ||
+            (spx_int32_t)((spx_uint32_t)jitter_buffer_get_pointer_timestamp(jitter) - newestEnd) >= 0))
+            break;
+        now += tickUs;
+    }
+
+    qsort(addedDelay, played, sizeof(int), compareInt);
+    printf("packets            %ld\n", count);
+    printf("played             %ld (%.2f%%)\n", played, 100.0 * played / count);
+    printf("late               %u (%.2f%%), %u discarded\n", stats.late, 100.0 * stats.late / count, stats.discarded);
+    printf("concealed ticks    %ld missing, %ld insertions\n", missing, inserted);
+    if (played) {
+        printf("added delay (ms)   p50 %.1f  p90 %.1f  p95 %.1f  p99 %.1f  max %.1f\n",
+               addedDelay[played / 2] / 1000.0, addedDelay[played * 90 / 100] / 1000.0,
+               addedDelay[played * 95 / 100] / 1000.0, addedDelay[played * 99 / 100] / 1000.0,
+               addedDelay[played - 1] / 1000.0);
+    }
+    printf("cpu per packet     %.0f ns\n", cpu / count);
+
+    free(batch);
+    free(addedDelay);
+    free(trace);
+    jitter_buffer_destroy(jitter);
+    return 0;
+}
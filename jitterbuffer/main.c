@@ -8,6 +8,17 @@
 unsigned int next_count = 0;
 unsigned int current_get_count = 0;
 
+#ifdef JITTER_BUFFER_TRACE
+static void printTrace(const JitterBufferTraceEvent *event, void *arg) {
+    static const char *names[] = {"timing", "rotate", "opt_delay", "adjust", "loss", "reset"};
+    (void)arg;
+    if (event->type == JITTER_BUFFER_TRACE_TIMING)
+        return;
+    printf("trace %s: pointer %u next_stop %u a %d b %d c %d\n", names[event->type],
+           event->pointer_timestamp, event->next_stop, event->a, event->b, event->c);
+}
+#endif
+
 void putBunchOfData(JitterBuffer *jitter, int n) {
     JitterBufferPacket jitter_packet2;
     int output;
@@ -82,6 +93,11 @@ int main() {
     JitterBuffer *jitter = jitter_buffer_init(20);   //this delay_step can make jump harder for larger value
     int num = 100;
 
+#ifdef JITTER_BUFFER_TRACE
+    JitterBufferTrace trace = {printTrace, NULL};
+    jitter_buffer_ctl(jitter, JITTER_BUFFER_SET_TRACE, &trace);
+#endif
+
     //set JITTER_BUFFER_SET_LATE_COST
     //int late_cost = 930000;
     //jitter_buffer_ctl(jitter, JITTER_BUFFER_SET_LATE_COST, &late_cost);
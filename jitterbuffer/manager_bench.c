@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <speex/speex_jitter.h>
+
+// Ticks many streams with jitter_manager_tick_all() and with one jitter_buffer_tick() per
+// stream, and reports the cost of the tick phase in ns per stream-tick.
+// Usage: JitterManagerBench [streams] [ticks] [percent of streams talking]
+
+#define STEP 20
+
+static double nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Arrival offset (in ticks) of the packet sent at tick t on stream s: a cheap hash so both runs
+// see exactly the same traffic
+static int arrivalDelay(int s, int t) {
+    unsigned int h = (unsigned int)s * 2654435761u ^ (unsigned int)t * 40503u;
+    h ^= h >> 13;
+    return (h % 100) < 10 ? 1 : 0;
+}
+
+static int isTalking(int s, int talking) {
+    return (s % 100) < talking;
+}
+
+int main(int argc, char **argv) {
+    int streams = argc > 1 ? atoi(argv[1]) : 10000;
+    int ticks = argc > 2 ? atoi(argv[2]) : 500;
+    int talking = argc > 3 ? atoi(argv[3]) : 20;
+    char buf[16];
+    double managerNs = 0, plainNs = 0;
+
+    JitterManager *mgr = jitter_manager_init(streams);
+    JitterBuffer **plain = (JitterBuffer**)malloc(streams * sizeof(JitterBuffer*));
+    for (int s = 0; s < streams; s++) {
+        jitter_manager_add_stream(mgr, STEP);
+        plain[s] = jitter_buffer_init(STEP);
+    }
+
+    for (int t = 0; t < ticks; t++) {
+        // Network and playout, not timed
+        for (int s = 0; s < streams; s++) {
+            if (!isTalking(s, talking))
+                continue;
+            for (int k = t - 1; k <= t; k++) {
+                if (k < 0 || k + arrivalDelay(s, k) != t)
+                    continue;
+                int v = k;
+                JitterBufferPacket packet;
+                packet.data = (char*)&v;
+                packet.len = sizeof(v);
+                packet.timestamp = k * STEP;
+                packet.span = STEP;
+                packet.sequence = k;
+                packet.user_data = 0;
+                jitter_manager_put(mgr, s, &packet);
+                jitter_buffer_put(plain[s], &packet);
+            }
+        }
+        for (int s = 0; s < streams; s++) {
+            JitterBufferPacket out;
+            out.data = buf;
+            out.len = sizeof(buf);
+            jitter_manager_get(mgr, s, &out, STEP, NULL);
+            out.len = sizeof(buf);
+            jitter_buffer_get(plain[s], &out, STEP, NULL);
+        }
+
+        double start = nowNs();
+        jitter_manager_tick_all(mgr);
+        double middle = nowNs();
+        for (int s = 0; s < streams; s++)
+            jitter_buffer_tick(plain[s]);
+        double end = nowNs();
+        managerNs += middle - start;
+        plainNs += end - middle;
+    }
+
+    printf("%d streams, %d ticks, %d%% talking\n", streams, ticks, talking);
+    printf("jitter_manager_tick_all: %.1f ns per stream-tick\n", managerNs / ((double)streams * ticks));
+    printf("jitter_buffer_tick:      %.1f ns per stream-tick\n", plainNs / ((double)streams * ticks));
+
+    for (int s = 0; s < streams; s++)
+        jitter_buffer_destroy(plain[s]);
+    free(plain);
+    jitter_manager_destroy(mgr);
+    return 0;
+}
@@ -0,0 +1,928 @@
+/* Copyright (C) 2003 Epic Games (written by Jean-Marc Valin)
+   Copyright (C) 2004-2006 Epic Games
+
+   File: preprocess.c
+   Preprocessor with denoising based on the algorithm by Ephraim and Malah
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are
+   met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+
+   3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+   IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+   OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+   INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+   STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+   POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/*
+
+   Recommended papers:
+
+   Y. Ephraim and D. Malah, "Speech enhancement using minimum mean-square error
+   short-time spectral amplitude estimator". IEEE Transactions on Acoustics,
+   Speech and Signal Processing, vol. ASSP-32, no. 6, pp. 1109-1121, 1984.
+
+   Y. Ephraim and D. Malah, "Speech enhancement using minimum mean-square error
+   log-spectral amplitude estimator". IEEE Transactions on Acoustics, Speech and
+   Signal Processing, vol. ASSP-33, no. 2, pp. 443-445, 1985.
+
+   I. Cohen and B. Berdugo, "Speech enhancement for non-stationary noise environments".
+   Signal Processing, vol. 81, no. 2, pp. 2403-2418, 2001.
+
+   Stefan Gustafsson, Rainer Martin, Peter Jax, and Peter Vary. "A psychoacoustic
+   approach to combined acoustic echo cancellation and noise reduction". IEEE
+   Transactions on Speech and Audio Processing, 2002.
+
+   J.-M. Valin, J. Rouat, and F. Michaud, "Microphone array post-filter for separation
+   of simultaneous non-stationary sources". In Proceedings IEEE International
+   Conference on Acoustics, Speech, and Signal Processing, 2004.
+
+   Only the floating-point build is supported here, like the resampler. There
+   is no echo canceller in this tree either: SPEEX_PREPROCESS_SET_ECHO_STATE
+   only stores the pointer and the residual echo estimate stays at zero.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include <speex/config.h>
+#endif
+
+#include <math.h>
+#include <speex/speex_preprocess.h>
+#include <speex/speex_echo.h>
+#include <speex/arch.h>
+#include <speex/fftwrap.h>
+#include <speex/filterbank.h>
+#include <speex/math_approx.h>
+#include <speex/os_support.h>
+
+#ifndef NULL
+#define NULL 0
+#endif
+
+#ifdef FIXED_POINT
+#error The preprocessor is only available in the floating-point build
+#endif
+
+#define LOUDNESS_EXP 5.f
+#define AMP_SCALE .001f
+#define AMP_SCALE_1 1000.f
+
+#define NB_BANDS 24
+
+#define SPEECH_PROB_START_DEFAULT       .35f
+#define SPEECH_PROB_CONTINUE_DEFAULT    .20f
+#define NOISE_SUPPRESS_DEFAULT       -15
+#define ECHO_SUPPRESS_DEFAULT        -40
+#define ECHO_SUPPRESS_ACTIVE_DEFAULT -15
+
+#define SQR(x) ((x)*(x))
+
+#define WORD2INT(x) ((x) < -32767.5f ? -32768 : ((x) > 32766.5f ? 32767 : (spx_int16_t)floor(.5+(x))))
+
+/** Speex pre-processor state. */
+struct SpeexPreprocessState_ {
+   /* Basic info */
+   int    frame_size;        /**< Number of samples processed each time */
+   int    ps_size;           /**< Number of points in the power spectrum */
+   int    sampling_rate;     /**< Sampling rate of the input/output */
+   int    nbands;
+   FilterBank *bank;
+
+   /* Parameters */
+   int    denoise_enabled;
+   int    vad_enabled;
+   int    dereverb_enabled;
+   float  reverb_decay;
+   float  reverb_level;
+   float  speech_prob_start;
+   float  speech_prob_continue;
+   int    noise_suppress;
+   int    echo_suppress;
+   int    echo_suppress_active;
+   SpeexEchoState *echo_state;
+
+   float  speech_prob;       /**< Probability last frame was speech */
+
+   /* DSP-related arrays */
+   float *frame;             /**< Processing frame (2*ps_size) */
+   float *ft;                /**< Processing frame in freq domain (2*ps_size) */
+   float *ps;                /**< Current power spectrum */
+   float *gain2;             /**< Adjusted gains */
+   float *gain_floor;        /**< Minimum gain allowed */
+   float *window;            /**< Analysis/Synthesis window */
+   float *noise;             /**< Noise estimate */
+   float *reverb_estimate;   /**< Estimate of reverb energy */
+   float *old_ps;            /**< Power spectrum for last frame */
+   float *gain;              /**< Ephraim Malah gain */
+   float *prior;             /**< A-priori SNR */
+   float *post;              /**< A-posteriori SNR */
+
+   float *S;                 /**< Smoothed power spectrum */
+   float *Smin;              /**< See Cohen paper */
+   float *Stmp;              /**< See Cohen paper */
+   int   *update_prob;       /**< Probability of speech presence for noise update */
+
+   float *zeta;              /**< Smoothed a priori SNR */
+   float *echo_noise;
+
+   /* Misc */
+   float *inbuf;             /**< Input buffer (overlapped analysis) */
+   float *outbuf;            /**< Output buffer (for overlap and add) */
+
+   /* AGC stuff */
+   int    agc_enabled;
+   float  agc_level;
+   float  loudness_accum;
+   float *loudness_weight;   /**< Perceptual loudness curve */
+   float  loudness;          /**< Loudness estimate */
+   float  agc_gain;          /**< Current AGC gain */
+   float  max_gain;          /**< Maximum gain allowed */
+   float  max_increase_step; /**< Maximum increase in gain from one frame to another */
+   float  max_decrease_step; /**< Maximum decrease in gain from one frame to another */
+   float  prev_loudness;     /**< Loudness of previous frame */
+   float  init_max;          /**< Current gain limit during initialisation */
+
+   int    nb_adapt;          /**< Number of frames used for adaptation so far */
+   int    was_speech;
+   int    min_count;         /**< Number of frames processed so far */
+   void  *fft_lookup;        /**< Lookup table for the FFT */
+};
+
+
+/* Power-complementary window: w[i]^2 + w[i+len/2]^2 = 1, so analysis and
+   synthesis with the same window and 50% overlap add back to the input */
+static void conj_window(float *w, int len)
+{
+   int i;
+   for (i=0;i<len;i++)
+   {
+      float tmp;
+      float x = 4.f*i/len;
+      int inv=0;
+      if (x<1.f)
+      {
+      } else if (x<2.f)
+      {
+         x=2.f-x;
+         inv=1;
+      } else if (x<3.f)
+      {
+         x=x-2.f;
+         inv=1;
+      } else {
+         x=4.f-x;
+      }
+      x = 1.271903f*x;
+      tmp = SQR(.5f-.5f*spx_cos_norm(x));
+      if (inv)
+         tmp=1.f-tmp;
+      w[i]=spx_sqrt(tmp);
+   }
+}
+
+/* This function approximates the gain function
+   y = gamma(1.25)^2 * M(-.25;1;-x) / sqrt(x)
+   which multiplied by xi/(1+xi) is the optimal gain
+   in the loudness domain ( sqrt[amplitude] )
+*/
+static inline float hypergeom_gain(float x)
+{
+   int ind;
+   float integer, frac;
+   static const float table[21] = {
+      0.82157f, 1.02017f, 1.20461f, 1.37534f, 1.53363f, 1.68092f, 1.81865f,
+      1.94811f, 2.07038f, 2.18638f, 2.29688f, 2.40255f, 2.50391f, 2.60144f,
+      2.69551f, 2.78647f, 2.87458f, 2.96015f, 3.04333f, 3.12431f, 3.20326f};
+   integer = floor(2*x);
+   ind = (int)integer;
+   if (ind<0)
+      return 1;
+   if (ind>19)
+      return 1+.1296/x;
+   frac = 2*x-integer;
+   return ((1-frac)*table[ind] + frac*table[ind+1])/sqrt(x+.0001f);
+}
+
+/* Maps an a priori SNR to a speech presence probability */
+static inline float qcurve(float x)
+{
+   return 1.f/(1.f+.15f/x);
+}
+
+static void compute_gain_floor(int noise_suppress, float effective_echo_suppress, float *noise, float *echo, float *gain_floor, int len)
+{
+   int i;
+   float echo_floor;
+   float noise_floor;
+
+   noise_floor = exp(.2302585f*noise_suppress);
+   echo_floor = exp(.2302585f*effective_echo_suppress);
+
+   /* Compute the gain floor based on different floors for the background noise and residual echo */
+   for (i=0;i<len;i++)
+      gain_floor[i] = sqrt(noise_floor*noise[i] + echo_floor*echo[i])/sqrt(1+noise[i] + echo[i]);
+}
+
+EXPORT SpeexPreprocessState *speex_preprocess_state_init(int frame_size, int sampling_rate)
+{
+   int i;
+   int N, N3, N4, M;
+
+   SpeexPreprocessState *st = (SpeexPreprocessState *)speex_alloc(sizeof(SpeexPreprocessState));
+   st->frame_size = frame_size;
+
+   /* The spectrum has as many points as the frame has samples: the FFT is
+      2*frame_size long and consecutive frames overlap by half */
+   st->ps_size = st->frame_size;
+
+   N = st->ps_size;
+   N3 = 2*N - st->frame_size;
+   N4 = st->frame_size - N3;
+
+   st->sampling_rate = sampling_rate;
+   st->denoise_enabled = 1;
+   st->vad_enabled = 0;
+   st->dereverb_enabled = 0;
+   st->reverb_decay = 0;
+   st->reverb_level = 0;
+   st->noise_suppress = NOISE_SUPPRESS_DEFAULT;
+   st->echo_suppress = ECHO_SUPPRESS_DEFAULT;
+   st->echo_suppress_active = ECHO_SUPPRESS_ACTIVE_DEFAULT;
+
+   st->speech_prob_start = SPEECH_PROB_START_DEFAULT;
+   st->speech_prob_continue = SPEECH_PROB_CONTINUE_DEFAULT;
+
+   st->echo_state = NULL;
+
+   st->nbands = NB_BANDS;
+   M = st->nbands;
+   st->bank = filterbank_new(M, sampling_rate, N, 1);
+
+   st->frame = (float*)speex_alloc(2*N*sizeof(float));
+   st->window = (float*)speex_alloc(2*N*sizeof(float));
+   st->ft = (float*)speex_alloc(2*N*sizeof(float));
+
+   /* The per-bin arrays are followed by one entry per Bark band */
+   st->ps = (float*)speex_alloc((N+M)*sizeof(float));
+   st->noise = (float*)speex_alloc((N+M)*sizeof(float));
+   st->echo_noise = (float*)speex_alloc((N+M)*sizeof(float));
+   st->reverb_estimate = (float*)speex_alloc((N+M)*sizeof(float));
+   st->old_ps = (float*)speex_alloc((N+M)*sizeof(float));
+   st->prior = (float*)speex_alloc((N+M)*sizeof(float));
+   st->post = (float*)speex_alloc((N+M)*sizeof(float));
+   st->gain = (float*)speex_alloc((N+M)*sizeof(float));
+   st->gain2 = (float*)speex_alloc((N+M)*sizeof(float));
+   st->gain_floor = (float*)speex_alloc((N+M)*sizeof(float));
+   st->zeta = (float*)speex_alloc((N+M)*sizeof(float));
+
+   st->S = (float*)speex_alloc(N*sizeof(float));
+   st->Smin = (float*)speex_alloc(N*sizeof(float));
+   st->Stmp = (float*)speex_alloc(N*sizeof(float));
+   st->update_prob = (int*)speex_alloc(N*sizeof(int));
+
+   st->inbuf = (float*)speex_alloc(N3*sizeof(float));
+   st->outbuf = (float*)speex_alloc(N3*sizeof(float));
+
+   conj_window(st->window, 2*N3);
+   for (i=2*N3;i<2*st->ps_size;i++)
+      st->window[i]=Q15_ONE;
+
+   if (N4>0)
+   {
+      for (i=N3-1;i>=0;i--)
+      {
+         st->window[i+N3+N4]=st->window[i+N3];
+         st->window[i+N3]=1;
+      }
+   }
+   for (i=0;i<N+M;i++)
+   {
+      st->noise[i]=1.f;
+      st->reverb_estimate[i]=0;
+      st->old_ps[i]=1;
+      st->gain[i]=Q15_ONE;
+      st->post[i]=1;
+      st->prior[i]=1;
+   }
+
+   for (i=0;i<N;i++)
+      st->update_prob[i] = 1;
+   for (i=0;i<N3;i++)
+   {
+      st->inbuf[i]=0;
+      st->outbuf[i]=0;
+   }
+
+   st->agc_enabled = 0;
+   st->agc_level = 8000;
+   st->loudness_weight = (float*)speex_alloc(N*sizeof(float));
+   for (i=0;i<N;i++)
+   {
+      float ff=((float)i)*.5*sampling_rate/((float)N);
+      st->loudness_weight[i] = .35f-.35f*ff/16000.f+.73f*exp(-.5f*(ff-3800)*(ff-3800)/9e5f);
+      if (st->loudness_weight[i]<.01f)
+         st->loudness_weight[i]=.01f;
+      st->loudness_weight[i] *= st->loudness_weight[i];
+   }
+   st->loudness = 1e-15;
+   st->agc_gain = 1;
+   st->max_gain = 30;
+   st->max_increase_step = exp(0.11513f * 12.*st->frame_size / st->sampling_rate);
+   st->max_decrease_step = exp(-0.11513f * 40.*st->frame_size / st->sampling_rate);
+   st->prev_loudness = 1;
+   st->init_max = 1;
+   st->was_speech = 0;
+
+   st->fft_lookup = spx_fft_init(2*N);
+
+   st->nb_adapt=0;
+   st->min_count=0;
+   return st;
+}
+
+EXPORT void speex_preprocess_state_destroy(SpeexPreprocessState *st)
+{
+   speex_free(st->frame);
+   speex_free(st->ft);
+   speex_free(st->ps);
+   speex_free(st->gain2);
+   speex_free(st->gain_floor);
+   speex_free(st->window);
+   speex_free(st->noise);
+   speex_free(st->reverb_estimate);
+   speex_free(st->old_ps);
+   speex_free(st->gain);
+   speex_free(st->prior);
+   speex_free(st->post);
+   speex_free(st->loudness_weight);
+   speex_free(st->echo_noise);
+
+   speex_free(st->S);
+   speex_free(st->Smin);
+   speex_free(st->Stmp);
+   speex_free(st->update_prob);
+   speex_free(st->zeta);
+
+   speex_free(st->inbuf);
+   speex_free(st->outbuf);
+
+   filterbank_destroy(st->bank);
+   spx_fft_destroy(st->fft_lookup);
+   speex_free(st);
+}
+
+static void speex_compute_agc(SpeexPreprocessState *st, float Pframe, float *ft)
+{
+   int i;
+   int N = st->ps_size;
+   float target_gain;
+   float loudness=1.f;
+   float rate;
+
+   for (i=2;i<N;i++)
+   {
+      loudness += 2.f*N*st->ps[i]* st->loudness_weight[i];
+   }
+   loudness=sqrt(loudness);
+   /* Only adapt the loudness estimate on frames that are likely speech */
+   if (Pframe>.3f)
+   {
+      rate = .03*Pframe*Pframe;
+      st->loudness = (1-rate)*st->loudness + (rate)*pow(AMP_SCALE*loudness, LOUDNESS_EXP);
+      st->loudness_accum = (1-rate)*st->loudness_accum + rate;
+      if (st->init_max < st->max_gain && st->nb_adapt > 20)
+         st->init_max *= 1.f + .1f*Pframe*Pframe;
+   }
+
+   target_gain = AMP_SCALE*st->agc_level*pow(st->loudness/(1e-4+st->loudness_accum), -1.0f/LOUDNESS_EXP);
+
+   if ((Pframe>.5  && st->nb_adapt > 20) || target_gain < st->agc_gain)
+   {
+      if (target_gain > st->max_increase_step*st->agc_gain)
+         target_gain = st->max_increase_step*st->agc_gain;
+      if (target_gain < st->max_decrease_step*st->agc_gain && loudness < 10*st->prev_loudness)
+         target_gain = st->max_decrease_step*st->agc_gain;
+      if (target_gain > st->max_gain)
+         target_gain = st->max_gain;
+      if (target_gain > st->init_max)
+         target_gain = st->init_max;
+
+      st->agc_gain = target_gain;
+   }
+
+   for (i=0;i<2*N;i++)
+      ft[i] *= st->agc_gain;
+   st->prev_loudness = loudness;
+}
+
+static void preprocess_analysis(SpeexPreprocessState *st, spx_int16_t *x)
+{
+   int i;
+   int N = st->ps_size;
+   int N3 = 2*N - st->frame_size;
+   int N4 = st->frame_size - N3;
+   float *ps=st->ps;
+
+   /* 'Build' input frame */
+   for (i=0;i<N3;i++)
+      st->frame[i]=st->inbuf[i];
+   for (i=0;i<st->frame_size;i++)
+      st->frame[N3+i]=x[i];
+
+   /* Update inbuf */
+   for (i=0;i<N3;i++)
+      st->inbuf[i]=x[N4+i];
+
+   /* Windowing */
+   for (i=0;i<2*N;i++)
+      st->frame[i] *= st->window[i];
+
+   /* Perform FFT */
+   spx_fft(st->fft_lookup, st->frame, st->ft);
+
+   /* Power spectrum */
+   ps[0]=SQR(st->ft[0]);
+   for (i=1;i<N;i++)
+      ps[i]=SQR(st->ft[2*i-1]) + SQR(st->ft[2*i]);
+
+   filterbank_compute_bank32(st->bank, ps, ps+N);
+}
+
+/* Minima-controlled noise tracking (Cohen): a bin is only allowed to update
+   the noise estimate when its smoothed power is close to the recent minimum */
+static void update_noise_prob(SpeexPreprocessState *st)
+{
+   int i;
+   int min_range;
+   int N = st->ps_size;
+
+   for (i=1;i<N-1;i++)
+      st->S[i] = .8f*st->S[i] + .05f*st->ps[i-1] + .1f*st->ps[i] + .05f*st->ps[i+1];
+   st->S[0] = .8f*st->S[0] + .2f*st->ps[0];
+   st->S[N-1] = .8f*st->S[N-1] + .2f*st->ps[N-1];
+
+   if (st->nb_adapt==1)
+   {
+      for (i=0;i<N;i++)
+         st->Smin[i] = st->Stmp[i] = 0;
+   }
+
+   if (st->nb_adapt < 100)
+      min_range = 15;
+   else if (st->nb_adapt < 1000)
+      min_range = 50;
+   else if (st->nb_adapt < 10000)
+      min_range = 150;
+   else
+      min_range = 300;
+   if (st->min_count > min_range)
+   {
+      st->min_count = 0;
+      for (i=0;i<N;i++)
+      {
+         st->Smin[i] = MIN32(st->Stmp[i], st->S[i]);
+         st->Stmp[i] = st->S[i];
+      }
+   } else {
+      for (i=0;i<N;i++)
+      {
+         st->Smin[i] = MIN32(st->Smin[i], st->S[i]);
+         st->Stmp[i] = MIN32(st->Stmp[i], st->S[i]);
+      }
+   }
+   for (i=0;i<N;i++)
+   {
+      if (.4f*st->S[i] > st->Smin[i])
+         st->update_prob[i] = 1;
+      else
+         st->update_prob[i] = 0;
+   }
+
+}
+
+EXPORT int speex_preprocess(SpeexPreprocessState *st, spx_int16_t *x, spx_int32_t *echo)
+{
+   (void)echo;
+   return speex_preprocess_run(st, x);
+}
+
+EXPORT int speex_preprocess_run(SpeexPreprocessState *st, spx_int16_t *x)
+{
+   int i;
+   int M;
+   int N = st->ps_size;
+   int N3 = 2*N - st->frame_size;
+   int N4 = st->frame_size - N3;
+   float *ps=st->ps;
+   float Zframe;
+   float Pframe;
+   float beta, beta_1;
+   float effective_echo_suppress;
+
+   st->nb_adapt++;
+   if (st->nb_adapt>20000)
+      st->nb_adapt = 20000;
+   st->min_count++;
+
+   beta = MAX16(.03f,1.f/st->nb_adapt);
+   beta_1 = Q15_ONE-beta;
+   M = st->nbands;
+   /* No residual echo: echo_noise is zero from init */
+
+   preprocess_analysis(st, x);
+
+   update_noise_prob(st);
+
+   /* Update the noise estimate for the frequencies where it can be */
+   for (i=0;i<N;i++)
+   {
+      if (!st->update_prob[i] || st->ps[i] < st->noise[i])
+         st->noise[i] = MAX32(0,beta_1*st->noise[i] + beta*st->ps[i]);
+   }
+   filterbank_compute_bank32(st->bank, st->noise, st->noise+N);
+
+   /* Special case for first frame */
+   if (st->nb_adapt==1)
+      for (i=0;i<N+M;i++)
+         st->old_ps[i] = ps[i];
+
+   /* Compute a posteriori SNR */
+   for (i=0;i<N+M;i++)
+   {
+      float gamma;
+
+      /* Total noise estimate including residual echo and reverberation */
+      float tot_noise = 1.f + st->noise[i] + st->echo_noise[i] + st->reverb_estimate[i];
+
+      /* A posteriori SNR = ps/noise - 1*/
+      st->post[i] = ps[i]/tot_noise - 1.f;
+      st->post[i]=MIN16(st->post[i], 100.f);
+
+      /* Computing update gamma = .1 + .9*(old/(old+noise))^2 */
+      gamma = .1f+.89f*SQR(st->old_ps[i]/(st->old_ps[i]+tot_noise));
+
+      /* A priori SNR update = gamma*max(0,post) + (1-gamma)*old/noise */
+      st->prior[i] = gamma*MAX16(0,st->post[i]) + (1.f-gamma)*(st->old_ps[i]/tot_noise);
+      st->prior[i]=MIN16(st->prior[i], 100.f);
+   }
+
+   /* Recursive average of the a priori SNR. A bit smoothed for the psd components */
+   st->zeta[0] = .7f*st->zeta[0] + .3f*st->prior[0];
+   for (i=1;i<N-1;i++)
+      st->zeta[i] = .7f*st->zeta[i] + .15f*st->prior[i] + .075f*st->prior[i-1] + .075f*st->prior[i+1];
+   for (i=N-1;i<N+M;i++)
+      st->zeta[i] = .7f*st->zeta[i] + .3f*st->prior[i];
+
+   /* Speech probability of presence for the entire frame is based on the average filterbank a priori SNR */
+   Zframe = 0;
+   for (i=N;i<N+M;i++)
+      Zframe += st->zeta[i];
+   Pframe = .1f+.899f*qcurve(Zframe/st->nbands);
+
+   effective_echo_suppress = (1.f-Pframe)*st->echo_suppress + Pframe*st->echo_suppress_active;
+
+   compute_gain_floor(st->noise_suppress, effective_echo_suppress, st->noise+N, st->echo_noise+N, st->gain_floor+N, M);
+
+   /* Compute Ephraim & Malah gain speech probability of presence for each critical band (Bark scale)
+      Technically this is actually wrong because the EM gaim assumes a slightly different probability
+      distribution */
+   for (i=N;i<N+M;i++)
+   {
+      /* See EM and Cohen papers*/
+      float theta;
+      /* Gain from hypergeometric function */
+      float MM;
+      /* Weiner filter gain */
+      float prior_ratio;
+      /* a priority probability of speech presence based on Bark sub-band alone */
+      float P1;
+      /* Speech absence a priori probability (considering sub-band and frame) */
+      float q;
+
+      prior_ratio = st->prior[i]/(st->prior[i]+1.f);
+      theta = prior_ratio*(1.f+st->post[i]);
+
+      MM = hypergeom_gain(theta);
+      /* Gain with bound */
+      st->gain[i] = MIN32(Q15_ONE, prior_ratio*MM);
+      /* Save old Bark power spectrum */
+      st->old_ps[i] = .2f*st->old_ps[i] + .8f*SQR(st->gain[i])*ps[i];
+
+      P1 = .199f+.8f*qcurve(st->zeta[i]);
+      q = Q15_ONE-Pframe*P1;
+      st->gain2[i]=1/(1.f + (q/(1.f-q))*(1+st->prior[i])*exp(-theta));
+   }
+   /* Convert the EM gains and speech prob to linear frequency */
+   filterbank_compute_psd16(st->bank,st->gain2+N, st->gain2);
+   filterbank_compute_psd16(st->bank,st->gain+N, st->gain);
+   filterbank_compute_psd16(st->bank,st->gain_floor+N, st->gain_floor);
+
+   /* Compute gain according to the Ephraim-Malah algorithm -- linear frequency */
+   for (i=0;i<N;i++)
+   {
+      float MM;
+      float theta;
+      float prior_ratio;
+      float tmp;
+      float p;
+      float g;
+
+      /* Wiener filter gain */
+      prior_ratio = st->prior[i]/(st->prior[i]+1.f);
+      theta = prior_ratio*(1.f+st->post[i]);
+
+      /* Optimal estimator for loudness domain */
+      MM = hypergeom_gain(theta);
+      /* EM gain with bound */
+      g = MIN32(Q15_ONE, prior_ratio*MM);
+      /* Interpolated speech probability of presence */
+      p = st->gain2[i];
+
+      /* Constrain the gain to be close to the Bark scale gain */
+      if (.333f*g > st->gain[i])
+         g = 3*st->gain[i];
+      st->gain[i] = g;
+
+      /* Save old power spectrum */
+      st->old_ps[i] = .2f*st->old_ps[i] + .8f*SQR(st->gain[i])*ps[i];
+
+      /* Apply gain floor */
+      if (st->gain[i] < st->gain_floor[i])
+         st->gain[i] = st->gain_floor[i];
+
+      /* Take into account speech probability of presence (loudness domain MMSE estimator) */
+      /* gain2 = [p*sqrt(gain)+(1-p)*sqrt(gain _floor) ]^2 */
+      tmp = p*spx_sqrt(st->gain[i]) + (1.f-p)*spx_sqrt(st->gain_floor[i]);
+      st->gain2[i]=SQR(tmp);
+   }
+
+   /* If noise suppression is off, don't apply the gain (the estimates are
+      still updated for the VAD and AGC) */
+   if (!st->denoise_enabled)
+   {
+      for (i=0;i<N+M;i++)
+         st->gain2[i]=Q15_ONE;
+   }
+
+   /* Apply computed gain */
+   for (i=1;i<N;i++)
+   {
+      st->ft[2*i-1] *= st->gain2[i];
+      st->ft[2*i] *= st->gain2[i];
+   }
+   st->ft[0] *= st->gain2[0];
+   st->ft[2*N-1] *= st->gain2[N-1];
+
+   if (st->agc_enabled)
+      speex_compute_agc(st, Pframe, st->ft);
+
+   /* Inverse FFT with 1/N scaling */
+   spx_ifft(st->fft_lookup, st->ft, st->frame);
+
+   if (st->agc_enabled)
+   {
+      float max_sample=0;
+      for (i=0;i<2*N;i++)
+         if (fabs(st->frame[i])>max_sample)
+            max_sample = fabs(st->frame[i]);
+      if (max_sample>28000.f)
+      {
+         float damp = 28000.f/max_sample;
+         for (i=0;i<2*N;i++)
+            st->frame[i] *= damp;
+      }
+   }
+
+   /* Synthesis window (for WOLA) */
+   for (i=0;i<2*N;i++)
+      st->frame[i] *= st->window[i];
+
+   /* Perform overlap and add */
+   for (i=0;i<N3;i++)
+      x[i] = WORD2INT(st->outbuf[i] + st->frame[i]);
+   for (i=0;i<N4;i++)
+      x[N3+i] = WORD2INT(st->frame[N3+i]);
+
+   /* Update outbuf */
+   for (i=0;i<N3;i++)
+      st->outbuf[i] = st->frame[st->frame_size+i];
+
+   /* The VAD is a hysteresis on the frame speech probability: it takes
+      prob_start to enter the speech state and prob_continue to stay there */
+   st->speech_prob = Pframe;
+   if (st->vad_enabled)
+   {
+      if (st->speech_prob > st->speech_prob_start || (st->was_speech && st->speech_prob > st->speech_prob_continue))
+      {
+         st->was_speech=1;
+         return 1;
+      } else
+      {
+         st->was_speech=0;
+         return 0;
+      }
+   } else {
+      return 1;
+   }
+}
+
+EXPORT void speex_preprocess_estimate_update(SpeexPreprocessState *st, spx_int16_t *x)
+{
+   int i;
+   int N = st->ps_size;
+   int N3 = 2*N - st->frame_size;
+   int M;
+   float *ps=st->ps;
+
+   M = st->nbands;
+   st->min_count++;
+
+   preprocess_analysis(st, x);
+
+   update_noise_prob(st);
+
+   for (i=1;i<N-1;i++)
+   {
+      if (!st->update_prob[i] || st->ps[i] < st->noise[i])
+      {
+         st->noise[i] = .95f*st->noise[i] + .05f*st->ps[i];
+      }
+   }
+
+   for (i=0;i<N3;i++)
+      st->outbuf[i] = x[st->frame_size-N3+i]*st->window[st->frame_size+i];
+
+   /* Save old power spectrum */
+   for (i=0;i<N+M;i++)
+      st->old_ps[i] = ps[i];
+
+   for (i=0;i<N;i++)
+      st->reverb_estimate[i] = st->reverb_decay*st->reverb_estimate[i];
+}
+
+
+EXPORT int speex_preprocess_ctl(SpeexPreprocessState *state, int request, void *ptr)
+{
+   int i;
+   SpeexPreprocessState *st;
+   st=(SpeexPreprocessState*)state;
+   switch(request)
+   {
+   case SPEEX_PREPROCESS_SET_DENOISE:
+      st->denoise_enabled = (*(spx_int32_t*)ptr);
+      break;
+   case SPEEX_PREPROCESS_GET_DENOISE:
+      (*(spx_int32_t*)ptr) = st->denoise_enabled;
+      break;
+   case SPEEX_PREPROCESS_SET_AGC:
+      st->agc_enabled = (*(spx_int32_t*)ptr);
+      break;
+   case SPEEX_PREPROCESS_GET_AGC:
+      (*(spx_int32_t*)ptr) = st->agc_enabled;
+      break;
+   case SPEEX_PREPROCESS_SET_AGC_LEVEL:
+      st->agc_level = (*(float*)ptr);
+      if (st->agc_level<1)
+         st->agc_level=1;
+      if (st->agc_level>32768)
+         st->agc_level=32768;
+      break;
+   case SPEEX_PREPROCESS_GET_AGC_LEVEL:
+      (*(float*)ptr) = st->agc_level;
+      break;
+   case SPEEX_PREPROCESS_SET_AGC_INCREMENT:
+      st->max_increase_step = exp(0.11513f * (*(spx_int32_t*)ptr)*st->frame_size / st->sampling_rate);
+      break;
+   case SPEEX_PREPROCESS_GET_AGC_INCREMENT:
+      (*(spx_int32_t*)ptr) = floor(.5+8.6858*log(st->max_increase_step)*st->sampling_rate/st->frame_size);
+      break;
+   case SPEEX_PREPROCESS_SET_AGC_DECREMENT:
+      st->max_decrease_step = exp(0.11513f * (*(spx_int32_t*)ptr)*st->frame_size / st->sampling_rate);
+      break;
+   case SPEEX_PREPROCESS_GET_AGC_DECREMENT:
+      (*(spx_int32_t*)ptr) = floor(.5+8.6858*log(st->max_decrease_step)*st->sampling_rate/st->frame_size);
+      break;
+   case SPEEX_PREPROCESS_SET_AGC_MAX_GAIN:
+      st->max_gain = exp(0.11513f * (*(spx_int32_t*)ptr));
+      break;
+   case SPEEX_PREPROCESS_GET_AGC_MAX_GAIN:
+      (*(spx_int32_t*)ptr) = floor(.5+8.6858*log(st->max_gain));
+      break;
+   case SPEEX_PREPROCESS_SET_VAD:
+      st->vad_enabled = (*(spx_int32_t*)ptr);
+      break;
+   case SPEEX_PREPROCESS_GET_VAD:
+      (*(spx_int32_t*)ptr) = st->vad_enabled;
+      break;
+
+   case SPEEX_PREPROCESS_SET_DEREVERB:
+      st->dereverb_enabled = (*(spx_int32_t*)ptr);
+      for (i=0;i<st->ps_size;i++)
+         st->reverb_estimate[i]=0;
+      break;
+   case SPEEX_PREPROCESS_GET_DEREVERB:
+      (*(spx_int32_t*)ptr) = st->dereverb_enabled;
+      break;
+
+   /* The reverb model is disabled, the level and decay are accepted and ignored */
+   case SPEEX_PREPROCESS_SET_DEREVERB_LEVEL:
+   case SPEEX_PREPROCESS_GET_DEREVERB_LEVEL:
+   case SPEEX_PREPROCESS_SET_DEREVERB_DECAY:
+   case SPEEX_PREPROCESS_GET_DEREVERB_DECAY:
+      break;
+
+   case SPEEX_PREPROCESS_SET_PROB_START:
+      *(spx_int32_t*)ptr = MIN32(100,MAX32(0, *(spx_int32_t*)ptr));
+      st->speech_prob_start = *(spx_int32_t*)ptr / 100.f;
+      break;
+   case SPEEX_PREPROCESS_GET_PROB_START:
+      (*(spx_int32_t*)ptr) = floor(.5+100*st->speech_prob_start);
+      break;
+
+   case SPEEX_PREPROCESS_SET_PROB_CONTINUE:
+      *(spx_int32_t*)ptr = MIN32(100,MAX32(0, *(spx_int32_t*)ptr));
+      st->speech_prob_continue = *(spx_int32_t*)ptr / 100.f;
+      break;
+   case SPEEX_PREPROCESS_GET_PROB_CONTINUE:
+      (*(spx_int32_t*)ptr) = floor(.5+100*st->speech_prob_continue);
+      break;
+
+   case SPEEX_PREPROCESS_SET_NOISE_SUPPRESS:
+      st->noise_suppress = -ABS(*(spx_int32_t*)ptr);
+      break;
+   case SPEEX_PREPROCESS_GET_NOISE_SUPPRESS:
+      (*(spx_int32_t*)ptr) = st->noise_suppress;
+      break;
+   case SPEEX_PREPROCESS_SET_ECHO_SUPPRESS:
+      st->echo_suppress = -ABS(*(spx_int32_t*)ptr);
+      break;
+   case SPEEX_PREPROCESS_GET_ECHO_SUPPRESS:
+      (*(spx_int32_t*)ptr) = st->echo_suppress;
+      break;
+   case SPEEX_PREPROCESS_SET_ECHO_SUPPRESS_ACTIVE:
+      st->echo_suppress_active = -ABS(*(spx_int32_t*)ptr);
+      break;
+   case SPEEX_PREPROCESS_GET_ECHO_SUPPRESS_ACTIVE:
+      (*(spx_int32_t*)ptr) = st->echo_suppress_active;
+      break;
+   case SPEEX_PREPROCESS_SET_ECHO_STATE:
+      st->echo_state = (SpeexEchoState*)ptr;
+      break;
+   case SPEEX_PREPROCESS_GET_ECHO_STATE:
+      (*(SpeexEchoState**)ptr) = (SpeexEchoState*)st->echo_state;
+      break;
+   case SPEEX_PREPROCESS_GET_AGC_LOUDNESS:
+      (*(spx_int32_t*)ptr) = pow(st->loudness, 1.0/LOUDNESS_EXP);
+      break;
+   case SPEEX_PREPROCESS_GET_AGC_GAIN:
+      (*(spx_int32_t*)ptr) = floor(.5+8.6858*log(st->agc_gain));
+      break;
+   case SPEEX_PREPROCESS_GET_PSD_SIZE:
+   case SPEEX_PREPROCESS_GET_NOISE_PSD_SIZE:
+      (*(spx_int32_t*)ptr) = st->ps_size;
+      break;
+   case SPEEX_PREPROCESS_GET_PSD:
+      for(i=0;i<st->ps_size;i++)
+         ((spx_int32_t *)ptr)[i] = (spx_int32_t) st->ps[i];
+      break;
+   case SPEEX_PREPROCESS_GET_NOISE_PSD:
+      for(i=0;i<st->ps_size;i++)
+         ((spx_int32_t *)ptr)[i] = (spx_int32_t) st->noise[i];
+      break;
+   case SPEEX_PREPROCESS_GET_PROB:
+      (*(spx_int32_t*)ptr) = floor(.5+100*st->speech_prob);
+      break;
+   case SPEEX_PREPROCESS_SET_AGC_TARGET:
+      st->agc_level = (*(spx_int32_t*)ptr);
+      if (st->agc_level<1)
+         st->agc_level=1;
+      if (st->agc_level>32768)
+         st->agc_level=32768;
+      break;
+   case SPEEX_PREPROCESS_GET_AGC_TARGET:
+      (*(spx_int32_t*)ptr) = st->agc_level;
+      break;
+   default:
+      speex_warning_int("Unknown speex_preprocess_ctl request: ", request);
+      return -1;
+   }
+   return 0;
+}
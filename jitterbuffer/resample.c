@@ -0,0 +1,964 @@
+/* Copyright (C) 2007-2008 Jean-Marc Valin
+   Copyright (C) 2008      Thorvald Natvig
+
+   File: resample.c
+   Arbitrary resampling code
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are
+   met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+
+   3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+   IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+   OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+   INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+   HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+   STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+   POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+   The design goals of this code are:
+      - Very fast algorithm
+      - SIMD-friendly algorithm
+      - Low memory requirement
+      - Good *perceptual* quality (and not best SNR)
+
+   Warning: This resampler is relatively new. Although I think I got rid of
+   all the major bugs and I don't expect the API to change anymore, there
+   may be something I've missed. So use with caution.
+
+   This algorithm is based on this original resampling algorithm:
+   Smith, Julius O. Digital Audio Resampling Home Page
+   Center for Computer Research in Music and Acoustics (CCRMA),
+   Stanford University, 2007.
+   Web published at http://www-ccrma.stanford.edu/~jos/resample/.
+
+   There is one main difference, though. This resampler uses cubic
+   interpolation instead of linear interpolation in the above paper. This
+   makes the table much smaller and makes it possible to compute that table
+   on a per-stream basis. In turn, being able to tweak the table for each
+   stream makes it possible to both reduce complexity on simple ratios
+   (e.g. 2/3), and get rid of the rounding operations in the inner loop.
+   The latter both reduces CPU time and makes the algorithm more SIMD-friendly.
+
+   Only the floating-point build is supported here: the fixed-point headers
+   (fixed_generic.h and friends) are not part of this tree. Samples are
+   floats on the int16 scale, as in the rest of Speex.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include <speex/config.h>
+#endif
+
+#include <speex/arch.h>
+#include <speex/speex_resampler.h>
+#include <speex/os_support.h>
+
+#include <math.h>
+#include <limits.h>
+#include <stdint.h>
+
+#ifndef NULL
+#define NULL 0
+#endif
+
+#ifdef FIXED_POINT
+#error The resampler is only available in the floating-point build
+#endif
+
+/* SSE is always there on x86-64, AVX2+FMA is picked at run time. Define
+   RESAMPLE_NO_SIMD to get the plain C loops everywhere. */
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(RESAMPLE_NO_SIMD)
+#define RESAMPLE_X86
+#include <immintrin.h>
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define IMAX(a,b) ((a) > (b) ? (a) : (b))
+#define IMIN(a,b) ((a) < (b) ? (a) : (b))
+
+/* Samples per channel copied into the history buffer at a time. Every block
+   costs a move of filt_len-1 samples of history, so bigger is faster up to
+   the point where the buffer stops fitting in L1. */
+#define RESAMPLER_BUFFER_SIZE 1024
+
+#define WORD2INT(x) ((x) < -32767.5f ? -32768 : ((x) > 32766.5f ? 32767 : (spx_int16_t)floor(.5+(x))))
+
+typedef int (*resampler_basic_func)(SpeexResamplerState *, spx_uint32_t , const float *, spx_uint32_t *, float *, spx_uint32_t *);
+/* sum(a[i] * b[i]) over len taps */
+typedef float (*inner_product_func)(const float *a, const float *b, int len);
+/* accum[k] += a[i] * b[i*oversample + k] for k = 0..3, over len taps */
+typedef void (*interpolate_product_func)(const float *a, const float *b, int len, int oversample, float *accum);
+
+struct SpeexResamplerState_ {
+   spx_uint32_t in_rate;
+   spx_uint32_t out_rate;
+   spx_uint32_t num_rate;
+   spx_uint32_t den_rate;
+
+   int    quality;
+   spx_uint32_t nb_channels;
+   spx_uint32_t filt_len;
+   spx_uint32_t mem_alloc_size;
+   spx_uint32_t buffer_size;
+   int          int_advance;
+   int          frac_advance;
+   float  cutoff;
+   spx_uint32_t oversample;
+   int          initialised;
+   int          started;
+
+   /* These are per-channel */
+   spx_int32_t  *last_sample;
+   spx_uint32_t *samp_frac_num;
+
+   float *mem;
+   float *sinc_table;
+   spx_uint32_t sinc_table_length;
+   resampler_basic_func resampler_ptr;
+   inner_product_func inner_product;
+   interpolate_product_func interpolate_product;
+
+   int    in_stride;
+   int    out_stride;
+} ;
+
+/* Kaiser window parameter of each quality level */
+#define KAISER12 12.0
+#define KAISER10 10.0
+#define KAISER8 8.0
+#define KAISER6 6.0
+
+struct QualityMapping {
+   int base_length;
+   int oversample;
+   float downsample_bandwidth;
+   float upsample_bandwidth;
+   double window_beta;
+};
+
+
+/* This table maps conversion quality to internal parameters. There are two
+   reasons that explain why the up-sampling bandwidth is larger than the
+   down-sampling bandwidth:
+   1) When up-sampling, we can assume that the spectrum is already attenuated
+      close to the Nyquist rate (from an A/D or a previous resampling filter)
+   2) Any aliasing that occurs very close to the Nyquist rate will be masked
+      by the sinusoids/noise just below the Nyquist rate (guaranteed only for
+      up-sampling).
+*/
+static const struct QualityMapping quality_map[11] = {
+   {  8,  4, 0.830f, 0.860f, KAISER6 }, /* Q0 */
+   { 16,  4, 0.850f, 0.880f, KAISER6 }, /* Q1 */
+   { 32,  4, 0.882f, 0.910f, KAISER6 }, /* Q2 */  /* 82.3% cutoff ( ~60 dB stop) 6  */
+   { 48,  8, 0.895f, 0.917f, KAISER8 }, /* Q3 */  /* 84.9% cutoff ( ~80 dB stop) 8  */
+   { 64,  8, 0.921f, 0.940f, KAISER8 }, /* Q4 */  /* 88.7% cutoff ( ~80 dB stop) 8  */
+   { 80, 16, 0.922f, 0.940f, KAISER10}, /* Q5 */  /* 89.1% cutoff (~100 dB stop) 10 */
+   { 96, 16, 0.940f, 0.945f, KAISER10}, /* Q6 */  /* 91.5% cutoff (~100 dB stop) 10 */
+   {128, 16, 0.950f, 0.950f, KAISER10}, /* Q7 */  /* 93.1% cutoff (~100 dB stop) 10 */
+   {160, 16, 0.960f, 0.960f, KAISER10}, /* Q8 */  /* 94.5% cutoff (~100 dB stop) 10 */
+   {192, 32, 0.968f, 0.968f, KAISER12}, /* Q9 */  /* 95.5% cutoff (~100 dB stop) 10 */
+   {256, 32, 0.975f, 0.975f, KAISER12}, /* Q10 */ /* 96.6% cutoff (~100 dB stop) 10 */
+};
+
+/* Zeroth order modified Bessel function of the first kind, by its power
+   series (converges quickly for the betas above) */
+static double bessel_i0(double x)
+{
+   double sum = 1.0, term = 1.0, half = x / 2;
+   int k;
+   for (k = 1; k < 50; k++)
+   {
+      term *= (half / k) * (half / k);
+      sum += term;
+      if (term < sum * 1e-12)
+         break;
+   }
+   return sum;
+}
+
+/* Kaiser window at x in [0, 1], 0 being the centre */
+static double kaiser(double x, double beta)
+{
+   if (x >= 1.0)
+      return 0.0;
+   return bessel_i0(beta * sqrt(1.0 - x * x)) / bessel_i0(beta);
+}
+
+/*8,24,40,56,80,104,128,160,200,256,320*/
+static float sinc(float cutoff, float x, int N, double beta)
+{
+   /*fprintf (stderr, "%f ", x);*/
+   float xx = x * cutoff;
+   if (fabs(x)<1e-6)
+      return cutoff;
+   else if (fabs(x) > .5*N)
+      return 0;
+   /*FIXME: Can it really be any slower than this? */
+   return cutoff*sin(M_PI*xx)/(M_PI*xx) * kaiser(fabs(2.*x/N), beta);
+}
+
+static void cubic_coef(float frac, float interp[4])
+{
+   /* Compute interpolation coefficients. I'm not sure whether this corresponds to cubic interpolation
+   but I know it's MMSE-optimal on a sinc */
+   interp[0] =  -0.16667f*frac + 0.16667f*frac*frac*frac;
+   interp[1] = frac + 0.5f*frac*frac - 0.5f*frac*frac*frac;
+   /*interp[2] = 1.f - 0.5f*frac - frac*frac + 0.5f*frac*frac*frac;*/
+   interp[3] = -0.33333f*frac + 0.5f*frac*frac - 0.16667f*frac*frac*frac;
+   /* Just to make sure we don't have rounding problems */
+   interp[2] = 1.-interp[0]-interp[1]-interp[3];
+}
+
+#ifndef RESAMPLE_X86
+
+static float inner_product_scalar(const float *a, const float *b, int len)
+{
+   /* Four partial sums, like the vector versions, so the compiler can keep
+      them in registers */
+   float sum[4] = {0, 0, 0, 0};
+   int i;
+   for (i = 0; i + 4 <= len; i += 4)
+   {
+      sum[0] += a[i] * b[i];
+      sum[1] += a[i+1] * b[i+1];
+      sum[2] += a[i+2] * b[i+2];
+      sum[3] += a[i+3] * b[i+3];
+   }
+   for (; i < len; i++)
+      sum[0] += a[i] * b[i];
+   return (sum[0] + sum[1]) + (sum[2] + sum[3]);
+}
+
+static void interpolate_product_scalar(const float *a, const float *b, int len, int oversample, float *accum)
+{
+   int i;
+   for (i = 0; i < len; i++)
+   {
+      const float curr_in = a[i];
+      const float *taps = b + i * oversample;
+      accum[0] += curr_in * taps[0];
+      accum[1] += curr_in * taps[1];
+      accum[2] += curr_in * taps[2];
+      accum[3] += curr_in * taps[3];
+   }
+}
+
+#endif /* !RESAMPLE_X86 */
+
+#ifdef RESAMPLE_X86
+
+static float inner_product_sse(const float *a, const float *b, int len)
+{
+   __m128 sum0 = _mm_setzero_ps();
+   __m128 sum1 = _mm_setzero_ps();
+   float lanes[4];
+   float sum;
+   int i;
+   for (i = 0; i + 8 <= len; i += 8)
+   {
+      sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+      sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+   }
+   _mm_storeu_ps(lanes, _mm_add_ps(sum0, sum1));
+   sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+   for (; i < len; i++)
+      sum += a[i] * b[i];
+   return sum;
+}
+
+/* The four interpolation phases of a tap are next to each other in the
+   table, so one load gets all of them */
+static void interpolate_product_sse(const float *a, const float *b, int len, int oversample, float *accum)
+{
+   /* Two chains, otherwise every tap waits for the previous add */
+   __m128 sum0 = _mm_loadu_ps(accum);
+   __m128 sum1 = _mm_setzero_ps();
+   int i;
+   for (i = 0; i + 2 <= len; i += 2)
+   {
+      sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_set1_ps(a[i]), _mm_loadu_ps(b + i * oversample)));
+      sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_set1_ps(a[i + 1]), _mm_loadu_ps(b + (i + 1) * oversample)));
+   }
+   for (; i < len; i++)
+      sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_set1_ps(a[i]), _mm_loadu_ps(b + i * oversample)));
+   _mm_storeu_ps(accum, _mm_add_ps(sum0, sum1));
+}
+
+__attribute__((target("avx2,fma")))
+static float inner_product_avx(const float *a, const float *b, int len)
+{
+   __m256 sum0 = _mm256_setzero_ps();
+   __m256 sum1 = _mm256_setzero_ps();
+   __m128 half;
+   float lanes[4];
+   float sum;
+   int i;
+   for (i = 0; i + 16 <= len; i += 16)
+   {
+      sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), sum0);
+      sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), sum1);
+   }
+   /* filt_len is a multiple of 8, this takes the last 8 when it is not one of 16 */
+   for (; i + 8 <= len; i += 8)
+      sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), sum0);
+   sum0 = _mm256_add_ps(sum0, sum1);
+   half = _mm_add_ps(_mm256_castps256_ps128(sum0), _mm256_extractf128_ps(sum0, 1));
+   _mm_storeu_ps(lanes, half);
+   /* Same as sonic: no AVX-to-SSE transition penalty for the caller */
+   _mm256_zeroupper();
+   sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+   for (; i < len; i++)
+      sum += a[i] * b[i];
+   return sum;
+}
+
+/* Two taps per instruction: the phases of tap i in the low half, those of
+   tap i+1 in the high half, folded together at the end */
+__attribute__((target("avx2,fma")))
+static void interpolate_product_avx(const float *a, const float *b, int len, int oversample, float *accum)
+{
+   const __m256i spread = _mm256_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1);
+   __m256 sum0 = _mm256_setzero_ps();
+   __m256 sum1 = _mm256_setzero_ps();
+   __m128 total;
+   int i;
+   for (i = 0; i + 4 <= len; i += 4)
+   {
+      const float *taps = b + i * oversample;
+      __m256 in = _mm256_castps128_ps256(_mm_loadu_ps(a + i));
+      __m256 in01 = _mm256_permutevar8x32_ps(in, spread);
+      __m256 in23 = _mm256_permutevar8x32_ps(in, _mm256_add_epi32(spread, _mm256_set1_epi32(2)));
+      sum0 = _mm256_fmadd_ps(in01, _mm256_loadu2_m128(taps + oversample, taps), sum0);
+      sum1 = _mm256_fmadd_ps(in23, _mm256_loadu2_m128(taps + 3 * oversample, taps + 2 * oversample), sum1);
+   }
+   sum0 = _mm256_add_ps(sum0, sum1);
+   total = _mm_add_ps(_mm_loadu_ps(accum),
+                      _mm_add_ps(_mm256_castps256_ps128(sum0), _mm256_extractf128_ps(sum0, 1)));
+   _mm256_zeroupper();
+   for (; i < len; i++)
+      total = _mm_add_ps(total, _mm_mul_ps(_mm_set1_ps(a[i]), _mm_loadu_ps(b + i * oversample)));
+   _mm_storeu_ps(accum, total);
+}
+
+#endif /* RESAMPLE_X86 */
+
+/* The fastest kernels this CPU can run */
+static void find_products(SpeexResamplerState *st)
+{
+#ifdef RESAMPLE_X86
+   if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+   {
+      st->inner_product = inner_product_avx;
+      st->interpolate_product = interpolate_product_avx;
+      return;
+   }
+   st->inner_product = inner_product_sse;
+   st->interpolate_product = interpolate_product_sse;
+#else
+   st->inner_product = inner_product_scalar;
+   st->interpolate_product = interpolate_product_scalar;
+#endif
+}
+
+static int resampler_basic_direct_single(SpeexResamplerState *st, spx_uint32_t channel_index, const float *in, spx_uint32_t *in_len, float *out, spx_uint32_t *out_len)
+{
+   const int N = st->filt_len;
+   int out_sample = 0;
+   int last_sample = st->last_sample[channel_index];
+   spx_uint32_t samp_frac_num = st->samp_frac_num[channel_index];
+   const float *sinc_table = st->sinc_table;
+   const int out_stride = st->out_stride;
+   const int int_advance = st->int_advance;
+   const int frac_advance = st->frac_advance;
+   const spx_uint32_t den_rate = st->den_rate;
+   const inner_product_func inner_product = st->inner_product;
+
+   while (!(last_sample >= (spx_int32_t)*in_len || out_sample >= (spx_int32_t)*out_len))
+   {
+      const float *sinct = & sinc_table[samp_frac_num*N];
+      const float *iptr = & in[last_sample];
+
+      out[out_stride * out_sample++] = inner_product(sinct, iptr, N);
+
+      last_sample += int_advance;
+      samp_frac_num += frac_advance;
+      if (samp_frac_num >= den_rate)
+      {
+         samp_frac_num -= den_rate;
+         last_sample++;
+      }
+   }
+
+   st->last_sample[channel_index] = last_sample;
+   st->samp_frac_num[channel_index] = samp_frac_num;
+   return out_sample;
+}
+
+static int resampler_basic_interpolate_single(SpeexResamplerState *st, spx_uint32_t channel_index, const float *in, spx_uint32_t *in_len, float *out, spx_uint32_t *out_len)
+{
+   const int N = st->filt_len;
+   int out_sample = 0;
+   int last_sample = st->last_sample[channel_index];
+   spx_uint32_t samp_frac_num = st->samp_frac_num[channel_index];
+   const int out_stride = st->out_stride;
+   const int int_advance = st->int_advance;
+   const int frac_advance = st->frac_advance;
+   const spx_uint32_t den_rate = st->den_rate;
+   const interpolate_product_func interpolate_product = st->interpolate_product;
+
+   while (!(last_sample >= (spx_int32_t)*in_len || out_sample >= (spx_int32_t)*out_len))
+   {
+      const float *iptr = & in[last_sample];
+
+      const int offset = (uint64_t)samp_frac_num*st->oversample/st->den_rate;
+      const float frac = ((float)(((uint64_t)samp_frac_num*st->oversample) % st->den_rate))/st->den_rate;
+      float interp[4];
+      float accum[4] = {0,0,0,0};
+
+      /* Tap j uses sinc_table[4 + (j+1)*oversample - offset - 2 + k], k = 0..3 */
+      interpolate_product(iptr, st->sinc_table + st->oversample - offset + 2, N, st->oversample, accum);
+      cubic_coef(frac, interp);
+      out[out_stride * out_sample++] = interp[0]*accum[0] + interp[1]*accum[1] + interp[2]*accum[2] + interp[3]*accum[3];
+
+      last_sample += int_advance;
+      samp_frac_num += frac_advance;
+      if (samp_frac_num >= den_rate)
+      {
+         samp_frac_num -= den_rate;
+         last_sample++;
+      }
+   }
+
+   st->last_sample[channel_index] = last_sample;
+   st->samp_frac_num[channel_index] = samp_frac_num;
+   return out_sample;
+}
+
+static int update_filter(SpeexResamplerState *st)
+{
+   spx_uint32_t old_length = st->filt_len;
+   spx_uint32_t old_alloc_size = st->mem_alloc_size;
+   spx_uint32_t min_sinc_table_length;
+   spx_uint32_t min_alloc_size;
+   int use_direct;
+   spx_uint32_t i;
+
+   st->int_advance = st->num_rate/st->den_rate;
+   st->frac_advance = st->num_rate%st->den_rate;
+   st->oversample = quality_map[st->quality].oversample;
+   st->filt_len = quality_map[st->quality].base_length;
+
+   if (st->num_rate > st->den_rate)
+   {
+      /* down-sampling */
+      st->cutoff = quality_map[st->quality].downsample_bandwidth * st->den_rate / st->num_rate;
+      if ((uint64_t)st->filt_len*st->num_rate/st->den_rate > INT_MAX/2)
+         goto fail;
+      /* FIXME: divide the numerator and denominator by a certain amount if they're too large */
+      st->filt_len = (uint64_t)st->filt_len*st->num_rate / st->den_rate;
+      /* Round up to make sure we have a multiple of 8 for SSE */
+      st->filt_len = ((st->filt_len-1)&(~0x7))+8;
+      if (2*st->den_rate < st->num_rate)
+         st->oversample >>= 1;
+      if (4*st->den_rate < st->num_rate)
+         st->oversample >>= 1;
+      if (8*st->den_rate < st->num_rate)
+         st->oversample >>= 1;
+      if (16*st->den_rate < st->num_rate)
+         st->oversample >>= 1;
+      if (st->oversample < 1)
+         st->oversample = 1;
+   } else {
+      /* up-sampling */
+      st->cutoff = quality_map[st->quality].upsample_bandwidth;
+   }
+
+   /* Choose the resampling type that requires the least amount of memory */
+   use_direct = (uint64_t)st->filt_len*st->den_rate <= (uint64_t)st->filt_len*st->oversample+8
+                && INT_MAX/sizeof(float)/st->den_rate >= st->filt_len;
+   if (use_direct)
+      min_sinc_table_length = st->filt_len*st->den_rate;
+   else
+      min_sinc_table_length = st->filt_len*st->oversample+8;
+
+   if (st->sinc_table_length < min_sinc_table_length)
+   {
+      float *sinc_table = (float *)speex_realloc(st->sinc_table,min_sinc_table_length*sizeof(float));
+      if (!sinc_table)
+         goto fail;
+      st->sinc_table = sinc_table;
+      st->sinc_table_length = min_sinc_table_length;
+   }
+
+   if (use_direct)
+   {
+      spx_uint32_t j;
+      for (i=0;i<st->den_rate;i++)
+      {
+         for (j=0;j<st->filt_len;j++)
+         {
+            st->sinc_table[i*st->filt_len+j] = sinc(st->cutoff,(((spx_int32_t)j-(spx_int32_t)st->filt_len/2+1)-((float)i)/st->den_rate), st->filt_len, quality_map[st->quality].window_beta);
+         }
+      }
+      st->resampler_ptr = resampler_basic_direct_single;
+   } else {
+      spx_int32_t k;
+      for (k=-4;k<(spx_int32_t)(st->oversample*st->filt_len+4);k++)
+         st->sinc_table[k+4] = sinc(st->cutoff,(k/(float)st->oversample - st->filt_len/2), st->filt_len, quality_map[st->quality].window_beta);
+      st->resampler_ptr = resampler_basic_interpolate_single;
+   }
+
+   /* Here's the place where we update the filter memory to take into account
+      the change in filter length. It's probably the messiest part of the code
+      due to handling of lots of corner cases. */
+   min_alloc_size = st->filt_len-1 + st->buffer_size;
+   if (!st->mem || (st->started && st->filt_len != old_length) || min_alloc_size > st->mem_alloc_size)
+   {
+      spx_uint32_t alloc_size = IMAX(min_alloc_size, st->mem_alloc_size);
+      float *mem = (float*)speex_alloc(st->nb_channels*alloc_size*sizeof(float));
+      if (!mem)
+         goto fail;
+      if (st->mem && st->started)
+      {
+         /* Keep the newest history at the end of the new one, and move the
+            read position so the filter stays centred on the same input. A
+            shorter filter can't look back further than it keeps, so that
+            case loses up to half the length difference of input. */
+         spx_uint32_t keep = IMIN(old_length, st->filt_len) - 1;
+         for (i=0;i<st->nb_channels;i++)
+         {
+            SPEEX_COPY(mem + i*alloc_size + st->filt_len-1 - keep,
+                       st->mem + i*old_alloc_size + old_length-1 - keep, keep);
+            st->last_sample[i] += ((spx_int32_t)st->filt_len - (spx_int32_t)old_length)/2;
+            if (st->last_sample[i] < 0)
+               st->last_sample[i] = 0;
+         }
+      }
+      speex_free(st->mem);
+      st->mem = mem;
+      st->mem_alloc_size = alloc_size;
+   } else if (!st->started)
+   {
+      SPEEX_MEMSET(st->mem, 0, st->nb_channels*st->mem_alloc_size);
+   }
+
+   return RESAMPLER_ERR_SUCCESS;
+
+fail:
+   st->resampler_ptr = NULL;
+   /* st->mem may still contain consumed input samples for the filter.
+      Restore filt_len so that filt_len - 1 still points to the position after
+      the last of these samples. */
+   st->filt_len = old_length;
+   return RESAMPLER_ERR_ALLOC_FAILED;
+}
+
+EXPORT SpeexResamplerState *speex_resampler_init(spx_uint32_t nb_channels, spx_uint32_t in_rate, spx_uint32_t out_rate, int quality, int *err)
+{
+   return speex_resampler_init_frac(nb_channels, in_rate, out_rate, in_rate, out_rate, quality, err);
+}
+
+EXPORT SpeexResamplerState *speex_resampler_init_frac(spx_uint32_t nb_channels, spx_uint32_t ratio_num, spx_uint32_t ratio_den, spx_uint32_t in_rate, spx_uint32_t out_rate, int quality, int *err)
+{
+   SpeexResamplerState *st;
+   int filter_err;
+
+   if (nb_channels == 0 || ratio_num == 0 || ratio_den == 0 || quality > 10 || quality < 0)
+   {
+      if (err)
+         *err = RESAMPLER_ERR_INVALID_ARG;
+      return NULL;
+   }
+   st = (SpeexResamplerState *)speex_alloc(sizeof(SpeexResamplerState));
+   if (!st)
+   {
+      if (err)
+         *err = RESAMPLER_ERR_ALLOC_FAILED;
+      return NULL;
+   }
+   st->initialised = 0;
+   st->started = 0;
+   st->in_rate = 0;
+   st->out_rate = 0;
+   st->num_rate = 0;
+   st->den_rate = 0;
+   st->quality = -1;
+   st->sinc_table_length = 0;
+   st->mem_alloc_size = 0;
+   st->filt_len = 0;
+   st->mem = 0;
+   st->resampler_ptr = 0;
+
+   st->cutoff = 1.f;
+   st->nb_channels = nb_channels;
+   st->in_stride = 1;
+   st->out_stride = 1;
+   st->buffer_size = RESAMPLER_BUFFER_SIZE;
+   find_products(st);
+
+   /* Per channel data */
+   if (!(st->last_sample = (spx_int32_t*)speex_alloc(nb_channels*sizeof(spx_int32_t))))
+      goto fail;
+   if (!(st->samp_frac_num = (spx_uint32_t*)speex_alloc(nb_channels*sizeof(spx_uint32_t))))
+      goto fail;
+
+   speex_resampler_set_quality(st, quality);
+   speex_resampler_set_rate_frac(st, ratio_num, ratio_den, in_rate, out_rate);
+
+   filter_err = update_filter(st);
+   if (filter_err == RESAMPLER_ERR_SUCCESS)
+   {
+      st->initialised = 1;
+   } else {
+      speex_resampler_destroy(st);
+      st = NULL;
+   }
+   if (err)
+      *err = filter_err;
+
+   return st;
+
+fail:
+   if (err)
+      *err = RESAMPLER_ERR_ALLOC_FAILED;
+   speex_resampler_destroy(st);
+   return NULL;
+}
+
+EXPORT void speex_resampler_destroy(SpeexResamplerState *st)
+{
+   speex_free(st->mem);
+   speex_free(st->sinc_table);
+   speex_free(st->last_sample);
+   speex_free(st->samp_frac_num);
+   speex_free(st);
+}
+
+static int speex_resampler_process_native(SpeexResamplerState *st, spx_uint32_t channel_index, spx_uint32_t *in_len, float *out, spx_uint32_t *out_len)
+{
+   int j=0;
+   const int N = st->filt_len;
+   int out_sample = 0;
+   float *mem = st->mem + channel_index * st->mem_alloc_size;
+   spx_uint32_t ilen;
+
+   st->started = 1;
+
+   /* Call the right resampler through the function ptr */
+   out_sample = st->resampler_ptr(st, channel_index, mem, in_len, out, out_len);
+
+   if (st->last_sample[channel_index] < (spx_int32_t)*in_len)
+      *in_len = st->last_sample[channel_index];
+   *out_len = out_sample;
+   st->last_sample[channel_index] -= *in_len;
+
+   ilen = *in_len;
+
+   for(j=0;j<N-1;++j)
+     mem[j] = mem[j+ilen];
+
+   return RESAMPLER_ERR_SUCCESS;
+}
+
+EXPORT int speex_resampler_process_float(SpeexResamplerState *st, spx_uint32_t channel_index, const float *in, spx_uint32_t *in_len, float *out, spx_uint32_t *out_len)
+{
+   int j;
+   spx_uint32_t ilen = *in_len;
+   spx_uint32_t olen = *out_len;
+   float *x = st->mem + channel_index * st->mem_alloc_size;
+   const int filt_offs = st->filt_len - 1;
+   const spx_uint32_t xlen = st->mem_alloc_size - filt_offs;
+   const int istride = st->in_stride;
+
+   if (!st->resampler_ptr)
+      return RESAMPLER_ERR_BAD_STATE;
+
+   while (ilen && olen) {
+     spx_uint32_t ichunk = (ilen > xlen) ? xlen : ilen;
+     spx_uint32_t ochunk = olen;
+
+     if (in) {
+       for(j=0;j<(spx_int32_t)ichunk;++j)
+         x[j+filt_offs]=in[j*istride];
+     } else {
+       for(j=0;j<(spx_int32_t)ichunk;++j)
+         x[j+filt_offs]=0;
+     }
+     speex_resampler_process_native(st, channel_index, &ichunk, out, &ochunk);
+     ilen -= ichunk;
+     olen -= ochunk;
+     out += ochunk * st->out_stride;
+     if (in)
+       in += ichunk * istride;
+   }
+   *in_len -= ilen;
+   *out_len -= olen;
+   return RESAMPLER_ERR_SUCCESS;
+}
+
+EXPORT int speex_resampler_process_int(SpeexResamplerState *st, spx_uint32_t channel_index, const spx_int16_t *in, spx_uint32_t *in_len, spx_int16_t *out, spx_uint32_t *out_len)
+{
+   int j;
+   const int istride_save = st->in_stride;
+   const int ostride_save = st->out_stride;
+   spx_uint32_t ilen = *in_len;
+   spx_uint32_t olen = *out_len;
+   float *x = st->mem + channel_index * st->mem_alloc_size;
+   const spx_uint32_t xlen = st->mem_alloc_size - (st->filt_len - 1);
+   const unsigned int ylen = RESAMPLER_BUFFER_SIZE;
+   float ystack[RESAMPLER_BUFFER_SIZE];
+
+   if (!st->resampler_ptr)
+      return RESAMPLER_ERR_BAD_STATE;
+
+   st->out_stride = 1;
+
+   while (ilen && olen) {
+     float *y = ystack;
+     spx_uint32_t ichunk = (ilen > xlen) ? xlen : ilen;
+     spx_uint32_t ochunk = (olen > ylen) ? ylen : olen;
+
+     if (in) {
+       for(j=0;j<(spx_int32_t)ichunk;++j)
+         x[j+st->filt_len-1]=in[j*istride_save];
+     } else {
+       for(j=0;j<(spx_int32_t)ichunk;++j)
+         x[j+st->filt_len-1]=0;
+     }
+     speex_resampler_process_native(st, channel_index, &ichunk, y, &ochunk);
+
+     for (j=0;j<(spx_int32_t)ochunk;++j)
+       out[j*ostride_save] = WORD2INT(ystack[j]);
+
+     ilen -= ichunk;
+     olen -= ochunk;
+     out += ochunk * ostride_save;
+     if (in)
+       in += ichunk * istride_save;
+   }
+   st->out_stride = ostride_save;
+   *in_len -= ilen;
+   *out_len -= olen;
+
+   return RESAMPLER_ERR_SUCCESS;
+}
+
+EXPORT int speex_resampler_process_interleaved_float(SpeexResamplerState *st, const float *in, spx_uint32_t *in_len, float *out, spx_uint32_t *out_len)
+{
+   spx_uint32_t i;
+   int istride_save, ostride_save;
+   spx_uint32_t bak_out_len = *out_len;
+   spx_uint32_t bak_in_len = *in_len;
+   istride_save = st->in_stride;
+   ostride_save = st->out_stride;
+   st->in_stride = st->out_stride = st->nb_channels;
+   for (i=0;i<st->nb_channels;i++)
+   {
+      *out_len = bak_out_len;
+      *in_len = bak_in_len;
+      if (in != NULL)
+         speex_resampler_process_float(st, i, in+i, in_len, out+i, out_len);
+      else
+         speex_resampler_process_float(st, i, NULL, in_len, out+i, out_len);
+   }
+   st->in_stride = istride_save;
+   st->out_stride = ostride_save;
+   return st->resampler_ptr ? RESAMPLER_ERR_SUCCESS : RESAMPLER_ERR_BAD_STATE;
+}
+
+EXPORT int speex_resampler_process_interleaved_int(SpeexResamplerState *st, const spx_int16_t *in, spx_uint32_t *in_len, spx_int16_t *out, spx_uint32_t *out_len)
+{
+   spx_uint32_t i;
+   int istride_save, ostride_save;
+   spx_uint32_t bak_out_len = *out_len;
+   spx_uint32_t bak_in_len = *in_len;
+   istride_save = st->in_stride;
+   ostride_save = st->out_stride;
+   st->in_stride = st->out_stride = st->nb_channels;
+   for (i=0;i<st->nb_channels;i++)
+   {
+      *out_len = bak_out_len;
+      *in_len = bak_in_len;
+      if (in != NULL)
+         speex_resampler_process_int(st, i, in+i, in_len, out+i, out_len);
+      else
+         speex_resampler_process_int(st, i, NULL, in_len, out+i, out_len);
+   }
+   st->in_stride = istride_save;
+   st->out_stride = ostride_save;
+   return st->resampler_ptr ? RESAMPLER_ERR_SUCCESS : RESAMPLER_ERR_BAD_STATE;
+}
+
+EXPORT int speex_resampler_set_rate(SpeexResamplerState *st, spx_uint32_t in_rate, spx_uint32_t out_rate)
+{
+   return speex_resampler_set_rate_frac(st, in_rate, out_rate, in_rate, out_rate);
+}
+
+EXPORT void speex_resampler_get_rate(SpeexResamplerState *st, spx_uint32_t *in_rate, spx_uint32_t *out_rate)
+{
+   *in_rate = st->in_rate;
+   *out_rate = st->out_rate;
+}
+
+static spx_uint32_t compute_gcd(spx_uint32_t a, spx_uint32_t b)
+{
+   while (b != 0)
+   {
+      spx_uint32_t temp = a;
+
+      a = b;
+      b = temp % b;
+   }
+   return a;
+}
+
+EXPORT int speex_resampler_set_rate_frac(SpeexResamplerState *st, spx_uint32_t ratio_num, spx_uint32_t ratio_den, spx_uint32_t in_rate, spx_uint32_t out_rate)
+{
+   spx_uint32_t fact;
+   spx_uint32_t old_den;
+   spx_uint32_t i;
+
+   if (ratio_num == 0 || ratio_den == 0)
+      return RESAMPLER_ERR_INVALID_ARG;
+
+   if (st->in_rate == in_rate && st->out_rate == out_rate && st->num_rate == ratio_num && st->den_rate == ratio_den)
+      return RESAMPLER_ERR_SUCCESS;
+
+   old_den = st->den_rate;
+   st->in_rate = in_rate;
+   st->out_rate = out_rate;
+   st->num_rate = ratio_num;
+   st->den_rate = ratio_den;
+
+   fact = compute_gcd(st->num_rate, st->den_rate);
+
+   st->num_rate /= fact;
+   st->den_rate /= fact;
+
+   if (old_den > 0)
+   {
+      for (i=0;i<st->nb_channels;i++)
+      {
+         st->samp_frac_num[i] = (uint64_t)st->samp_frac_num[i]*st->den_rate/old_den;
+         /* Safety net */
+         if (st->samp_frac_num[i] >= st->den_rate)
+            st->samp_frac_num[i] = st->den_rate-1;
+      }
+   }
+
+   if (st->initialised)
+      return update_filter(st);
+   return RESAMPLER_ERR_SUCCESS;
+}
+
+EXPORT void speex_resampler_get_ratio(SpeexResamplerState *st, spx_uint32_t *ratio_num, spx_uint32_t *ratio_den)
+{
+   *ratio_num = st->num_rate;
+   *ratio_den = st->den_rate;
+}
+
+EXPORT int speex_resampler_set_quality(SpeexResamplerState *st, int quality)
+{
+   if (quality > 10 || quality < 0)
+      return RESAMPLER_ERR_INVALID_ARG;
+   if (st->quality == quality)
+      return RESAMPLER_ERR_SUCCESS;
+   st->quality = quality;
+   if (st->initialised)
+      return update_filter(st);
+   return RESAMPLER_ERR_SUCCESS;
+}
+
+EXPORT void speex_resampler_get_quality(SpeexResamplerState *st, int *quality)
+{
+   *quality = st->quality;
+}
+
+EXPORT void speex_resampler_set_input_stride(SpeexResamplerState *st, spx_uint32_t stride)
+{
+   st->in_stride = stride;
+}
+
+EXPORT void speex_resampler_get_input_stride(SpeexResamplerState *st, spx_uint32_t *stride)
+{
+   *stride = st->in_stride;
+}
+
+EXPORT void speex_resampler_set_output_stride(SpeexResamplerState *st, spx_uint32_t stride)
+{
+   st->out_stride = stride;
+}
+
+EXPORT void speex_resampler_get_output_stride(SpeexResamplerState *st, spx_uint32_t *stride)
+{
+   *stride = st->out_stride;
+}
+
+EXPORT int speex_resampler_get_input_latency(SpeexResamplerState *st)
+{
+  return st->filt_len / 2;
+}
+
+EXPORT int speex_resampler_get_output_latency(SpeexResamplerState *st)
+{
+  return ((st->filt_len / 2) * st->den_rate + (st->num_rate >> 1)) / st->num_rate;
+}
+
+EXPORT int speex_resampler_skip_zeros(SpeexResamplerState *st)
+{
+   spx_uint32_t i;
+   for (i=0;i<st->nb_channels;i++)
+      st->last_sample[i] = st->filt_len/2;
+   return RESAMPLER_ERR_SUCCESS;
+}
+
+EXPORT int speex_resampler_reset_mem(SpeexResamplerState *st)
+{
+   spx_uint32_t i;
+   for (i=0;i<st->nb_channels;i++)
+   {
+      st->last_sample[i] = 0;
+      st->samp_frac_num[i] = 0;
+   }
+   SPEEX_MEMSET(st->mem, 0, st->nb_channels*st->mem_alloc_size);
+   st->started = 0;
+   return RESAMPLER_ERR_SUCCESS;
+}
+
+EXPORT const char *speex_resampler_strerror(int err)
+{
+   switch (err)
+   {
+      case RESAMPLER_ERR_SUCCESS:
+         return "Success.";
+      case RESAMPLER_ERR_ALLOC_FAILED:
+         return "Memory allocation failed.";
+      case RESAMPLER_ERR_BAD_STATE:
+         return "Bad resampler state.";
+      case RESAMPLER_ERR_INVALID_ARG:
+         return "Invalid argument.";
+      case RESAMPLER_ERR_PTR_OVERLAP:
+         return "Input and output buffers overlap.";
+      default:
+         return "Unknown error. Bad error code or strange version.";
+   }
+}
@@ -0,0 +1,93 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <speex/speex_resampler.h>
+
+// Streams a sine through the resampler in 10 ms frames at every quality level and reports the
+// throughput (ns per output sample, times real time) and how far the output is from the ideal
+// sine at the output rate.
+// Usage: ResamplerBench [in rate] [out rate] [seconds] [channels]
+
+#define FRAME_MS 10
+#define TONE_HZ 997.0
+#define AMPLITUDE 16000.0
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+static double nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Error of the output against the sine it should be, in dB below the tone. The first and last
+// 50 ms are left out, the filter is still filling up / draining there.
+static double errorDb(const short *out, int numSamples, int channels, int rate) {
+    double signal = 0, noise = 0;
+    int edge = rate / 20;
+    for (int i = edge; i < numSamples - edge; i++) {
+        double ideal = AMPLITUDE * sin(2 * M_PI * TONE_HZ * i / rate);
+        for (int c = 0; c < channels; c++) {
+            double diff = out[(size_t)i * channels + c] - ideal;
+            signal += ideal * ideal;
+            noise += diff * diff;
+        }
+    }
+    return noise > 0 ? 10 * log10(signal / noise) : 999;
+}
+
+int main(int argc, char **argv) {
+    int inRate = argc > 1 ? atoi(argv[1]) : 44100;
+    int outRate = argc > 2 ? atoi(argv[2]) : 48000;
+    int seconds = argc > 3 ? atoi(argv[3]) : 20;
+    int channels = argc > 4 ? atoi(argv[4]) : 2;
+    int inSamples = inRate * seconds;
+    int outCapacity = (int)((long long)inSamples * outRate / inRate) + outRate;
+    int frame = inRate * FRAME_MS / 1000;
+
+    short *in = (short*)malloc((size_t)inSamples * channels * sizeof(short));
+    short *out = (short*)malloc((size_t)outCapacity * channels * sizeof(short));
+    for (int i = 0; i < inSamples; i++) {
+        short value = (short)lrint(AMPLITUDE * sin(2 * M_PI * TONE_HZ * i / inRate));
+        for (int c = 0; c < channels; c++)
+            in[(size_t)i * channels + c] = value;
+    }
+
+    printf("%d Hz -> %d Hz, %d s, %d channel(s), %d ms frames\n", inRate, outRate, seconds, channels, FRAME_MS);
+    printf("quality  ns/sample  x realtime  error dB  latency\n");
+    for (int quality = SPEEX_RESAMPLER_QUALITY_MIN; quality <= SPEEX_RESAMPLER_QUALITY_MAX; quality++) {
+        int err;
+        SpeexResamplerState *st = speex_resampler_init(channels, inRate, outRate, quality, &err);
+        if (!st) {
+            fprintf(stderr, "speex_resampler_init: %s\n", speex_resampler_strerror(err));
+            return 1;
+        }
+        // Output aligned with the input, so it can be compared with the ideal sine
+        speex_resampler_skip_zeros(st);
+
+        int written = 0;
+        double start = nowNs();
+        for (int pos = 0; pos < inSamples; pos += frame) {
+            spx_uint32_t inLen = inSamples - pos < frame ? inSamples - pos : frame;
+            spx_uint32_t outLen = outCapacity - written;
+            speex_resampler_process_interleaved_int(st, in + (size_t)pos * channels, &inLen,
+                                                    out + (size_t)written * channels, &outLen);
+            written += outLen;
+        }
+        double elapsed = nowNs() - start;
+
+        printf("%7d  %9.2f  %10.0f  %8.1f  %4d ms\n", quality,
+               elapsed / ((double)written * channels),
+               seconds * 1e9 / elapsed,
+               errorDb(out, written, channels, outRate),
+               speex_resampler_get_output_latency(st) * 1000 / outRate);
+        speex_resampler_destroy(st);
+    }
+
+    free(in);
+    free(out);
+    return 0;
+}
@@ -19,13 +19,12 @@
 #define _ALLOCA_S_THRESHOLD 10240
 #endif
 
-/* Default to floating point */
+/* Default to floating point. smallft.c is not part of this tree, so the
+   KISS FFT is used in both builds. */
 #ifndef FIXED_POINT
 #  define FLOATING_POINT
-#  define USE_SMALLFT
-#else
-#  define USE_KISS_FFT
 #endif
+#define USE_KISS_FFT
 
 /* We don't support visibility on Win32 */
 #define EXPORT
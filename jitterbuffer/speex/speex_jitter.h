@@ -53,6 +53,9 @@ struct JitterBuffer_;
 /** Generic adaptive jitter buffer state */
 typedef struct JitterBuffer_ JitterBuffer;
 
+/** Manager for many jitter buffers, see jitter_manager_init() */
+typedef struct JitterManager_ JitterManager;
+
 /** Definition of an incoming packet */
 typedef struct _JitterBufferPacket JitterBufferPacket;
 
@@ -66,6 +69,39 @@ struct _JitterBufferPacket {
    spx_uint32_t user_data;  /**< Put whatever data you like here (it's ignored by the jitter buffer) */
 };
 
+/** Jitter buffer statistics, see JITTER_BUFFER_GET_STATS. Counters start at 0 when the jitter 
+    buffer is created, are kept across jitter_buffer_reset() and are cleared by JITTER_BUFFER_RESET_STATS. */
+typedef struct JitterBufferStats_ {
+   spx_uint32_t received;      /**< Packets given to jitter_buffer_put() */
+   spx_uint32_t late;          /**< Packets that arrived after the time they were due (they may still be played) */
+   spx_uint32_t discarded;     /**< Packets dropped without being returned (too late, never played or no room left) */
+   spx_uint32_t returned;      /**< Packets returned by jitter_buffer_get() and jitter_buffer_get_another() */
+   spx_uint32_t lost;          /**< Calls to jitter_buffer_get() that found no packet to play (missing or concealed) */
+   spx_uint32_t inserted;      /**< Timestamp units inserted to increase the buffering */
+   spx_uint32_t dropped;       /**< Timestamp units skipped to reduce the buffering */
+   spx_int32_t  drift;         /**< dropped - inserted: positive when the sender runs faster than the playout */
+   spx_int32_t  jitter;        /**< Interarrival jitter estimate as in RFC 3550 (timestamp units) */
+   spx_int32_t  buffer_delay;  /**< Data buffered ahead of the playout pointer (timestamp units) */
+   spx_int32_t  target_delay;  /**< Last delay adjustment wanted (timestamp units, negative means more buffering) */
+   spx_int32_t  stored;        /**< Packets currently stored */
+} JitterBufferStats;
+
+/** Trace event passed to the JITTER_BUFFER_SET_TRACE callback. The meaning of a, b and c depends on type. */
+typedef struct JitterBufferTraceEvent_ {
+   int          type;               /**< One of the JITTER_BUFFER_TRACE_* values */
+   spx_uint32_t pointer_timestamp;  /**< Playout pointer when the event happened */
+   spx_uint32_t next_stop;          /**< Current "arrival time" (end of the last tick) */
+   spx_int32_t  a;
+   spx_int32_t  b;
+   spx_int32_t  c;
+} JitterBufferTraceEvent;
+
+/** Trace callback and its argument, see JITTER_BUFFER_SET_TRACE */
+typedef struct JitterBufferTrace_ {
+   void (*callback)(const JitterBufferTraceEvent *event, void *arg);
+   void *arg;
+} JitterBufferTrace;
+
 /** Packet has been retrieved */
 #define JITTER_BUFFER_OK 0
 /** Packet is lost or is late */
@@ -113,6 +149,50 @@ struct _JitterBufferPacket {
 #define JITTER_BUFFER_SET_LATE_COST 12
 #define JITTER_BUFFER_GET_LATE_COST 13
 
+/** Number of most recent packets used by the short-term delay estimate (1 to 64, default 16) */
+#define JITTER_BUFFER_SET_SHORT_TERM_WINDOW 14
+#define JITTER_BUFFER_GET_SHORT_TERM_WINDOW 15
+
+/** How much (in percent) the short-term estimate can pull the delay down when the network gets 
+    better. An increase it asks for is always applied. 0 disables the short-term estimate (default 50). */
+#define JITTER_BUFFER_SET_SHORT_TERM_WEIGHT 16
+#define JITTER_BUFFER_GET_SHORT_TERM_WEIGHT 17
+
+/** Get all the statistics in one call (JitterBufferStats*). Constant time, cheap enough to poll on every tick. */
+#define JITTER_BUFFER_GET_STATS 18
+/** Clear the statistics counters (ptr is ignored) */
+#define JITTER_BUFFER_RESET_STATS 19
+/** Install a trace callback (JitterBufferTrace*, callback NULL to disable). Only available when the 
+    jitter buffer is compiled with JITTER_BUFFER_TRACE, otherwise tracing costs nothing and this returns -1.
+    The callback runs synchronously from put/get/tick and must not call back into the jitter buffer. */
+#define JITTER_BUFFER_SET_TRACE 20
+
+/** Turn automatic delay adjustment in jitter_buffer_tick() on or off (spx_int32_t). Calling 
+    jitter_buffer_update_delay() turns it off too. */
+#define JITTER_BUFFER_SET_AUTO_ADJUST 21
+/** Get whether automatic delay adjustment is on (spx_int32_t) */
+#define JITTER_BUFFER_GET_AUTO_ADJUST 22
+/** Get the delay adjustment the jitter buffer would make now, without making it (spx_int32_t, 
+    timestamp units): positive means that much buffering could be removed, negative that more 
+    is needed. Lets the application adjust smoothly, e.g. by time-stretching. */
+#define JITTER_BUFFER_GET_OPT_DELAY 23
+/** Tell the jitter buffer the application removed (positive) or added (negative) this much 
+    buffering on its own, e.g. by playing faster or slower (spx_int32_t, timestamp units) */
+#define JITTER_BUFFER_ADJUST_DELAY 24
+
+/** A timing (arrival time relative to the playout, a) was added to the delay histogram */
+#define JITTER_BUFFER_TRACE_TIMING 0
+/** The oldest timing sub-window was dropped, a is the number of timings left */
+#define JITTER_BUFFER_TRACE_ROTATE 1
+/** Optimal delay computed: a is the adjustment, b its cost, c the number of timings used */
+#define JITTER_BUFFER_TRACE_OPT_DELAY 2
+/** Buffering adjusted by a timestamp units (negative means more buffering) */
+#define JITTER_BUFFER_TRACE_ADJUST 3
+/** No packet to play: a is the span to conceal, b is 1 if it was an insertion to increase the buffering */
+#define JITTER_BUFFER_TRACE_LOSS 4
+/** The buffer resynchronised on the packet with timestamp a after too many losses */
+#define JITTER_BUFFER_TRACE_RESET 5
+
 
 /** Initialises jitter buffer 
  * 
@@ -136,12 +216,45 @@ void jitter_buffer_reset(JitterBuffer *jitter);
 void jitter_buffer_destroy(JitterBuffer *jitter);
 
 /** Put one packet into the jitter buffer
- * 
+ *
+ * Cost is O(log n) for n stored packets, plus O(log n) per stale packet it cleans up. When the
+ * buffer is full, the earliest packet is evicted in O(log n), so a put under overload stays
+ * bounded (about 16 heap steps per packet with the 200 packet buffer).
+ *
  * @param jitter Jitter buffer state
  * @param packet Incoming packet
 */
 void jitter_buffer_put(JitterBuffer *jitter, const JitterBufferPacket *packet);
 
+/** Put several packets into the jitter buffer, e.g. everything one recvmmsg() returned
+ * 
+ * The batch is taken in runs of 64 packets in the order given, and each run is inserted in 
+ * timestamp order, so a batch of up to 64 goes in as if jitter_buffer_put() were called on each 
+ * packet in timestamp order. A larger batch is only sorted within each run. Old packets are 
+ * cleaned up once, before the first insert, instead of before every packet. 
+ * 
+ * @param jitter Jitter buffer state
+ * @param packets Incoming packets (any order)
+ * @param nb_packets Number of packets
+*/
+void jitter_buffer_put_many(JitterBuffer *jitter, const JitterBufferPacket *packets, int nb_packets);
+
+/** Put one packet into the jitter buffer from another thread
+ * 
+ * Meant for a network thread feeding a jitter buffer that is read by the playout thread. The 
+ * packet is pushed on a lock-free inbox (any number of threads may call this concurrently) and
+ * inserted by the next jitter_buffer_get(), jitter_buffer_tick() or JITTER_BUFFER_GET_AVALIABLE_COUNT 
+ * from the playout thread, so its arrival time has the resolution of one tick. Every other call
+ * must come from the playout thread. As with jitter_buffer_put(), the data is copied if no 
+ * destroy callback is set (the buffer frees the copy), and adopted if one is (packets that turn 
+ * out to be too late are handed to it). Don't change the callback while packets may still be 
+ * waiting in the inbox. jitter_buffer_reset() drops the packets still waiting there. 
+ * 
+ * @param jitter Jitter buffer state
+ * @param packet Incoming packet
+*/
+void jitter_buffer_put_async(JitterBuffer *jitter, const JitterBufferPacket *packet);
+
 /** Get one packet from the jitter buffer
  * 
  * @param jitter Jitter buffer state
@@ -188,6 +301,52 @@ int jitter_buffer_ctl(JitterBuffer *jitter, int request, void *ptr);
 
 int jitter_buffer_update_delay(JitterBuffer *jitter, JitterBufferPacket *packet, spx_int32_t *start_offset);
 
+/** Creates a manager for many jitter buffers ticked together. The state every tick touches
+ *  (playout pointer, arrival time, buffering, loss count) is kept in contiguous arrays so that 
+ *  jitter_manager_tick_all() stays cheap with thousands of streams. All calls for a managed 
+ *  stream must go through the jitter_manager_* functions.
+ * 
+ * @param max_streams Maximum number of streams
+ * @return Newly created manager
+ */
+JitterManager *jitter_manager_init(int max_streams);
+
+/** Destroys the manager and all its streams
+ * 
+ * @param mgr Manager state
+ */
+void jitter_manager_destroy(JitterManager *mgr);
+
+/** Adds a stream (same as jitter_buffer_init())
+ * 
+ * @param mgr Manager state
+ * @param step_size Starting value for the size of concealment packets and delay adjustment steps
+ * @return Stream index, -1 if the manager is full
+ */
+int jitter_manager_add_stream(JitterManager *mgr, int step_size);
+
+/** Same as jitter_buffer_put() on one stream */
+void jitter_manager_put(JitterManager *mgr, int stream, const JitterBufferPacket *packet);
+
+/** Same as jitter_buffer_put_many() on one stream */
+void jitter_manager_put_many(JitterManager *mgr, int stream, const JitterBufferPacket *packets, int nb_packets);
+
+/** Same as jitter_buffer_get() on one stream */
+int jitter_manager_get(JitterManager *mgr, int stream, JitterBufferPacket *packet, spx_int32_t desired_span, spx_int32_t *start_offset);
+
+/** Same as jitter_buffer_get_another() on one stream */
+int jitter_manager_get_another(JitterManager *mgr, int stream, JitterBufferPacket *packet);
+
+/** Same as jitter_buffer_ctl() on one stream */
+int jitter_manager_ctl(JitterManager *mgr, int stream, int request, void *ptr);
+
+/** Same as calling jitter_buffer_tick() on every stream. Streams whose delay adjustment is known 
+ *  to be a no-op are skipped, and negative buffering is reported once for all streams.
+ * 
+ * @param mgr Manager state
+ */
+void jitter_manager_tick_all(JitterManager *mgr);
+
 /* @} */
 
 #ifdef __cplusplus